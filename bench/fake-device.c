@@ -0,0 +1,481 @@
+/*
+ * Copyright © 2017 Michael Heimpold <mhei@heimpold.de>
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <poll.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "fake-device.h"
+
+/* how often the threads look whether they should stop, in milliseconds */
+#define FAKE_POLL_INTERVAL 100
+
+/* size of the receive buffer of a connection, requests are small */
+#define FAKE_REQUEST_MAX (64 * 1024)
+
+/* serial number of the first device, the others count up */
+#define FAKE_SERIAL_BASE 10000000
+
+struct fake_device {
+	struct fake_device_opts opts;
+
+	int udp_fd;
+	int http_fd;
+
+	pthread_t udp_thread;
+	pthread_t http_thread;
+
+	/* pre-generated body of the GET responses */
+	char *body;
+	size_t body_len;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	/* cleared to stop all threads */
+	int running;
+
+	/* count of connection threads still alive */
+	unsigned int connections;
+
+	unsigned long queries;
+	unsigned long requests;
+};
+
+/* an accepted API connection, served by its own thread */
+struct fake_conn {
+	struct fake_device *fd;
+	int s;
+};
+
+/* approximate size of a single channel of the generated body */
+#define FAKE_CHANNEL_SIZE 48
+
+unsigned int fake_device_channels(size_t response_size)
+{
+	unsigned int n = response_size / FAKE_CHANNEL_SIZE;
+
+	return n ? : 1;
+}
+
+/* body of the GET responses: {"device": {...}, "channels": {"ch0000": {...}, ...}} */
+static int fake_generate_body(struct fake_device *fd)
+{
+	unsigned int i, n = fake_device_channels(fd->opts.response_size);
+	size_t size = 128 + (size_t)n * (FAKE_CHANNEL_SIZE + 16);
+	size_t len;
+
+	fd->body = malloc(size);
+	if (!fd->body)
+		return -1;
+
+	len = snprintf(fd->body, size,
+	               "{\"device\": {\"product\": \"XPL fake\", \"serial\": \"%08u\"}, \"channels\": {",
+	               FAKE_SERIAL_BASE);
+
+	for (i = 0; i < n; i++)
+		len += snprintf(fd->body + len, size - len,
+		                "%s\"ch%04u\": {\"value\": %u, \"mode\": \"on\", \"name\": \"channel\"}",
+		                i ? ", " : "", i, i);
+
+	len += snprintf(fd->body + len, size - len, "}}");
+	fd->body_len = len;
+
+	return 0;
+}
+
+static int fake_running(struct fake_device *fd)
+{
+	int running;
+
+	pthread_mutex_lock(&fd->lock);
+	running = fd->running;
+	pthread_mutex_unlock(&fd->lock);
+
+	return running;
+}
+
+/* wait until the socket is readable, returns 0 when asked to stop */
+static int fake_wait(struct fake_device *fd, int s)
+{
+	struct pollfd pfd = { .fd = s, .events = POLLIN };
+	int rv;
+
+	while (fake_running(fd)) {
+		rv = poll(&pfd, 1, FAKE_POLL_INTERVAL);
+		if (rv > 0)
+			return 1;
+		if (rv == -1 && errno != EINTR)
+			return 0;
+	}
+
+	return 0;
+}
+
+static void *fake_udp_thread(void *arg)
+{
+	struct fake_device *fd = (struct fake_device *)arg;
+	struct sockaddr_storage peer;
+	socklen_t peerlen;
+	char buf[2048], body[256], pkt[512];
+	unsigned int i;
+	ssize_t len;
+	int blen, plen;
+
+	while (fake_wait(fd, fd->udp_fd)) {
+		peerlen = sizeof(peer);
+		len = recvfrom(fd->udp_fd, buf, sizeof(buf) - 1, 0, (struct sockaddr *)&peer, &peerlen);
+		if (len <= 0)
+			continue;
+		buf[len] = '\0';
+
+		/* only answer XPL search queries */
+		if (!strstr(buf, "NT: i2se:iodevice"))
+			continue;
+
+		pthread_mutex_lock(&fd->lock);
+		fd->queries++;
+		pthread_mutex_unlock(&fd->lock);
+
+		if (fd->opts.latency_us)
+			usleep(fd->opts.latency_us);
+
+		for (i = 0; i < fd->opts.devices; i++) {
+			blen = snprintf(body, sizeof(body),
+			                "{\"serial\": \"%08u\", \"mac_address\": \"00:01:87:%02x:%02x:%02x\", "
+			                "\"product\": \"XPL fake\", \"software_version\": \"1.0\"}",
+			                FAKE_SERIAL_BASE + i, (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+
+			plen = snprintf(pkt, sizeof(pkt),
+			                "NOTIFY * HTTP/1.0\r\n"
+			                "Content-Type: application/json\r\n"
+			                "Content-Length: %d\r\n"
+			                "\r\n"
+			                "%s", blen, body);
+
+			sendto(fd->udp_fd, pkt, plen, 0, (struct sockaddr *)&peer, peerlen);
+		}
+	}
+
+	return NULL;
+}
+
+static int fake_write_all(int s, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = send(s, buf, len, MSG_NOSIGNAL);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static int fake_respond(struct fake_device *fd, int s, const char *body, size_t body_len)
+{
+	char hdr[256];
+	int hlen;
+
+	hlen = snprintf(hdr, sizeof(hdr),
+	                "HTTP/1.1 200 OK\r\n"
+	                "Content-Type: application/json\r\n"
+	                "Content-Length: %zu\r\n"
+	                "\r\n", body_len);
+
+	if (fd->opts.latency_us)
+		usleep(fd->opts.latency_us);
+
+	if (fake_write_all(s, hdr, hlen) == -1)
+		return -1;
+
+	return fake_write_all(s, body, body_len);
+}
+
+/* length of the body announced in the header, zero if there is none */
+static long fake_content_length(const char *hdr)
+{
+	const char *p = hdr;
+
+	while ((p = strstr(p, "\r\n"))) {
+		p += 2;
+		if (strncasecmp(p, "Content-Length:", 15) == 0)
+			return strtol(p + 15, NULL, 10);
+	}
+
+	return 0;
+}
+
+static void *fake_conn_thread(void *arg)
+{
+	struct fake_conn *conn = (struct fake_conn *)arg;
+	struct fake_device *fd = conn->fd;
+	int s = conn->s;
+	char *buf, *end;
+	size_t len = 0, hlen, total;
+	long clen;
+	ssize_t n;
+
+	free(conn);
+
+	buf = malloc(FAKE_REQUEST_MAX + 1);
+	if (!buf)
+		goto out;
+
+	while (fake_wait(fd, s)) {
+		n = recv(s, buf + len, FAKE_REQUEST_MAX - len, 0);
+		if (n <= 0)
+			break;
+		len += n;
+		buf[len] = '\0';
+
+		/* handle all complete requests in the buffer (pipelining) */
+		while ((end = strstr(buf, "\r\n\r\n"))) {
+			hlen = end + 4 - buf;
+			clen = fake_content_length(buf);
+			if (clen < 0 || hlen + clen > FAKE_REQUEST_MAX)
+				goto out;
+
+			total = hlen + clen;
+			if (len < total)
+				break;
+
+			pthread_mutex_lock(&fd->lock);
+			fd->requests++;
+			pthread_mutex_unlock(&fd->lock);
+
+			/* a set responds with the new values, i.e. the posted body */
+			if (strncmp(buf, "POST ", 5) == 0) {
+				if (fake_respond(fd, s, buf + hlen, clen) == -1)
+					goto out;
+			} else {
+				if (fake_respond(fd, s, fd->body, fd->body_len) == -1)
+					goto out;
+			}
+
+			memmove(buf, buf + total, len - total);
+			len -= total;
+			buf[len] = '\0';
+		}
+
+		if (len == FAKE_REQUEST_MAX)
+			break;
+	}
+
+out:
+	free(buf);
+	close(s);
+
+	pthread_mutex_lock(&fd->lock);
+	fd->connections--;
+	pthread_cond_broadcast(&fd->cond);
+	pthread_mutex_unlock(&fd->lock);
+
+	return NULL;
+}
+
+static void *fake_http_thread(void *arg)
+{
+	struct fake_device *fd = (struct fake_device *)arg;
+	pthread_attr_t attr;
+	struct fake_conn *conn;
+	pthread_t thread;
+	int s, one = 1;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	while (fake_wait(fd, fd->http_fd)) {
+		s = accept(fd->http_fd, NULL, NULL);
+		if (s == -1)
+			continue;
+
+		setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		conn = malloc(sizeof(struct fake_conn));
+		if (!conn) {
+			close(s);
+			continue;
+		}
+		conn->fd = fd;
+		conn->s = s;
+
+		pthread_mutex_lock(&fd->lock);
+		fd->connections++;
+		pthread_mutex_unlock(&fd->lock);
+
+		if (pthread_create(&thread, &attr, fake_conn_thread, conn)) {
+			free(conn);
+			close(s);
+
+			pthread_mutex_lock(&fd->lock);
+			fd->connections--;
+			pthread_mutex_unlock(&fd->lock);
+		}
+	}
+
+	pthread_attr_destroy(&attr);
+	return NULL;
+}
+
+/* bind a socket to the loopback address, returns the port in use or -1 */
+static int fake_bind(int s, unsigned int port)
+{
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof(addr);
+	int one = 1;
+
+	setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+
+	if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+		return -1;
+
+	if (getsockname(s, (struct sockaddr *)&addr, &addrlen) == -1)
+		return -1;
+
+	return ntohs(addr.sin_port);
+}
+
+struct fake_device *fake_device_start(const struct fake_device_opts *opts)
+{
+	struct fake_device *fd;
+	int port;
+
+	fd = calloc(1, sizeof(struct fake_device));
+	if (!fd)
+		return NULL;
+
+	fd->opts = *opts;
+	fd->running = 1;
+	pthread_mutex_init(&fd->lock, NULL);
+	pthread_cond_init(&fd->cond, NULL);
+
+	if (fake_generate_body(fd) == -1)
+		goto free_out;
+
+	fd->udp_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd->udp_fd == -1)
+		goto body_out;
+
+	port = fake_bind(fd->udp_fd, opts->udp_port);
+	if (port == -1)
+		goto udp_out;
+	fd->opts.udp_port = port;
+
+	fd->http_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd->http_fd == -1)
+		goto udp_out;
+
+	port = fake_bind(fd->http_fd, opts->http_port);
+	if (port == -1 || listen(fd->http_fd, 128) == -1)
+		goto http_out;
+	fd->opts.http_port = port;
+
+	if (pthread_create(&fd->udp_thread, NULL, fake_udp_thread, fd))
+		goto http_out;
+
+	if (pthread_create(&fd->http_thread, NULL, fake_http_thread, fd)) {
+		pthread_mutex_lock(&fd->lock);
+		fd->running = 0;
+		pthread_mutex_unlock(&fd->lock);
+		pthread_join(fd->udp_thread, NULL);
+		goto http_out;
+	}
+
+	return fd;
+
+http_out:
+	close(fd->http_fd);
+udp_out:
+	close(fd->udp_fd);
+body_out:
+	free(fd->body);
+free_out:
+	pthread_cond_destroy(&fd->cond);
+	pthread_mutex_destroy(&fd->lock);
+	free(fd);
+	return NULL;
+}
+
+unsigned int fake_device_udp_port(struct fake_device *fd)
+{
+	return fd->opts.udp_port;
+}
+
+unsigned int fake_device_http_port(struct fake_device *fd)
+{
+	return fd->opts.http_port;
+}
+
+unsigned long fake_device_queries(struct fake_device *fd)
+{
+	unsigned long v;
+
+	pthread_mutex_lock(&fd->lock);
+	v = fd->queries;
+	pthread_mutex_unlock(&fd->lock);
+
+	return v;
+}
+
+unsigned long fake_device_requests(struct fake_device *fd)
+{
+	unsigned long v;
+
+	pthread_mutex_lock(&fd->lock);
+	v = fd->requests;
+	pthread_mutex_unlock(&fd->lock);
+
+	return v;
+}
+
+void fake_device_stop(struct fake_device *fd)
+{
+	if (!fd)
+		return;
+
+	pthread_mutex_lock(&fd->lock);
+	fd->running = 0;
+	pthread_mutex_unlock(&fd->lock);
+
+	pthread_join(fd->udp_thread, NULL);
+	pthread_join(fd->http_thread, NULL);
+
+	/* connection threads notice within one poll interval */
+	pthread_mutex_lock(&fd->lock);
+	while (fd->connections)
+		pthread_cond_wait(&fd->cond, &fd->lock);
+	pthread_mutex_unlock(&fd->lock);
+
+	close(fd->udp_fd);
+	close(fd->http_fd);
+	free(fd->body);
+	pthread_cond_destroy(&fd->cond);
+	pthread_mutex_destroy(&fd->lock);
+	free(fd);
+}
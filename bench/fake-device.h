@@ -0,0 +1,57 @@
+/*
+ * Copyright © 2017 Michael Heimpold <mhei@heimpold.de>
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ */
+#ifndef FAKE_DEVICE_H
+#define FAKE_DEVICE_H
+
+#include <stddef.h>
+
+/*
+ * Fake XPL device(s) on the loopback interface: answers the HTTPMU search queries
+ * (NT: i2se:iodevice) on a UDP port and serves the RESTful API on a TCP port.
+ */
+
+/* parameters of the fake */
+struct fake_device_opts {
+	/* count of devices responding to a search query (distinct serial numbers) */
+	unsigned int devices;
+
+	/* delay before each response, both search and HTTP, in microseconds */
+	unsigned int latency_us;
+
+	/* approximate size of the response body to GET requests in bytes */
+	size_t response_size;
+
+	/* UDP port for the search queries and TCP port of the API, zero means any free port */
+	unsigned int udp_port;
+	unsigned int http_port;
+};
+
+/* count of channels in a response of the given size, the channels are named "ch0000" and so on */
+unsigned int fake_device_channels(size_t response_size);
+
+struct fake_device;
+
+/**
+ * Start serving in background threads.
+ *
+ * @return The fake device, or NULL with errno set on error.
+ */
+struct fake_device *fake_device_start(const struct fake_device_opts *opts);
+
+/* ports actually used */
+unsigned int fake_device_udp_port(struct fake_device *fd);
+unsigned int fake_device_http_port(struct fake_device *fd);
+
+/* count of search queries and HTTP requests answered so far */
+unsigned long fake_device_queries(struct fake_device *fd);
+unsigned long fake_device_requests(struct fake_device *fd);
+
+/**
+ * Stop serving, waits for all connections to finish and releases all resources.
+ */
+void fake_device_stop(struct fake_device *fd);
+
+#endif /* FAKE_DEVICE_H */
@@ -0,0 +1,413 @@
+/*
+ * Copyright © 2017 Michael Heimpold <mhei@heimpold.de>
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <time.h>
+
+#include <json.h>
+
+#include "xplclient.h"
+#include "config.h"
+#include "fake-device.h"
+
+extern char *optarg;
+extern int optind;
+
+unsigned int devices = 16;
+unsigned int latency_us = 0;
+unsigned int response_size = 4096;
+unsigned int requests = 2000;
+unsigned int rounds = 20;
+unsigned int lookups = 100000;
+
+/* command line options */
+const struct option long_options[] = {
+	{ "devices",            required_argument,      0,      'n' },
+	{ "latency",            required_argument,      0,      'l' },
+	{ "size",               required_argument,      0,      's' },
+	{ "requests",           required_argument,      0,      'r' },
+	{ "rounds",             required_argument,      0,      'R' },
+	{ "lookups",            required_argument,      0,      'k' },
+	{ "version",            no_argument,            0,      'V' },
+	{ "help",               no_argument,            0,      'h' },
+
+	{} /* stop condition for iterator */
+};
+
+/* descriptions for the command line options */
+const char *long_options_descs[] = {
+	"count of fake devices answering a search (default: 16)",
+	"response latency of the fake devices in microseconds (default: 0)",
+	"approximate size of the GET responses in bytes (default: 4096)",
+	"count of requests per REST benchmark (default: 2000)",
+	"count of searches of the discovery benchmark (default: 20)",
+	"count of lookups per JSON path benchmark (default: 100000)",
+	"print version and exit",
+	"print this usage and exit",
+	NULL /* stop condition for iterator */
+};
+
+void usage(char *p, int exitcode)
+{
+	const char **desc = long_options_descs;
+	const struct option *op = long_options;
+
+	fprintf(stderr,
+		"%s (%s) -- benchmark the library against a fake XPL device on the loopback interface\n\n"
+		"Usage: %s [options]\n\n"
+		"Results are printed to stdout as one JSON object per line.\n\n"
+		"Options:\n",
+		p, PACKAGE_STRING, p);
+
+	while (op->name && desc) {
+		fprintf(stderr, "\t-%c, --%-12s\t%s\n", op->val, op->name, *desc);
+		op++; desc++;
+	}
+
+	fprintf(stderr, "\n");
+
+	exit(exitcode);
+}
+
+/* parse a positive number or exit */
+unsigned int parse_count(const char *arg, const char *what, unsigned int min)
+{
+	char *end;
+	unsigned long v = strtoul(arg, &end, 10);
+
+	if (*arg == '\0' || *end != '\0' || v < min || v > 100000000) {
+		fprintf(stderr, "Error: Invalid %s '%s'.\n", what, arg);
+		exit(EXIT_FAILURE);
+	}
+
+	return v;
+}
+
+/* parse options from the command line */
+int options_parse_cli(int argc, char * argv[])
+{
+	int rc = EXIT_FAILURE;
+
+	while (1) {
+		int c = getopt_long(argc, argv, "n:l:s:r:R:k:Vh", long_options, NULL);
+
+		/* detect the end of the options */
+		if (c == -1) break;
+
+		switch (c) {
+		case 'n':
+			devices = parse_count(optarg, "device count", 1);
+			break;
+		case 'l':
+			latency_us = parse_count(optarg, "latency", 0);
+			break;
+		case 's':
+			response_size = parse_count(optarg, "response size", 1);
+			break;
+		case 'r':
+			requests = parse_count(optarg, "request count", 1);
+			break;
+		case 'R':
+			rounds = parse_count(optarg, "round count", 1);
+			break;
+		case 'k':
+			lookups = parse_count(optarg, "lookup count", 1);
+			break;
+		case 'V':
+			fprintf(stderr, "%s (%s)\n", argv[0], PACKAGE_STRING);
+			exit(EXIT_SUCCESS);
+		case '?':
+		case 'h':
+			rc = EXIT_SUCCESS;
+			/* fall-through */
+		default:
+			usage(argv[0], rc);
+		}
+	}
+
+	return 0;
+}
+
+uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* upper bound of the bucket which contains the given fraction of the samples (at most the maximum) */
+uint64_t hist_percentile(const struct xplclient_histogram *h, double q)
+{
+	unsigned long sum = 0;
+	unsigned int i;
+
+	for (i = 0; i < XPLCLIENT_HIST_BUCKETS - 1; i++) {
+		sum += h->buckets[i];
+		if (sum >= q * h->count)
+			return (XPLCLIENT_HIST_BUCKET_LIMIT(i) < h->max_us) ? XPLCLIENT_HIST_BUCKET_LIMIT(i) : h->max_us;
+	}
+
+	return h->max_us;
+}
+
+/* state of a single search round */
+struct discovery_round {
+	uint64_t start, first, last;
+	unsigned int found;
+};
+
+int discovery_cb(void *ctx, const struct sockaddr *address, socklen_t addrlen, struct json_object *deviceinfo)
+{
+	struct discovery_round *r = (struct discovery_round *)ctx;
+	uint64_t t = now_ns() - r->start;
+
+	json_object_put(deviceinfo);
+
+	if (r->found++ == 0)
+		r->first = t;
+	r->last = t;
+
+	/* all devices answered, the remaining timeout is not interesting */
+	return (r->found == devices) ? XPLCLIENT_SEARCH_STOP : XPLCLIENT_SEARCH_CONTINUE;
+}
+
+int bench_discovery(struct fake_device *fake)
+{
+	struct xplclient_search_opts opts;
+	struct discovery_round r;
+	uint64_t *first, *last;
+	unsigned int i, complete = 0;
+
+	first = calloc(rounds, sizeof(uint64_t));
+	last = calloc(rounds, sizeof(uint64_t));
+	if (!first || !last)
+		goto err_out;
+
+	/* the loopback interface does not take part in multicast searches, so the fake is
+	 * queried via a unicast sweep of a single host - the rest is the same code path */
+	memset(&opts, 0, sizeof(opts));
+	opts.sweep = "127.0.0.1/32";
+	opts.port = fake_device_udp_port(fake);
+	opts.timeout = 1;
+
+	for (i = 0; i < rounds; i++) {
+		memset(&r, 0, sizeof(r));
+		r.start = now_ns();
+
+		if (xplclient_search_devices_ex(discovery_cb, &r, &opts))
+			goto err_out;
+
+		first[complete] = r.first / 1000;
+		last[complete] = r.last / 1000;
+		if (r.found == devices)
+			complete++;
+	}
+
+	qsort(first, complete, sizeof(uint64_t), compare_u64);
+	qsort(last, complete, sizeof(uint64_t), compare_u64);
+
+	printf("{\"benchmark\": \"discovery\", \"devices\": %u, \"rounds\": %u, \"complete\": %u, "
+	       "\"first_p50_us\": %llu, \"first_max_us\": %llu, \"last_p50_us\": %llu, \"last_max_us\": %llu}\n",
+	       devices, rounds, complete,
+	       complete ? (unsigned long long)first[complete / 2] : 0ULL,
+	       complete ? (unsigned long long)first[complete - 1] : 0ULL,
+	       complete ? (unsigned long long)last[complete / 2] : 0ULL,
+	       complete ? (unsigned long long)last[complete - 1] : 0ULL);
+
+	free(first);
+	free(last);
+	return 0;
+
+err_out:
+	perror("discovery");
+	free(first);
+	free(last);
+	return -1;
+}
+
+/* requests per second and latency of GET or SET requests */
+int bench_rest(const char *name, const char *url, int set, int persistent)
+{
+	struct xplclient_request_stats stats;
+	struct json_object *data = NULL, *result;
+	unsigned int i, count = requests;
+	uint64_t start, elapsed;
+	xplclient_t ctx;
+	int rv = -1;
+
+	ctx = xplclient_new_by_url(url);
+	if (!ctx)
+		goto err_out;
+
+	if (xplclient_set_persistent(ctx, persistent))
+		goto free_out;
+
+	if (set) {
+		data = json_object_new_object();
+		if (!data)
+			goto free_out;
+	}
+
+	/* opening a new connection for each request is much slower, fewer samples suffice */
+	if (!persistent)
+		count = (count + 3) / 4;
+
+	/* the first request opens the connection */
+	result = set ? xplclient_url_set(ctx, "/channel/physical", data) : xplclient_url_get(ctx, "/channel/physical");
+	if (!result)
+		goto free_out;
+	json_object_put(result);
+
+	xplclient_reset_stats(ctx);
+	start = now_ns();
+
+	for (i = 0; i < count; i++) {
+		if (set)
+			json_object_object_add(data, "value", json_object_new_int(i));
+
+		result = set ? xplclient_url_set(ctx, "/channel/physical", data) : xplclient_url_get(ctx, "/channel/physical");
+		json_object_put(result);
+	}
+
+	elapsed = now_ns() - start;
+	xplclient_get_stats(ctx, &stats);
+
+	printf("{\"benchmark\": \"%s\", \"requests\": %lu, \"failed\": %lu, \"seconds\": %.6f, "
+	       "\"rps\": %.1f, \"mean_us\": %llu, \"p50_us\": %llu, \"p99_us\": %llu, \"max_us\": %llu, "
+	       "\"parse_mean_us\": %llu, \"bytes_received\": %llu}\n",
+	       name, stats.requests, stats.failed, elapsed / 1e9,
+	       stats.requests / (elapsed / 1e9),
+	       (unsigned long long)(stats.total.count ? stats.total.sum_us / stats.total.count : 0),
+	       (unsigned long long)hist_percentile(&stats.total, 0.5),
+	       (unsigned long long)hist_percentile(&stats.total, 0.99),
+	       (unsigned long long)stats.total.max_us,
+	       (unsigned long long)(stats.parse.count ? stats.parse.sum_us / stats.parse.count : 0),
+	       (unsigned long long)stats.bytes_received);
+
+	rv = 0;
+
+free_out:
+	json_object_put(data);
+	xplclient_free(ctx);
+err_out:
+	if (rv)
+		fprintf(stderr, "%s: failed\n", name);
+	return rv;
+}
+
+/* cost of looking up values in a response */
+int bench_json_path(const char *url)
+{
+	struct json_object *root, *values[4];
+	char paths[4][64];
+	const char *path_list[4];
+	xplclient_json_path_t jp, jp_multi;
+	unsigned int i, n, found = 0;
+	uint64_t start, by_key_ns, compiled_ns, multi_ns;
+	xplclient_t ctx;
+
+	ctx = xplclient_new_by_url(url);
+	if (!ctx)
+		return -1;
+
+	root = xplclient_url_get(ctx, "/channel/physical");
+	xplclient_free(ctx);
+	if (!root)
+		return -1;
+
+	/* the last channels, so that the lookups go through the whole object */
+	n = fake_device_channels(response_size);
+	for (i = 0; i < 4; i++) {
+		snprintf(paths[i], sizeof(paths[i]), "channels/ch%04u/value", (n > i) ? n - 1 - i : 0);
+		path_list[i] = paths[i];
+	}
+
+	jp = xplclient_json_path_compile(paths[0]);
+	jp_multi = xplclient_json_path_compile_multi(path_list, 4);
+	if (!jp || !jp_multi) {
+		json_object_put(root);
+		xplclient_json_path_free(jp);
+		return -1;
+	}
+
+	start = now_ns();
+	for (i = 0; i < lookups; i++)
+		found += xplclient_json_object_get_by_key(root, paths[0]) != NULL;
+	by_key_ns = now_ns() - start;
+
+	start = now_ns();
+	for (i = 0; i < lookups; i++)
+		found += xplclient_json_path_get(jp, root) != NULL;
+	compiled_ns = now_ns() - start;
+
+	start = now_ns();
+	for (i = 0; i < lookups; i++)
+		found += xplclient_json_path_get_multi(jp_multi, root, values) == 4;
+	multi_ns = now_ns() - start;
+
+	printf("{\"benchmark\": \"json_path\", \"lookups\": %u, \"found\": %u, \"by_key_ns\": %.1f, "
+	       "\"compiled_ns\": %.1f, \"compiled_multi4_ns\": %.1f}\n",
+	       lookups, found, (double)by_key_ns / lookups, (double)compiled_ns / lookups,
+	       (double)multi_ns / lookups);
+
+	xplclient_json_path_free(jp);
+	xplclient_json_path_free(jp_multi);
+	json_object_put(root);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct fake_device_opts fopts;
+	struct fake_device *fake;
+	char url[64];
+	int rv = EXIT_SUCCESS;
+
+	options_parse_cli(argc, argv);
+
+	if (xplclient_global_init()) {
+		fprintf(stderr, "Error: Could not initialize the library.\n");
+		return EXIT_FAILURE;
+	}
+
+	memset(&fopts, 0, sizeof(fopts));
+	fopts.devices = devices;
+	fopts.latency_us = latency_us;
+	fopts.response_size = response_size;
+
+	fake = fake_device_start(&fopts);
+	if (!fake) {
+		perror("fake device");
+		return EXIT_FAILURE;
+	}
+
+	snprintf(url, sizeof(url), "http://127.0.0.1:%u/api", fake_device_http_port(fake));
+
+	if (bench_discovery(fake) ||
+	    bench_rest("url_get", url, 0, 1) ||
+	    bench_rest("url_get_fresh_connection", url, 0, 0) ||
+	    bench_rest("url_set", url, 1, 1) ||
+	    bench_json_path(url))
+		rv = EXIT_FAILURE;
+
+	fake_device_stop(fake);
+	xplclient_global_cleanup();
+
+	return rv;
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright © 2017 Michael Heimpold <mhei@heimpold.de>
+ *
+ * SPDX-License-Identifier: LGPL-2.1
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include <json.h>
+
+#include "xplclient.h"
+#include "xplclient-private.h"
+
+/* completion callback of a single item */
+static int bulk_cb(void *cb_ctx, xplclient_t ctx, const char *path, struct json_object *result)
+{
+	struct xplclient_bulk_item *item = (struct xplclient_bulk_item *)cb_ctx;
+	struct json_object *value;
+
+	if (!result) {
+		item->err = EIO;
+		return 0;
+	}
+
+	/* whole response requested */
+	if (!item->key) {
+		item->result = result;
+		item->err = 0;
+		return 0;
+	}
+
+	value = xplclient_json_object_get_by_key(result, item->key);
+	if (value) {
+		item->result = json_object_get(value);
+		item->err = 0;
+	} else {
+		item->err = ENOENT;
+	}
+
+	json_object_put(result);
+	return 0;
+}
+
+int xplclient_url_get_bulk(xplclient_t ctx, struct xplclient_bulk_item *items, unsigned int count)
+{
+	unsigned int i;
+	int c = 0;
+
+	for (i = 0; i < count; i++) {
+		items[i].result = NULL;
+		items[i].err = EIO;
+	}
+
+	/* the engine is kept, so that its connections to the device are re-used by later calls */
+	if (!ctx->bulk) {
+		ctx->bulk = xplclient_multi_new();
+		if (!ctx->bulk)
+			return -1;
+
+		if (xpl_multi_set_max_host_connections(ctx->bulk, XPLCLIENT_BULK_MAX_CONNECTIONS) == -1) {
+			xplclient_multi_free(ctx->bulk);
+			ctx->bulk = NULL;
+			return -1;
+		}
+	}
+
+	for (i = 0; i < count; i++)
+		if (xplclient_multi_add_get(ctx->bulk, ctx, items[i].path, bulk_cb, &items[i]) == -1)
+			items[i].err = ENOMEM;
+
+	if (xplclient_multi_run(ctx->bulk) == -1) {
+		/* drop all pending requests, the engine cannot be trusted anymore */
+		xplclient_multi_free(ctx->bulk);
+		ctx->bulk = NULL;
+
+		for (i = 0; i < count; i++) {
+			json_object_put(items[i].result);
+			items[i].result = NULL;
+		}
+
+		return -1;
+	}
+
+	for (i = 0; i < count; i++)
+		if (items[i].err == 0)
+			c++;
+
+	return c;
+}
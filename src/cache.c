@@ -0,0 +1,621 @@
+/*
+ * Copyright © 2017 Michael Heimpold <mhei@heimpold.de>
+ *
+ * SPDX-License-Identifier: LGPL-2.1
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+
+#include <poll.h>
+#include <time.h>
+#include <errno.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <json.h>
+
+#include "xplclient.h"
+#include "xplclient-private.h"
+
+/* a resolved serial number */
+struct cache_entry {
+	struct cache_entry *next;
+
+	/* trimmed and lower-cased serial number */
+	char *key;
+
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+
+	/* NOTIFY information of the device */
+	struct json_object *deviceinfo;
+
+	/* wall clock time of the last response, so that it is meaningful across processes */
+	time_t seen;
+};
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct cache_entry *cache_entries;
+static unsigned int cache_ttl = XPLCLIENT_CACHE_DEFAULT_TTL;
+static char *cache_file;
+static int cache_dirty;
+static struct xplclient_cache_stats cache_stats;
+
+/* build the cache key for a serial number, returns malloc-ed string or NULL */
+static char *cache_key(const char *serial)
+{
+	char *key, *p;
+
+	key = strdup(serial);
+	if (!key)
+		return NULL;
+
+	for (p = key; *p; p++)
+		*p = tolower(*p);
+
+	return xpl_trim_serial(key);
+}
+
+static void cache_entry_free(struct cache_entry *e)
+{
+	json_object_put(e->deviceinfo);
+	free(e->key);
+	free(e);
+}
+
+/* must be called with cache_lock held */
+static struct cache_entry *cache_find(const char *key)
+{
+	struct cache_entry *e;
+
+	for (e = cache_entries; e; e = e->next)
+		if (strcmp(e->key, key) == 0)
+			return e;
+
+	return NULL;
+}
+
+/* write the cache atomically to the configured file; must be called with cache_lock held */
+static int cache_write(void)
+{
+	char host[64], port[8]; /* > INET6_ADDRSTRLEN, > 5 digits max */
+	struct cache_entry *e;
+	char *tmpfile;
+	FILE *f;
+	int rv = -1;
+
+	if (!cache_file)
+		return 0;
+
+	if (asprintf(&tmpfile, "%s.tmp", cache_file) == -1)
+		return -1;
+
+	f = fopen(tmpfile, "w");
+	if (!f)
+		goto free_out;
+
+	for (e = cache_entries; e; e = e->next) {
+		if (getnameinfo((struct sockaddr *)&e->addr, e->addrlen, host, sizeof(host), port, sizeof(port),
+		                NI_NUMERICHOST | NI_NUMERICSERV) != 0)
+			continue;
+
+		/* one entry per line: serial, address, port, time last seen and the (single-line) NOTIFY JSON */
+		fprintf(f, "%s\t%s\t%s\t%lld\t%s\n", e->key, host, port, (long long)e->seen,
+		        json_object_to_json_string_ext(e->deviceinfo, JSON_C_TO_STRING_PLAIN));
+	}
+
+	if (fclose(f) != 0)
+		goto unlink_out;
+
+	if (rename(tmpfile, cache_file) == -1)
+		goto unlink_out;
+
+	rv = 0;
+	goto free_out;
+
+unlink_out:
+	unlink(tmpfile);
+free_out:
+	free(tmpfile);
+	return rv;
+}
+
+/* write the cache if an address changed since the last write; must be called with cache_lock held */
+static void cache_sync(void)
+{
+	if (cache_dirty && cache_write() == 0)
+		cache_dirty = 0;
+}
+
+/* insert or update an entry, takes over the reference of deviceinfo; must be called with cache_lock held.
+ * The file is not written here but by cache_sync, so that a search answered by many devices
+ * rewrites it only once. */
+static int cache_store(const char *key, const struct sockaddr *addr, socklen_t addrlen,
+                       struct json_object *deviceinfo, time_t seen)
+{
+	struct cache_entry *e;
+	int changed = 1;
+
+	if (addrlen > sizeof(e->addr))
+		goto put_out;
+
+	e = cache_find(key);
+	if (e) {
+		changed = e->addrlen != addrlen || memcmp(&e->addr, addr, addrlen) != 0;
+		json_object_put(e->deviceinfo);
+	} else {
+		e = calloc(1, sizeof(struct cache_entry));
+		if (!e)
+			goto put_out;
+
+		e->key = strdup(key);
+		if (!e->key) {
+			free(e);
+			goto put_out;
+		}
+
+		e->next = cache_entries;
+		cache_entries = e;
+	}
+
+	memcpy(&e->addr, addr, addrlen);
+	e->addrlen = addrlen;
+	e->deviceinfo = deviceinfo;
+	e->seen = seen;
+
+	/* only the address matters for a fast startup, so avoid rewriting the file for each refresh */
+	if (changed)
+		cache_dirty = 1;
+
+	return 0;
+
+put_out:
+	json_object_put(deviceinfo);
+	return -1;
+}
+
+/* return the trimmed and lower-cased serial of a NOTIFY response or NULL */
+static char *cache_key_from_info(struct json_object *deviceinfo)
+{
+	struct json_object *serial = NULL;
+
+#if JSON_C_MINOR_VERSION > 10
+	json_object_object_get_ex(deviceinfo, "serial", &serial);
+#else
+	serial = json_object_object_get(deviceinfo, "serial");
+#endif
+
+	return serial ? cache_key(json_object_get_string(serial)) : NULL;
+}
+
+void xplclient_cache_set_ttl(unsigned int ttl)
+{
+	pthread_mutex_lock(&cache_lock);
+	cache_ttl = ttl;
+	pthread_mutex_unlock(&cache_lock);
+}
+
+int xplclient_cache_set_file(const char *filename)
+{
+	struct addrinfo hints, *res;
+	char *line = NULL, *fields[5], *p, *filecopy;
+	size_t size = 0;
+	struct json_object *deviceinfo;
+	FILE *f;
+	int i, rv = 0;
+
+	pthread_mutex_lock(&cache_lock);
+
+	free(cache_file);
+	cache_file = NULL;
+
+	if (!filename)
+		goto unlock_out;
+
+	/* it is set not before loading finished, to avoid rewriting the file for each loaded entry */
+	filecopy = strdup(filename);
+	if (!filecopy) {
+		rv = -1;
+		goto unlock_out;
+	}
+
+	f = fopen(filename, "r");
+	if (!f) {
+		/* a missing file is fine, it is created on first update */
+		if (errno != ENOENT)
+			rv = -1;
+		goto set_out;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+
+	while (getline(&line, &size, f) != -1) {
+		/* split into tab separated fields, the last field (JSON) takes the remainder */
+		for (i = 0, p = line; i < 5 && p; i++)
+			fields[i] = strsep(&p, i < 4 ? "\t" : "\n");
+
+		if (i < 5 || !fields[4])
+			continue;
+
+		if (getaddrinfo(fields[1], fields[2], &hints, &res) != 0)
+			continue;
+
+		deviceinfo = json_tokener_parse(fields[4]);
+		if (deviceinfo && !cache_find(fields[0]))
+			cache_store(fields[0], res->ai_addr, res->ai_addrlen, deviceinfo, strtoll(fields[3], NULL, 10));
+		else
+			json_object_put(deviceinfo);
+
+		freeaddrinfo(res);
+	}
+
+	free(line);
+	fclose(f);
+
+set_out:
+	/* the file holds all loaded entries already */
+	cache_file = filecopy;
+	cache_dirty = 0;
+unlock_out:
+	pthread_mutex_unlock(&cache_lock);
+	return rv;
+}
+
+void xplclient_cache_flush(void)
+{
+	struct cache_entry *e;
+
+	pthread_mutex_lock(&cache_lock);
+
+	while ((e = cache_entries)) {
+		cache_entries = e->next;
+		cache_entry_free(e);
+	}
+
+	cache_dirty = 1;
+	cache_sync();
+
+	pthread_mutex_unlock(&cache_lock);
+}
+
+void xplclient_cache_invalidate(const char *serial)
+{
+	struct cache_entry **pe, *e;
+	char *key;
+
+	key = cache_key(serial);
+	if (!key)
+		return;
+
+	pthread_mutex_lock(&cache_lock);
+
+	for (pe = &cache_entries; (e = *pe); pe = &e->next) {
+		if (strcmp(e->key, key) == 0) {
+			*pe = e->next;
+			cache_entry_free(e);
+			cache_dirty = 1;
+			cache_sync();
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&cache_lock);
+
+	free(key);
+}
+
+void xplclient_cache_get_stats(struct xplclient_cache_stats *stats)
+{
+	struct cache_entry *e;
+
+	pthread_mutex_lock(&cache_lock);
+
+	*stats = cache_stats;
+
+	stats->entries = 0;
+	for (e = cache_entries; e; e = e->next)
+		stats->entries++;
+
+	pthread_mutex_unlock(&cache_lock);
+}
+
+/* shared state for the revalidation and the search callback */
+struct resolve_ctx {
+	/* the key we are looking for */
+	char *key;
+
+	/* result */
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	struct json_object *deviceinfo;
+	int found;
+};
+
+static int resolve_cb(void *ctx, const struct sockaddr *address, socklen_t addrlen, struct json_object *deviceinfo)
+{
+	struct resolve_ctx *rctx = (struct resolve_ctx *)ctx;
+	char *key;
+
+	key = cache_key_from_info(deviceinfo);
+	if (!key) {
+		json_object_put(deviceinfo);
+		return XPLCLIENT_SEARCH_CONTINUE;
+	}
+
+	/* every response is fresh information, so remember all devices we see */
+	pthread_mutex_lock(&cache_lock);
+	if (cache_ttl)
+		cache_store(key, address, addrlen, json_object_get(deviceinfo), time(NULL));
+	pthread_mutex_unlock(&cache_lock);
+
+	if (!rctx->found && strcmp(key, rctx->key) == 0) {
+		memcpy(&rctx->addr, address, addrlen);
+		rctx->addrlen = addrlen;
+		rctx->deviceinfo = deviceinfo;
+		rctx->found = 1;
+	} else {
+		json_object_put(deviceinfo);
+	}
+
+	free(key);
+
+	return rctx->found ? XPLCLIENT_SEARCH_STOP : XPLCLIENT_SEARCH_CONTINUE;
+}
+
+/* ask a known address directly whether the device is still there */
+static int cache_revalidate(struct resolve_ctx *rctx, const struct sockaddr_storage *addr)
+{
+	struct sockaddr_storage dst;
+	struct xpl_recv_ctx rx;
+	struct pollfd pfd;
+	socklen_t dstlen;
+	uint64_t deadline;
+	int64_t remaining;
+
+	/* the query goes to the search port of the device */
+	memcpy(&dst, addr, sizeof(dst));
+	switch (dst.ss_family) {
+	case AF_INET:
+		((struct sockaddr_in *)&dst)->sin_port = htons(XPLCLIENT_DEFAULT_MC_PORT);
+		dstlen = sizeof(struct sockaddr_in);
+		break;
+	case AF_INET6:
+		((struct sockaddr_in6 *)&dst)->sin6_port = htons(XPLCLIENT_DEFAULT_MC_PORT);
+		dstlen = sizeof(struct sockaddr_in6);
+		break;
+	default:
+		return 0;
+	}
+
+	if (xpl_recv_ctx_init(&rx) == -1)
+		return -1;
+
+	pfd.fd = socket(dst.ss_family, SOCK_DGRAM, 0);
+	if (pfd.fd == -1)
+		goto cleanup_out;
+	pfd.events = POLLIN;
+
+	if (xpl_send_query(pfd.fd, (struct sockaddr *)&dst, dstlen) == -1)
+		goto close_out;
+
+	/* wait for the response of the device - ignore all others, but these must not extend the wait */
+	deadline = xpl_monotonic_ns() + (uint64_t)XPLCLIENT_CACHE_REVALIDATE_TIMEOUT * 1000000;
+	while (!rctx->found) {
+		remaining = (int64_t)(deadline - xpl_monotonic_ns());
+		if (remaining <= 0 || poll(&pfd, 1, (remaining + 999999) / 1000000) <= 0)
+			break;
+
+		xpl_recv_packets(&rx, pfd.fd, NULL, resolve_cb, rctx);
+	}
+
+close_out:
+	close(pfd.fd);
+cleanup_out:
+	xpl_recv_ctx_cleanup(&rx);
+	return rctx->found;
+}
+
+int xplclient_resolve_serial(const char *serial, struct sockaddr *addr, socklen_t *addrlen,
+                             struct json_object **deviceinfo)
+{
+	struct sockaddr_storage stale_addr;
+	struct resolve_ctx rctx;
+	struct cache_entry *e;
+	int stale = 0, rv;
+	uint64_t start;
+
+	start = xpl_monotonic_ns();
+	memset(&rctx, 0, sizeof(rctx));
+
+	rctx.key = cache_key(serial);
+	if (!rctx.key)
+		return -1;
+
+	pthread_mutex_lock(&cache_lock);
+
+	e = cache_ttl ? cache_find(rctx.key) : NULL;
+	if (e && time(NULL) - e->seen < cache_ttl) {
+		/* fresh entry */
+		memcpy(&rctx.addr, &e->addr, e->addrlen);
+		rctx.addrlen = e->addrlen;
+		rctx.deviceinfo = json_object_get(e->deviceinfo);
+		rctx.found = 1;
+		cache_stats.hits++;
+	} else if (e) {
+		memcpy(&stale_addr, &e->addr, e->addrlen);
+		stale = 1;
+	}
+
+	pthread_mutex_unlock(&cache_lock);
+
+	/* try the last known address first, this is much cheaper than a multicast search */
+	if (stale && cache_revalidate(&rctx, &stale_addr) == 1) {
+		pthread_mutex_lock(&cache_lock);
+		cache_stats.revalidations++;
+		cache_sync();
+		pthread_mutex_unlock(&cache_lock);
+	}
+
+	if (!rctx.found) {
+		pthread_mutex_lock(&cache_lock);
+		cache_stats.misses++;
+		pthread_mutex_unlock(&cache_lock);
+
+		rv = xplclient_search_devices(resolve_cb, (void *)&rctx, NULL, NULL, 0, 0);
+
+		/* all devices seen by the search are written at once */
+		pthread_mutex_lock(&cache_lock);
+		cache_sync();
+		pthread_mutex_unlock(&cache_lock);
+
+		if (rv) {
+			free(rctx.key);
+			xpl_stats_resolve(xpl_monotonic_ns() - start);
+			return rv;
+		}
+
+		/* the device is gone, so forget about it */
+		if (!rctx.found && stale)
+			xplclient_cache_invalidate(serial);
+	}
+
+	if (rctx.found) {
+		if (addr)
+			memcpy(addr, &rctx.addr, rctx.addrlen);
+		if (addrlen)
+			*addrlen = rctx.addrlen;
+		if (deviceinfo)
+			*deviceinfo = rctx.deviceinfo;
+		else
+			json_object_put(rctx.deviceinfo);
+	}
+
+	free(rctx.key);
+	xpl_stats_resolve(xpl_monotonic_ns() - start);
+
+	return rctx.found;
+}
+
+/* shared state of the search for several serial numbers */
+struct resolve_multi_ctx {
+	char **keys;
+	unsigned int count;
+	unsigned int missing;
+
+	/* results, an address length of zero means not found (yet) */
+	struct sockaddr_storage *addrs;
+	socklen_t *addrlens;
+};
+
+static int resolve_multi_cb(void *ctx, const struct sockaddr *address, socklen_t addrlen, struct json_object *deviceinfo)
+{
+	struct resolve_multi_ctx *rctx = (struct resolve_multi_ctx *)ctx;
+	unsigned int i;
+	char *key;
+
+	key = cache_key_from_info(deviceinfo);
+	if (!key)
+		goto put_out;
+
+	pthread_mutex_lock(&cache_lock);
+	if (cache_ttl)
+		cache_store(key, address, addrlen, json_object_get(deviceinfo), time(NULL));
+	pthread_mutex_unlock(&cache_lock);
+
+	/* the same serial number may be requested more than once, e.g. for several ports */
+	for (i = 0; i < rctx->count; i++) {
+		if (rctx->addrlens[i] || !rctx->keys[i] || strcmp(key, rctx->keys[i]) != 0)
+			continue;
+
+		memcpy(&rctx->addrs[i], address, addrlen);
+		rctx->addrlens[i] = addrlen;
+		rctx->missing--;
+	}
+
+	free(key);
+
+put_out:
+	json_object_put(deviceinfo);
+
+	return rctx->missing ? XPLCLIENT_SEARCH_CONTINUE : XPLCLIENT_SEARCH_STOP;
+}
+
+int xpl_resolve_serials(const char * const *serials, unsigned int count,
+                        struct sockaddr_storage *addrs, socklen_t *addrlens, unsigned int timeout_ms)
+{
+	struct xplclient_search_opts opts;
+	struct resolve_multi_ctx rctx;
+	struct cache_entry *e;
+	unsigned int i;
+	int rv = -1, err;
+	uint64_t start;
+
+	start = xpl_monotonic_ns();
+	memset(&rctx, 0, sizeof(rctx));
+	rctx.count = count;
+	rctx.addrs = addrs;
+	rctx.addrlens = addrlens;
+
+	rctx.keys = calloc(count, sizeof(char *));
+	if (!rctx.keys)
+		return -1;
+
+	for (i = 0; i < count; i++) {
+		addrlens[i] = 0;
+
+		rctx.keys[i] = cache_key(serials[i]);
+		if (!rctx.keys[i])
+			goto free_out;
+	}
+
+	pthread_mutex_lock(&cache_lock);
+
+	/* expired entries are not revalidated one by one, the search below refreshes all of them at once */
+	for (i = 0; i < count; i++) {
+		e = cache_ttl ? cache_find(rctx.keys[i]) : NULL;
+		if (e && time(NULL) - e->seen < cache_ttl) {
+			memcpy(&addrs[i], &e->addr, e->addrlen);
+			addrlens[i] = e->addrlen;
+			cache_stats.hits++;
+		} else {
+			rctx.missing++;
+			cache_stats.misses++;
+		}
+	}
+
+	pthread_mutex_unlock(&cache_lock);
+
+	if (rctx.missing && timeout_ms) {
+		memset(&opts, 0, sizeof(opts));
+		opts.timeout_ms = timeout_ms;
+
+		err = xplclient_search_devices_ex(resolve_multi_cb, (void *)&rctx, &opts);
+
+		/* all devices seen by the search are written at once */
+		pthread_mutex_lock(&cache_lock);
+		cache_sync();
+		pthread_mutex_unlock(&cache_lock);
+
+		if (err)
+			goto free_out;
+	}
+
+	rv = count - rctx.missing;
+
+free_out:
+	for (i = 0; i < count; i++)
+		free(rctx.keys[i]);
+	free(rctx.keys);
+	xpl_stats_resolve(xpl_monotonic_ns() - start);
+	return rv;
+}
@@ -0,0 +1,446 @@
+/*
+ * Copyright © 2017 Michael Heimpold <mhei@heimpold.de>
+ *
+ * SPDX-License-Identifier: LGPL-2.1
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include <errno.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <json.h>
+
+#include "xplclient.h"
+#include "xplclient-private.h"
+
+/* number of hash buckets of the device table */
+#define DISCOVERY_BUCKETS 256
+
+/* tags of the epoll events */
+#define DISCOVERY_EV_SOCKETS 0
+#define DISCOVERY_EV_TIMER   1
+
+/* a known device */
+struct discovery_dev {
+	struct discovery_dev *next;
+
+	/* table key: trimmed serial number, MAC address as fallback */
+	char *key;
+
+	/* address last reported to the callback */
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+
+	/* last known address per family (IPv4, IPv6): a dual-stack device answers the queries
+	 * of both families, this must not look like a change of its address every round */
+	struct sockaddr_storage family_addr[2];
+	socklen_t family_addrlen[2];
+
+	/* last NOTIFY response and its string representation for change detection */
+	struct json_object *deviceinfo;
+	char *deviceinfo_str;
+
+	/* query round in which the device responded the last time */
+	unsigned long round;
+};
+
+struct xplclient_discovery {
+	/* sockets used to query, they are re-opened only when the interfaces change */
+	struct xpl_search_set set;
+
+	/* parameters to open the sockets, the strings are owned copies */
+	struct xplclient_search_opts opts;
+
+	/* receive buffer and JSON tokener */
+	struct xpl_recv_ctx rx;
+
+	/* epoll fd covering the (nested) epoll fd of the sockets and the timer */
+	int epfd;
+
+	/* periodic timer for re-queries */
+	int timerfd;
+
+	/* count of queries sent so far */
+	unsigned long round;
+
+	/* count of unanswered query rounds after which a device is considered vanished */
+	unsigned int expiry;
+
+	xplclient_discovery_cb cb;
+	void *cb_ctx;
+
+	struct discovery_dev *table[DISCOVERY_BUCKETS];
+};
+
+static unsigned int discovery_hash(const char *key)
+{
+	unsigned int h = 2166136261u;
+
+	while (*key)
+		h = (h ^ (unsigned char)*key++) * 16777619u;
+
+	return h % DISCOVERY_BUCKETS;
+}
+
+static void discovery_dev_free(struct discovery_dev *dev)
+{
+	json_object_put(dev->deviceinfo);
+	free(dev->deviceinfo_str);
+	free(dev->key);
+	free(dev);
+}
+
+/* build the table key for the given NOTIFY response, returns malloc-ed string or NULL */
+static char *discovery_key(struct json_object *deviceinfo)
+{
+	struct json_object *val = NULL;
+	char *key, *p;
+
+#if JSON_C_MINOR_VERSION > 10
+	if (!json_object_object_get_ex(deviceinfo, "serial", &val))
+		json_object_object_get_ex(deviceinfo, "mac_address", &val);
+#else
+	val = json_object_object_get(deviceinfo, "serial");
+	if (!val)
+		val = json_object_object_get(deviceinfo, "mac_address");
+#endif
+
+	if (!val)
+		return NULL;
+
+	key = strdup(json_object_get_string(val));
+	if (!key)
+		return NULL;
+
+	/* normalize, so that the key can be hashed and compared case-sensitive */
+	for (p = key; *p; p++)
+		*p = tolower(*p);
+
+	return xpl_trim_serial(key);
+}
+
+/* callback for xpl_recv_packets: merge a response into the device table */
+static int discovery_recv_cb(void *ctx, const struct sockaddr *address, socklen_t addrlen, struct json_object *deviceinfo)
+{
+	xplclient_discovery_t d = (xplclient_discovery_t)ctx;
+	enum xplclient_discovery_event event;
+	struct discovery_dev *dev;
+	const char *info_str;
+	char *key, *s;
+	unsigned int h;
+	int f = (address->sa_family == AF_INET6), addr_changed;
+
+	key = discovery_key(deviceinfo);
+	if (!key)
+		goto put_out;
+
+	info_str = json_object_to_json_string(deviceinfo);
+	h = discovery_hash(key);
+
+	for (dev = d->table[h]; dev; dev = dev->next)
+		if (strcmp(dev->key, key) == 0)
+			break;
+
+	if (dev) {
+		dev->round = d->round;
+		free(key);
+
+		/* only an address of a family seen before can change */
+		addr_changed = dev->family_addrlen[f] &&
+		               (dev->family_addrlen[f] != addrlen || memcmp(&dev->family_addr[f], address, addrlen) != 0);
+		memcpy(&dev->family_addr[f], address, addrlen);
+		dev->family_addrlen[f] = addrlen;
+
+		/* nothing new, so nothing to report */
+		if (!addr_changed && strcmp(dev->deviceinfo_str, info_str) == 0)
+			goto put_out;
+
+		s = strdup(info_str);
+		if (!s)
+			goto put_out;
+
+		free(dev->deviceinfo_str);
+		dev->deviceinfo_str = s;
+		json_object_put(dev->deviceinfo);
+		event = XPLCLIENT_DISCOVERY_CHANGED;
+	} else {
+		dev = calloc(1, sizeof(struct discovery_dev));
+		if (!dev) {
+			free(key);
+			goto put_out;
+		}
+
+		dev->key = key;
+		dev->round = d->round;
+		dev->deviceinfo_str = strdup(info_str);
+		if (!dev->deviceinfo_str) {
+			discovery_dev_free(dev);
+			goto put_out;
+		}
+
+		memcpy(&dev->family_addr[f], address, addrlen);
+		dev->family_addrlen[f] = addrlen;
+
+		dev->next = d->table[h];
+		d->table[h] = dev;
+		event = XPLCLIENT_DISCOVERY_ADDED;
+	}
+
+	/* the table takes over our reference */
+	dev->deviceinfo = deviceinfo;
+	memcpy(&dev->addr, address, addrlen);
+	dev->addrlen = addrlen;
+
+	if (d->cb)
+		d->cb(d->cb_ctx, event, (struct sockaddr *)&dev->addr, dev->addrlen, dev->deviceinfo);
+
+	return 0;
+
+put_out:
+	json_object_put(deviceinfo);
+	return 0;
+}
+
+/* drop all devices which did not respond for too long */
+static void discovery_expire(xplclient_discovery_t d)
+{
+	struct discovery_dev **pdev, *dev;
+	int i;
+
+	for (i = 0; i < DISCOVERY_BUCKETS; i++) {
+		pdev = &d->table[i];
+
+		while ((dev = *pdev)) {
+			if (d->round - dev->round < d->expiry) {
+				pdev = &dev->next;
+				continue;
+			}
+
+			*pdev = dev->next;
+
+			if (d->cb)
+				d->cb(d->cb_ctx, XPLCLIENT_DISCOVERY_VANISHED, (struct sockaddr *)&dev->addr, dev->addrlen,
+				      dev->deviceinfo);
+
+			discovery_dev_free(dev);
+		}
+	}
+}
+
+int xplclient_discovery_query(xplclient_discovery_t d)
+{
+	d->round++;
+
+	return xpl_search_set_query(&d->set);
+}
+
+/* (re-)open the search sockets for the current interfaces */
+static int discovery_open_set(xplclient_discovery_t d)
+{
+	struct epoll_event ev;
+
+	if (d->set.socks) {
+		epoll_ctl(d->epfd, EPOLL_CTL_DEL, d->set.epfd, NULL);
+		xpl_search_set_close(&d->set);
+	}
+
+	if (xpl_search_set_open(&d->set, &d->opts) == -1)
+		return -1;
+
+	/* the set's epoll fd is nested, so our own fd stays the same across re-opens */
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = DISCOVERY_EV_SOCKETS;
+
+	if (epoll_ctl(d->epfd, EPOLL_CTL_ADD, d->set.epfd, &ev) == -1) {
+		xpl_search_set_close(&d->set);
+		return -1;
+	}
+
+	return 0;
+}
+
+xplclient_discovery_t xplclient_discovery_new(const char *interface, const char *mc_address, unsigned int port,
+                                              unsigned int interval_ms, xplclient_discovery_cb cb, void *cb_ctx)
+{
+	struct epoll_event ev;
+	struct itimerspec its;
+	xplclient_discovery_t d;
+
+	d = calloc(1, sizeof(struct xplclient_discovery));
+	if (!d)
+		return NULL;
+
+	d->cb = cb;
+	d->cb_ctx = cb_ctx;
+	d->expiry = XPLCLIENT_DISCOVERY_DEFAULT_EXPIRY;
+	d->opts.port = port;
+	d->timerfd = -1;
+
+	/* remember the parameters for re-opening the sockets */
+	if (interface && !(d->opts.interface = strdup(interface)))
+		goto free_out;
+
+	if (mc_address && !(d->opts.mc_address = strdup(mc_address)))
+		goto free_out;
+
+	if (xpl_recv_ctx_init(&d->rx) == -1)
+		goto free_out;
+
+	d->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (d->epfd == -1)
+		goto cleanup_out;
+
+	if (discovery_open_set(d) == -1)
+		goto close_epoll_out;
+
+	d->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (d->timerfd == -1)
+		goto close_out;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = DISCOVERY_EV_TIMER;
+	if (epoll_ctl(d->epfd, EPOLL_CTL_ADD, d->timerfd, &ev) == -1)
+		goto close_out;
+
+	/* periodic timer */
+	if (interval_ms == 0)
+		interval_ms = XPLCLIENT_DISCOVERY_DEFAULT_INTERVAL;
+
+	memset(&its, 0, sizeof(its));
+	its.it_interval.tv_sec = interval_ms / 1000;
+	its.it_interval.tv_nsec = (interval_ms % 1000) * 1000000;
+	its.it_value = its.it_interval;
+
+	if (timerfd_settime(d->timerfd, 0, &its, NULL) == -1)
+		goto close_out;
+
+	/* start with an initial query */
+	if (xplclient_discovery_query(d))
+		goto close_out;
+
+	return d;
+
+close_out:
+	if (d->timerfd != -1)
+		close(d->timerfd);
+	xpl_search_set_close(&d->set);
+close_epoll_out:
+	close(d->epfd);
+cleanup_out:
+	xpl_recv_ctx_cleanup(&d->rx);
+free_out:
+	free((char *)d->opts.mc_address);
+	free((char *)d->opts.interface);
+	free(d);
+	return NULL;
+}
+
+void xplclient_discovery_set_expiry(xplclient_discovery_t d, unsigned int rounds)
+{
+	d->expiry = rounds ? : 1;
+}
+
+int xplclient_discovery_get_fd(xplclient_discovery_t d)
+{
+	return d->epfd;
+}
+
+/* periodic work: follow interface changes, expire devices and start the next round */
+static int discovery_tick(xplclient_discovery_t d)
+{
+	/* the kernel reported link/address changes, so pick up new and drop gone interfaces */
+	if (xpl_search_set_changed(&d->set) && discovery_open_set(d) == -1 && errno != ENODEV)
+		return -1;
+
+	/* first expire devices of the last rounds, then start the next one */
+	discovery_expire(d);
+
+	return xplclient_discovery_query(d);
+}
+
+int xplclient_discovery_process(xplclient_discovery_t d)
+{
+	struct epoll_event evs[2];
+	uint64_t expirations;
+	int i, n;
+
+	while (1) {
+		n = epoll_wait(d->epfd, evs, sizeof(evs) / sizeof(evs[0]), 0);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		/* nothing more to do */
+		if (n == 0)
+			return 0;
+
+		for (i = 0; i < n; i++) {
+			if (evs[i].data.u32 == DISCOVERY_EV_TIMER) {
+				if (read(d->timerfd, &expirations, sizeof(expirations)) != sizeof(expirations))
+					continue;
+
+				if (discovery_tick(d))
+					return -1;
+
+				continue;
+			}
+
+			/* process the packets of all ready sockets */
+			xpl_search_set_dispatch(&d->set, &d->rx, discovery_recv_cb, d);
+		}
+	}
+}
+
+void xplclient_discovery_get_stats(xplclient_discovery_t d, struct xplclient_search_stats *stats)
+{
+	*stats = d->rx.stats;
+}
+
+int xplclient_discovery_foreach(xplclient_discovery_t d, xplclient_search_devices_cb cb, void *cb_ctx)
+{
+	struct discovery_dev *dev;
+	int i, c = 0;
+
+	for (i = 0; i < DISCOVERY_BUCKETS; i++) {
+		for (dev = d->table[i]; dev; dev = dev->next, c++)
+			cb(cb_ctx, (struct sockaddr *)&dev->addr, dev->addrlen, json_object_get(dev->deviceinfo));
+	}
+
+	return c;
+}
+
+void xplclient_discovery_free(xplclient_discovery_t d)
+{
+	struct discovery_dev *dev;
+	int i;
+
+	if (!d)
+		return;
+
+	for (i = 0; i < DISCOVERY_BUCKETS; i++) {
+		while ((dev = d->table[i])) {
+			d->table[i] = dev->next;
+			discovery_dev_free(dev);
+		}
+	}
+
+	close(d->timerfd);
+	close(d->epfd);
+	xpl_search_set_close(&d->set);
+	xpl_recv_ctx_cleanup(&d->rx);
+	free((char *)d->opts.mc_address);
+	free((char *)d->opts.interface);
+	free(d);
+}
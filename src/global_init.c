@@ -7,6 +7,7 @@
 #include <curl/curl.h>
 
 #include "xplclient.h"
+#include "xplclient-private.h"
 
 int xplclient_global_init(void)
 {
@@ -15,3 +16,10 @@ int xplclient_global_init(void)
 	rv = curl_global_init(CURL_GLOBAL_ALL);
 	return (rv == 0) ? 0 : -1;
 }
+
+void xplclient_global_cleanup(void)
+{
+	xpl_share_cleanup();
+	xplclient_pool_flush();
+	curl_global_cleanup();
+}
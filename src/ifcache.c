@@ -0,0 +1,208 @@
+/*
+ * Copyright © 2017 Michael Heimpold <mhei@heimpold.de>
+ *
+ * SPDX-License-Identifier: LGPL-2.1
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <ifaddrs.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "xplclient.h"
+#include "xplclient-private.h"
+
+/*
+ * Process-wide cache of the interface addresses. Instead of calling getifaddrs for each
+ * search, the list is only re-read when the kernel announced a link or address change
+ * on the netlink socket. Without such a socket, each listing re-reads it, and a generation
+ * check re-reads it at most once per discovery interval.
+ */
+static pthread_mutex_t ifcache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct xpl_iface *ifcache_list;
+static int ifcache_count;
+static int ifcache_valid;
+static unsigned long ifcache_gen;
+static int ifcache_nl = -1;
+static int ifcache_nl_tried;
+
+/* monotonic time of the last re-read, used without netlink only */
+static uint64_t ifcache_read;
+#define IFCACHE_POLL_INTERVAL_NS ((uint64_t)XPLCLIENT_DISCOVERY_DEFAULT_INTERVAL * 1000000)
+
+static int ifcache_nl_open(void)
+{
+	struct sockaddr_nl sa;
+	int s;
+
+	s = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (s == -1)
+		return -1;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	sa.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+
+	if (bind(s, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+		close(s);
+		return -1;
+	}
+
+	return s;
+}
+
+/* drain the netlink socket, returns whether anything changed since the last call */
+static int ifcache_nl_changed(void)
+{
+	char buf[4096];
+	int changed = 0;
+	ssize_t len;
+
+	while ((len = recv(ifcache_nl, buf, sizeof(buf), MSG_DONTWAIT)) != 0) {
+		if (len > 0) {
+			changed = 1;
+			continue;
+		}
+
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			break;
+
+		/* ENOBUFS: we missed events, errors in general: we cannot know */
+		if (errno != EINTR)
+			return 1;
+	}
+
+	return changed;
+}
+
+static int ifcache_refresh(void)
+{
+	struct ifaddrs *addrs, *addr;
+	struct xpl_iface *list;
+	int c = 0;
+
+	if (getifaddrs(&addrs) == -1)
+		return -1;
+
+	for (addr = addrs; addr; addr = addr->ifa_next)
+		if (addr->ifa_addr && (addr->ifa_addr->sa_family == AF_INET || addr->ifa_addr->sa_family == AF_INET6))
+			c++;
+
+	list = calloc(c ? : 1, sizeof(struct xpl_iface));
+	if (!list) {
+		freeifaddrs(addrs);
+		return -1;
+	}
+
+	for (addr = addrs, c = 0; addr; addr = addr->ifa_next) {
+		struct xpl_iface *iface = &list[c];
+		socklen_t len;
+
+		if (!addr->ifa_addr)
+			continue;
+
+		switch (addr->ifa_addr->sa_family) {
+		case AF_INET:
+			len = sizeof(struct sockaddr_in);
+			break;
+		case AF_INET6:
+			len = sizeof(struct sockaddr_in6);
+			break;
+		default:
+			continue;
+		}
+
+		strncpy(iface->name, addr->ifa_name, sizeof(iface->name) - 1);
+		iface->index = if_nametoindex(addr->ifa_name);
+		iface->flags = addr->ifa_flags;
+		memcpy(&iface->addr, addr->ifa_addr, len);
+		if ((addr->ifa_flags & IFF_BROADCAST) && addr->ifa_broadaddr)
+			memcpy(&iface->broadaddr, addr->ifa_broadaddr, len);
+		c++;
+	}
+
+	freeifaddrs(addrs);
+
+	/* a new generation only if something changed, the entries are zero-padded by calloc */
+	if (!ifcache_list || c != ifcache_count || memcmp(list, ifcache_list, c * sizeof(struct xpl_iface)) != 0)
+		ifcache_gen++;
+
+	free(ifcache_list);
+	ifcache_list = list;
+	ifcache_count = c;
+	ifcache_valid = 1;
+	ifcache_read = xpl_monotonic_ns();
+
+	return 0;
+}
+
+int xpl_iface_list(struct xpl_iface **list, int *count, unsigned long *gen)
+{
+	int rv = -1;
+
+	pthread_mutex_lock(&ifcache_lock);
+
+	/* subscribe before the first dump, so that no change gets lost in between */
+	if (!ifcache_nl_tried) {
+		ifcache_nl = ifcache_nl_open();
+		ifcache_nl_tried = 1;
+	}
+
+	if (ifcache_nl == -1 || ifcache_nl_changed())
+		ifcache_valid = 0;
+
+	if (!ifcache_valid && ifcache_refresh() == -1)
+		goto unlock_out;
+
+	*list = malloc((ifcache_count ? : 1) * sizeof(struct xpl_iface));
+	if (!*list)
+		goto unlock_out;
+
+	memcpy(*list, ifcache_list, ifcache_count * sizeof(struct xpl_iface));
+	*count = ifcache_count;
+	if (gen)
+		*gen = ifcache_gen;
+
+	rv = 0;
+
+unlock_out:
+	pthread_mutex_unlock(&ifcache_lock);
+	return rv;
+}
+
+unsigned long xpl_iface_generation(void)
+{
+	unsigned long gen;
+
+	pthread_mutex_lock(&ifcache_lock);
+
+	if (!ifcache_nl_tried) {
+		ifcache_nl = ifcache_nl_open();
+		ifcache_nl_tried = 1;
+	}
+
+	if (ifcache_nl == -1) {
+		/* nobody tells us about changes, so look for them ourselves - but not on every check */
+		if (!ifcache_valid || xpl_monotonic_ns() - ifcache_read >= IFCACHE_POLL_INTERVAL_NS)
+			ifcache_refresh();
+	} else if (ifcache_nl_changed()) {
+		/* a refresh is deferred to the next listing, just announce a new generation */
+		if (ifcache_valid)
+			ifcache_gen++;
+		ifcache_valid = 0;
+	}
+
+	gen = ifcache_gen;
+
+	pthread_mutex_unlock(&ifcache_lock);
+
+	return gen;
+}
@@ -10,6 +10,28 @@
 #include <json.h>
 
 #include "xplclient.h"
+#include "xplclient-private.h"
+
+/* descend one level: object member, or array element for a numeric path element */
+static struct json_object *get_by_key_step(struct json_object *p, const char *s)
+{
+	long index;
+
+	if (json_object_is_type(p, json_type_array)) {
+		index = xpl_json_path_index(s);
+		if (index < 0 || index >= json_object_array_length(p))
+			return NULL;
+		return json_object_array_get_idx(p, index);
+	}
+
+#if JSON_C_MINOR_VERSION > 10
+	if (!json_object_object_get_ex(p, s, &p))
+		return NULL;
+	return p;
+#else
+	return json_object_object_get(p, s);
+#endif
+}
 
 struct json_object *xplclient_json_object_get_by_key(struct json_object *root, const char *key)
 {
@@ -30,27 +52,15 @@ struct json_object *xplclient_json_object_get_by_key(struct json_object *root, c
 		*d = '\0';
 
 		/* p points to current json tree object */
-#if JSON_C_MINOR_VERSION > 10
-		if (!json_object_object_get_ex(p, s, &p)) {
-			p = NULL;
-			goto free_out; /* not found, so leave */
-		}
-#else
-		p = json_object_object_get(p, s);
+		p = get_by_key_step(p, s);
 		if (p == NULL)
 			goto free_out; /* not found, so leave */
-#endif
 
 		/* adjust new start */
 		s = d + 1;
 	}
 
-#if JSON_C_MINOR_VERSION > 10
-	if (!json_object_object_get_ex(p, s, &p))
-		p = NULL; /* not found */
-#else
-	p = json_object_object_get(p, s);
-#endif
+	p = get_by_key_step(p, s);
 
 free_out:
 	free(k);
@@ -0,0 +1,265 @@
+/*
+ * Copyright © 2017 Michael Heimpold <mhei@heimpold.de>
+ *
+ * SPDX-License-Identifier: LGPL-2.1
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <json.h>
+
+#include "xplclient.h"
+#include "xplclient-private.h"
+
+/* numeric path elements may also address array elements */
+long xpl_json_path_index(const char *s)
+{
+	long v = 0;
+	int digits = 0;
+
+	for (; *s; s++) {
+		if (*s < '0' || *s > '9' || ++digits > 9)
+			return -1;
+		v = v * 10 + (*s - '0');
+	}
+
+	return digits ? v : -1;
+}
+
+/* look up or create the child node with the given key */
+static unsigned int json_path_child(xplclient_json_path_t jp, unsigned int parent, const char *key)
+{
+	struct json_path_node *node;
+	unsigned int *link = &jp->nodes[parent].child;
+
+	while (*link) {
+		if (strcmp(jp->nodes[*link].key, key) == 0)
+			return *link;
+		link = &jp->nodes[*link].sibling;
+	}
+
+	/* append, so that the evaluation order follows the order of the paths */
+	*link = jp->node_count++;
+
+	node = &jp->nodes[*link];
+	node->key = key;
+	node->parent = parent;
+	node->index = xpl_json_path_index(key);
+	node->leaf = -1;
+
+	return *link;
+}
+
+xplclient_json_path_t xplclient_json_path_compile_multi(const char * const *paths, unsigned int count)
+{
+	xplclient_json_path_t jp;
+	size_t len = 0;
+	unsigned int i, n, max_nodes = 1;
+	const char *p;
+	char *s, *d;
+
+	if (count == 0)
+		return NULL;
+
+	jp = calloc(1, sizeof(struct xplclient_json_path));
+	if (!jp)
+		return NULL;
+
+	jp->count = count;
+
+	/* each element of each path needs at most one node */
+	for (i = 0; i < count; i++) {
+		len += strlen(paths[i]) + 1;
+
+		for (p = paths[i]; (p = strchr(p, '/')); p++)
+			max_nodes++;
+		max_nodes++;
+	}
+
+	jp->strings = malloc(len);
+	if (!jp->strings)
+		goto free_out;
+
+	jp->nodes = calloc(max_nodes, sizeof(struct json_path_node));
+	if (!jp->nodes)
+		goto free_out;
+
+	jp->next_leaf = calloc(count, sizeof(int));
+	if (!jp->next_leaf)
+		goto free_out;
+
+	jp->nodes[0].leaf = -1;
+	jp->node_count = 1;
+
+	for (i = 0, s = jp->strings; i < count; i++) {
+		strcpy(s, paths[i]);
+		n = 0;
+
+		/* split into elements and walk down the tree */
+		while ((d = strchr(s, '/'))) {
+			*d = '\0';
+			n = json_path_child(jp, n, s);
+			s = d + 1;
+		}
+
+		n = json_path_child(jp, n, s);
+		s += strlen(s) + 1;
+
+		jp->next_leaf[i] = jp->nodes[n].leaf;
+		jp->nodes[n].leaf = i;
+
+		if (i == 0)
+			jp->first_leaf = n;
+	}
+
+	return jp;
+
+free_out:
+	xplclient_json_path_free(jp);
+	return NULL;
+}
+
+xplclient_json_path_t xplclient_json_path_compile(const char *path)
+{
+	return xplclient_json_path_compile_multi(&path, 1);
+}
+
+void xplclient_json_path_free(xplclient_json_path_t jp)
+{
+	if (!jp)
+		return;
+
+	free(jp->next_leaf);
+	free(jp->nodes);
+	free(jp->strings);
+	free(jp);
+}
+
+struct json_object *xpl_json_copy(struct json_object *data)
+{
+	struct json_object *copy, *el, *val;
+	int i, len;
+
+	switch (json_object_get_type(data)) {
+	case json_type_object:
+		copy = json_object_new_object();
+		if (!copy)
+			return NULL;
+
+		json_object_object_foreach(data, key, v) {
+			val = xpl_json_copy(v);
+			if (v && !val)
+				goto put_out;
+			json_object_object_add(copy, key, val);
+		}
+		return copy;
+
+	case json_type_array:
+		copy = json_object_new_array();
+		if (!copy)
+			return NULL;
+
+		len = json_object_array_length(data);
+		for (i = 0; i < len; i++) {
+			el = json_object_array_get_idx(data, i);
+			val = xpl_json_copy(el);
+			if (el && !val)
+				goto put_out;
+			if (json_object_array_add(copy, val) == -1) {
+				json_object_put(val);
+				goto put_out;
+			}
+		}
+		return copy;
+
+	case json_type_boolean:
+		return json_object_new_boolean(json_object_get_boolean(data));
+	case json_type_double:
+		return json_object_new_double(json_object_get_double(data));
+	case json_type_int:
+		return json_object_new_int64(json_object_get_int64(data));
+	case json_type_string:
+		return json_object_new_string_len(json_object_get_string(data), json_object_get_string_len(data));
+	default:
+		return NULL;
+	}
+
+put_out:
+	json_object_put(copy);
+	return NULL;
+}
+
+struct json_object *xpl_json_path_step(const struct json_path_node *node, struct json_object *obj)
+{
+	struct json_object *v = NULL;
+
+	switch (json_object_get_type(obj)) {
+	case json_type_object:
+#if JSON_C_MINOR_VERSION > 10
+		json_object_object_get_ex(obj, node->key, &v);
+#else
+		v = json_object_object_get(obj, node->key);
+#endif
+		break;
+	case json_type_array:
+		if (node->index >= 0 && node->index < json_object_array_length(obj))
+			v = json_object_array_get_idx(obj, node->index);
+		break;
+	default:
+		break;
+	}
+
+	return v;
+}
+
+static int json_path_eval(xplclient_json_path_t jp, unsigned int n, struct json_object *obj,
+                          struct json_object **values)
+{
+	const struct json_path_node *node = &jp->nodes[n];
+	struct json_object *v;
+	unsigned int c;
+	int l, found = 0;
+
+	for (l = node->leaf; l != -1; l = jp->next_leaf[l], found++)
+		values[l] = obj;
+
+	for (c = node->child; c; c = jp->nodes[c].sibling) {
+		v = xpl_json_path_step(&jp->nodes[c], obj);
+		if (v)
+			found += json_path_eval(jp, c, v, values);
+	}
+
+	return found;
+}
+
+int xplclient_json_path_get_multi(xplclient_json_path_t jp, struct json_object *root, struct json_object **values)
+{
+	memset(values, 0, jp->count * sizeof(struct json_object *));
+
+	if (!root)
+		return 0;
+
+	return json_path_eval(jp, 0, root, values);
+}
+
+/* resolve the single path ending at the given node, walking up to the root first */
+static struct json_object *json_path_resolve(xplclient_json_path_t jp, unsigned int n, struct json_object *root)
+{
+	struct json_object *p;
+
+	if (n == 0)
+		return root;
+
+	p = json_path_resolve(jp, jp->nodes[n].parent, root);
+
+	return p ? xpl_json_path_step(&jp->nodes[n], p) : NULL;
+}
+
+struct json_object *xplclient_json_path_get(xplclient_json_path_t jp, struct json_object *root)
+{
+	if (!root)
+		return NULL;
+
+	return json_path_resolve(jp, jp->first_leaf, root);
+}
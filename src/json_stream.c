@@ -0,0 +1,434 @@
+/*
+ * Copyright © 2017 Michael Heimpold <mhei@heimpold.de>
+ *
+ * SPDX-License-Identifier: LGPL-2.1
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <json.h>
+
+#include "xplclient.h"
+#include "xplclient-private.h"
+
+/*
+ * Streaming extraction of selected values from a JSON document: the document is scanned
+ * chunk by chunk while it is received, only the values addressed by the compiled paths
+ * are collected and parsed into JSON objects - everything else is merely skipped.
+ */
+
+/* longest object key which can still match a path element */
+#define JSON_STREAM_MAXKEY 256
+
+/* deepest nesting tracked, deeper paths never match */
+#define JSON_STREAM_MAXDEPTH 32
+
+/* no path continues here */
+#define JSON_STREAM_NOMATCH UINT_MAX
+
+enum json_stream_state {
+	JS_VALUE,       /* expecting a value */
+	JS_ARRAY_FIRST, /* after '[', expecting a value or ']' */
+	JS_KEY_START,   /* expecting an object key or '}' */
+	JS_KEY,         /* inside an object key */
+	JS_COLON,       /* after an object key */
+	JS_CONSUME,     /* inside a value which is skipped or captured */
+	JS_AFTER,       /* after a value inside a container */
+	JS_DONE,        /* document complete */
+	JS_ERROR,       /* document malformed */
+};
+
+/* a container on the path to the selected values */
+struct json_stream_frame {
+	unsigned int node;
+	int is_array;
+	long index;
+};
+
+struct xpl_json_stream {
+	xplclient_json_path_t paths;
+	xplclient_json_extract_cb cb;
+	void *cb_ctx;
+
+	enum json_stream_state state;
+
+	/* containers which (may) lead to a selected value */
+	struct json_stream_frame frames[JSON_STREAM_MAXDEPTH];
+	int depth;
+
+	/* tree node of the value which starts next */
+	unsigned int target;
+
+	/* current object key */
+	char key[JSON_STREAM_MAXKEY];
+	size_t keylen;
+	int key_esc, key_unmatchable;
+
+	/* state of the value being consumed */
+	int capture, literal, in_str, esc;
+	unsigned int nesting;
+
+	/* raw text of a captured value */
+	char *buf;
+	size_t buflen, bufsize;
+
+	struct json_tokener *tok;
+
+	/* count of values passed to the callback */
+	unsigned int found;
+};
+
+struct xpl_json_stream *xpl_json_stream_new(xplclient_json_path_t paths, xplclient_json_extract_cb cb, void *cb_ctx)
+{
+	struct xpl_json_stream *js;
+
+	js = calloc(1, sizeof(struct xpl_json_stream));
+	if (!js)
+		return NULL;
+
+	js->tok = xpl_pool_get_parser();
+	if (!js->tok) {
+		free(js);
+		return NULL;
+	}
+
+	js->paths = paths;
+	js->cb = cb;
+	js->cb_ctx = cb_ctx;
+
+	/* the document itself is the root of the path tree */
+	js->state = JS_VALUE;
+	js->target = 0;
+
+	return js;
+}
+
+void xpl_json_stream_free(struct xpl_json_stream *js)
+{
+	if (!js)
+		return;
+
+	xpl_pool_put_parser(js->tok);
+	free(js->buf);
+	free(js);
+}
+
+int xpl_json_stream_done(struct xpl_json_stream *js)
+{
+	return js->state == JS_DONE;
+}
+
+unsigned int xpl_json_stream_found(struct xpl_json_stream *js)
+{
+	return js->found;
+}
+
+static int json_stream_is_ws(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/* find the tree node of an object member or array element of the current container */
+static unsigned int json_stream_lookup(struct xpl_json_stream *js)
+{
+	struct json_stream_frame *f = &js->frames[js->depth - 1];
+	const struct json_path_node *nodes = js->paths->nodes;
+	unsigned int c;
+
+	if (f->node == JSON_STREAM_NOMATCH)
+		return JSON_STREAM_NOMATCH;
+
+	for (c = nodes[f->node].child; c; c = nodes[c].sibling) {
+		if (f->is_array) {
+			if (nodes[c].index == f->index)
+				return c;
+		} else if (!js->key_unmatchable && strcmp(nodes[c].key, js->key) == 0) {
+			return c;
+		}
+	}
+
+	return JSON_STREAM_NOMATCH;
+}
+
+static int json_stream_append(struct xpl_json_stream *js, char c)
+{
+	char *p;
+
+	if (js->buflen + 1 >= js->bufsize) {
+		p = realloc(js->buf, js->bufsize ? js->bufsize * 2 : 256);
+		if (!p)
+			return -1;
+
+		js->buf = p;
+		js->bufsize = js->bufsize ? js->bufsize * 2 : 256;
+	}
+
+	js->buf[js->buflen++] = c;
+	return 0;
+}
+
+/* pass a value and all values of deeper paths below it to the callback */
+static int json_stream_report(struct xpl_json_stream *js, unsigned int n, struct json_object *value)
+{
+	const struct json_path_node *nodes = js->paths->nodes;
+	struct json_object *v;
+	unsigned int c;
+	int l;
+
+	for (l = nodes[n].leaf; l != -1; l = js->paths->next_leaf[l]) {
+		js->found++;
+
+		if (js->cb(js->cb_ctx, l, json_object_get(value)))
+			return XPL_RECV_STOP;
+	}
+
+	for (c = nodes[n].child; c; c = nodes[c].sibling) {
+		v = xpl_json_path_step(&nodes[c], value);
+		if (v && json_stream_report(js, c, v))
+			return XPL_RECV_STOP;
+	}
+
+	return 0;
+}
+
+/* a value was completely consumed */
+static int json_stream_value_end(struct xpl_json_stream *js)
+{
+	struct json_object *value;
+	int rv = 0;
+
+	js->state = js->depth ? JS_AFTER : JS_DONE;
+
+	if (!js->capture)
+		return 0;
+
+	/* including the terminating NUL, so that literals at the end are complete, too */
+	js->buf[js->buflen] = '\0';
+	json_tokener_reset(js->tok);
+	value = json_tokener_parse_ex(js->tok, js->buf, js->buflen + 1);
+	if (!value) {
+		js->state = JS_ERROR;
+		return -1;
+	}
+
+	rv = json_stream_report(js, js->target, value);
+	json_object_put(value);
+
+	return rv;
+}
+
+/* begin a value with its first character, returns whether the character was consumed */
+static int json_stream_value_start(struct xpl_json_stream *js, char c)
+{
+	const struct json_path_node *node;
+	struct json_stream_frame *f;
+
+	node = (js->target == JSON_STREAM_NOMATCH) ? NULL : &js->paths->nodes[js->target];
+
+	/* container leading to selected values deeper inside: follow it */
+	if (node && node->leaf == -1 && (c == '{' || c == '[')) {
+		if (js->depth == JSON_STREAM_MAXDEPTH)
+			goto consume;
+
+		f = &js->frames[js->depth++];
+		f->node = js->target;
+		f->is_array = (c == '[');
+		f->index = 0;
+
+		js->state = f->is_array ? JS_ARRAY_FIRST : JS_KEY_START;
+		return 1;
+	}
+
+consume:
+	/* selected value: collect its text, anything else is just skipped */
+	js->capture = node && node->leaf != -1;
+	js->buflen = 0;
+	js->literal = js->in_str = js->esc = 0;
+	js->nesting = 0;
+
+	switch (c) {
+	case '{':
+	case '[':
+		js->nesting = 1;
+		break;
+	case '"':
+		js->in_str = 1;
+		break;
+	case '}':
+	case ']':
+	case ',':
+	case ':':
+		js->state = JS_ERROR;
+		return 1;
+	default:
+		js->literal = 1;
+		break;
+	}
+
+	if (js->capture && json_stream_append(js, c) == -1) {
+		js->state = JS_ERROR;
+		return 1;
+	}
+
+	js->state = JS_CONSUME;
+	return 1;
+}
+
+/* process a single character, returns whether it was consumed (otherwise process it again) */
+static int json_stream_char(struct xpl_json_stream *js, char c, int *rv)
+{
+	struct json_stream_frame *f;
+
+	switch (js->state) {
+	case JS_VALUE:
+		if (json_stream_is_ws(c))
+			return 1;
+		return json_stream_value_start(js, c);
+
+	case JS_ARRAY_FIRST:
+		if (json_stream_is_ws(c))
+			return 1;
+		if (c == ']') {
+			js->depth--;
+			js->state = js->depth ? JS_AFTER : JS_DONE;
+			return 1;
+		}
+		js->target = json_stream_lookup(js);
+		js->state = JS_VALUE;
+		return 0;
+
+	case JS_KEY_START:
+		if (json_stream_is_ws(c))
+			return 1;
+		if (c == '}' && js->frames[js->depth - 1].index == 0) {
+			js->depth--;
+			js->state = js->depth ? JS_AFTER : JS_DONE;
+			return 1;
+		}
+		if (c != '"') {
+			js->state = JS_ERROR;
+			return 1;
+		}
+		js->keylen = 0;
+		js->key_esc = js->key_unmatchable = 0;
+		js->state = JS_KEY;
+		return 1;
+
+	case JS_KEY:
+		if (js->key_esc) {
+			/* only simple escapes can be matched against path elements */
+			if (c != '"' && c != '\\' && c != '/')
+				js->key_unmatchable = 1;
+			js->key_esc = 0;
+		} else if (c == '\\') {
+			js->key_esc = 1;
+			return 1;
+		} else if (c == '"') {
+			js->key[js->keylen] = '\0';
+			js->state = JS_COLON;
+			return 1;
+		}
+
+		if (js->keylen + 1 < sizeof(js->key))
+			js->key[js->keylen++] = c;
+		else
+			js->key_unmatchable = 1;
+		return 1;
+
+	case JS_COLON:
+		if (json_stream_is_ws(c))
+			return 1;
+		if (c != ':') {
+			js->state = JS_ERROR;
+			return 1;
+		}
+		js->frames[js->depth - 1].index++;
+		js->target = json_stream_lookup(js);
+		js->state = JS_VALUE;
+		return 1;
+
+	case JS_CONSUME:
+		if (js->literal) {
+			/* a literal ends with the next structural character, which is not part of it */
+			if (json_stream_is_ws(c) || c == ',' || c == '}' || c == ']') {
+				*rv = json_stream_value_end(js);
+				return 0;
+			}
+		} else if (js->in_str) {
+			if (js->esc)
+				js->esc = 0;
+			else if (c == '\\')
+				js->esc = 1;
+			else if (c == '"')
+				js->in_str = 0;
+		} else if (c == '"') {
+			js->in_str = 1;
+		} else if (c == '{' || c == '[') {
+			js->nesting++;
+		} else if (c == '}' || c == ']') {
+			js->nesting--;
+		}
+
+		if (js->capture && json_stream_append(js, c) == -1) {
+			js->state = JS_ERROR;
+			return 1;
+		}
+
+		/* string or container complete? */
+		if (!js->literal && !js->in_str && js->nesting == 0)
+			*rv = json_stream_value_end(js);
+		return 1;
+
+	case JS_AFTER:
+		if (json_stream_is_ws(c))
+			return 1;
+
+		f = &js->frames[js->depth - 1];
+
+		if (c == ',') {
+			if (f->is_array) {
+				f->index++;
+				js->target = json_stream_lookup(js);
+				js->state = JS_VALUE;
+			} else {
+				js->state = JS_KEY_START;
+			}
+			return 1;
+		}
+
+		if (c == (f->is_array ? ']' : '}')) {
+			js->depth--;
+			js->state = js->depth ? JS_AFTER : JS_DONE;
+			return 1;
+		}
+
+		js->state = JS_ERROR;
+		return 1;
+
+	case JS_DONE:
+		/* trailing whitespace is fine, anything else is ignored */
+		return 1;
+
+	case JS_ERROR:
+	default:
+		return 1;
+	}
+}
+
+int xpl_json_stream_feed(struct xpl_json_stream *js, const char *buf, size_t len)
+{
+	size_t i = 0;
+	int rv = 0;
+
+	while (i < len && js->state != JS_ERROR) {
+		if (json_stream_char(js, buf[i], &rv))
+			i++;
+
+		if (rv)
+			return rv;
+	}
+
+	return (js->state == JS_ERROR) ? -1 : 0;
+}
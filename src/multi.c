@@ -0,0 +1,345 @@
+/*
+ * Copyright © 2017 Michael Heimpold <mhei@heimpold.de>
+ *
+ * SPDX-License-Identifier: LGPL-2.1
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <json.h>
+#include <curl/curl.h>
+
+#include "xplclient.h"
+#include "xplclient-private.h"
+
+/* a single queued GET/SET operation */
+struct multi_req {
+	/* linked list of all requests currently owned by the multi context */
+	struct multi_req *prev, *next;
+
+	/* private easy handle of this transfer */
+	CURL *curl;
+
+	/* XPL client context and path the request was issued for */
+	xplclient_t ctx;
+	char *path;
+
+	/* response body parser */
+	struct json_tokener *tok;
+	struct curl_recv_data recvdata;
+
+	/* completion callback */
+	xplclient_multi_cb cb;
+	void *cb_ctx;
+};
+
+struct xplclient_multi {
+	/* cURL multi handle driving all transfers */
+	CURLM *multi;
+
+	/* all queued or running requests */
+	struct multi_req *reqs;
+
+	/* event loop integration callbacks */
+	xplclient_multi_socket_cb socket_cb;
+	void *socket_cb_ctx;
+	xplclient_multi_timer_cb timer_cb;
+	void *timer_cb_ctx;
+};
+
+static void multi_req_free(struct multi_req *req)
+{
+	curl_easy_cleanup(req->curl);
+	xpl_recv_data_cleanup(&req->recvdata);
+
+	/* an oversized parser is not worth keeping */
+	if (req->tok && req->recvdata.size > req->ctx->recv_hwm)
+		json_tokener_free(req->tok);
+	else
+		xpl_pool_put_parser(req->tok);
+	free(req->path);
+	free(req);
+}
+
+static void multi_req_unlink(xplclient_multi_t m, struct multi_req *req)
+{
+	if (req->prev)
+		req->prev->next = req->next;
+	else
+		m->reqs = req->next;
+
+	if (req->next)
+		req->next->prev = req->prev;
+}
+
+static int multi_socket_cb(CURL *easy, curl_socket_t s, int what, void *userp, void *socketp)
+{
+	xplclient_multi_t m = (xplclient_multi_t)userp;
+
+	return m->socket_cb ? m->socket_cb(m->socket_cb_ctx, s, what) : 0;
+}
+
+static int multi_timer_cb(CURLM *multi, long timeout_ms, void *userp)
+{
+	xplclient_multi_t m = (xplclient_multi_t)userp;
+
+	return m->timer_cb ? m->timer_cb(m->timer_cb_ctx, timeout_ms) : 0;
+}
+
+xplclient_multi_t xplclient_multi_new(void)
+{
+	xplclient_multi_t m;
+
+	m = calloc(1, sizeof(struct xplclient_multi));
+	if (!m)
+		return NULL;
+
+	m->multi = curl_multi_init();
+	if (!m->multi)
+		goto free_out;
+
+	if (curl_multi_setopt(m->multi, CURLMOPT_SOCKETFUNCTION, multi_socket_cb) != CURLM_OK)
+		goto cleanup_out;
+
+	if (curl_multi_setopt(m->multi, CURLMOPT_SOCKETDATA, (void *)m) != CURLM_OK)
+		goto cleanup_out;
+
+	if (curl_multi_setopt(m->multi, CURLMOPT_TIMERFUNCTION, multi_timer_cb) != CURLM_OK)
+		goto cleanup_out;
+
+	if (curl_multi_setopt(m->multi, CURLMOPT_TIMERDATA, (void *)m) != CURLM_OK)
+		goto cleanup_out;
+
+	/* use HTTP/2 multiplexing for devices which support it */
+	if (curl_multi_setopt(m->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX) != CURLM_OK)
+		goto cleanup_out;
+
+	return m;
+
+cleanup_out:
+	curl_multi_cleanup(m->multi);
+free_out:
+	free(m);
+	return NULL;
+}
+
+void xplclient_multi_free(xplclient_multi_t m)
+{
+	struct multi_req *req;
+
+	if (!m)
+		return;
+
+	/* abort all pending requests without notifying */
+	while ((req = m->reqs)) {
+		multi_req_unlink(m, req);
+		curl_multi_remove_handle(m->multi, req->curl);
+		multi_req_free(req);
+	}
+
+	curl_multi_cleanup(m->multi);
+	free(m);
+}
+
+static int multi_add(xplclient_multi_t m, xplclient_t ctx, const char *path, struct json_object *data,
+                     xplclient_multi_cb cb, void *cb_ctx)
+{
+	struct multi_req *req;
+	char url[128];
+
+	if (snprintf(url, sizeof(url), "%s%s", ctx->url_prefix, path) >= sizeof(url))
+		return -1;
+
+	req = calloc(1, sizeof(struct multi_req));
+	if (!req)
+		return -1;
+
+	req->ctx = ctx;
+	req->cb = cb;
+	req->cb_ctx = cb_ctx;
+
+	req->path = strdup(path);
+	if (!req->path)
+		goto free_out;
+
+	/* each transfer parses its body while it arrives */
+	req->tok = xpl_pool_get_parser();
+	if (!req->tok)
+		goto free_out;
+
+	xpl_recv_data_init(&req->recvdata, req->tok);
+
+	/* the duplicate inherits all options the context's handle was set up with */
+	req->curl = curl_easy_duphandle(ctx->curl);
+	if (!req->curl)
+		goto free_out;
+
+	if (curl_easy_setopt(req->curl, CURLOPT_HTTPHEADER, data ? ctx->post_headers : ctx->headers) != CURLE_OK)
+		goto free_out;
+
+	if (curl_easy_setopt(req->curl, CURLOPT_URL, url) != CURLE_OK)
+		goto free_out;
+
+	if (curl_easy_setopt(req->curl, CURLOPT_WRITEFUNCTION, xpl_curl_recv_cb) != CURLE_OK)
+		goto free_out;
+
+	if (curl_easy_setopt(req->curl, CURLOPT_WRITEDATA, (void *)&req->recvdata) != CURLE_OK)
+		goto free_out;
+
+	if (curl_easy_setopt(req->curl, CURLOPT_PRIVATE, (void *)req) != CURLE_OK)
+		goto free_out;
+
+	if (data) {
+		/* let cURL copy the body so that caller may release data immediately */
+		if (curl_easy_setopt(req->curl, CURLOPT_COPYPOSTFIELDS, json_object_to_json_string(data)) != CURLE_OK)
+			goto free_out;
+	} else {
+		if (curl_easy_setopt(req->curl, CURLOPT_HTTPGET, 1L) != CURLE_OK)
+			goto free_out;
+	}
+
+	if (curl_multi_add_handle(m->multi, req->curl) != CURLM_OK)
+		goto free_out;
+
+	/* link in front */
+	req->next = m->reqs;
+	if (m->reqs)
+		m->reqs->prev = req;
+	m->reqs = req;
+
+	return 0;
+
+free_out:
+	multi_req_free(req);
+	return -1;
+}
+
+int xplclient_multi_add_get(xplclient_multi_t m, xplclient_t ctx, const char *path,
+                            xplclient_multi_cb cb, void *cb_ctx)
+{
+	return multi_add(m, ctx, path, NULL, cb, cb_ctx);
+}
+
+int xplclient_multi_add_set(xplclient_multi_t m, xplclient_t ctx, const char *path, struct json_object *data,
+                            xplclient_multi_cb cb, void *cb_ctx)
+{
+	return multi_add(m, ctx, path, data, cb, cb_ctx);
+}
+
+/* deliver the results of all finished transfers */
+static void multi_dispatch(xplclient_multi_t m)
+{
+	struct multi_req *req;
+	struct json_object *root;
+	CURLMsg *msg;
+	int pending;
+
+	while ((msg = curl_multi_info_read(m->multi, &pending))) {
+		if (msg->msg != CURLMSG_DONE)
+			continue;
+
+		if (curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&req) != CURLE_OK || !req)
+			continue;
+
+		root = NULL;
+		if (msg->data.result == CURLE_OK)
+			root = xpl_recv_data_finish(&req->recvdata);
+
+		xpl_stats_request(req->ctx, req->curl, req->path, &req->recvdata, root == NULL);
+
+		/* detach before calling back, so that callee may queue new requests */
+		curl_multi_remove_handle(m->multi, req->curl);
+		multi_req_unlink(m, req);
+
+		if (req->cb)
+			req->cb(req->cb_ctx, req->ctx, req->path, root);
+		else
+			json_object_put(root);
+
+		multi_req_free(req);
+	}
+}
+
+int xplclient_multi_perform(xplclient_multi_t m, int *running)
+{
+	int still_running;
+
+	if (curl_multi_perform(m->multi, &still_running) != CURLM_OK)
+		return -1;
+
+	multi_dispatch(m);
+
+	if (running)
+		*running = m->reqs ? 1 : 0;
+
+	return 0;
+}
+
+int xplclient_multi_wait(xplclient_multi_t m, int timeout_ms)
+{
+	int numfds;
+
+	if (curl_multi_wait(m->multi, NULL, 0, timeout_ms, &numfds) != CURLM_OK)
+		return -1;
+
+	return numfds;
+}
+
+int xplclient_multi_run(xplclient_multi_t m)
+{
+	int running;
+
+	do {
+		if (xplclient_multi_perform(m, &running) == -1)
+			return -1;
+
+		if (running && xplclient_multi_wait(m, 1000) == -1)
+			return -1;
+	} while (running);
+
+	return 0;
+}
+
+int xpl_multi_set_max_host_connections(xplclient_multi_t m, long max)
+{
+	return (curl_multi_setopt(m->multi, CURLMOPT_MAX_HOST_CONNECTIONS, max) == CURLM_OK) ? 0 : -1;
+}
+
+void xplclient_multi_set_socket_cb(xplclient_multi_t m, xplclient_multi_socket_cb cb, void *cb_ctx)
+{
+	m->socket_cb = cb;
+	m->socket_cb_ctx = cb_ctx;
+}
+
+void xplclient_multi_set_timer_cb(xplclient_multi_t m, xplclient_multi_timer_cb cb, void *cb_ctx)
+{
+	m->timer_cb = cb;
+	m->timer_cb_ctx = cb_ctx;
+}
+
+int xplclient_multi_socket_action(xplclient_multi_t m, int fd, int events, int *running)
+{
+	int still_running;
+
+	if (curl_multi_socket_action(m->multi, fd, events, &still_running) != CURLM_OK)
+		return -1;
+
+	multi_dispatch(m);
+
+	if (running)
+		*running = m->reqs ? 1 : 0;
+
+	return 0;
+}
+
+long xplclient_multi_timeout(xplclient_multi_t m)
+{
+	long timeout_ms;
+
+	if (curl_multi_timeout(m->multi, &timeout_ms) != CURLM_OK)
+		return -1;
+
+	return timeout_ms;
+}
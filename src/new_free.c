@@ -11,9 +11,11 @@
 #include <sys/socket.h>
 #include <netdb.h>
 
+#include <json.h>
 #include <curl/curl.h>
 
 #include "xplclient.h"
+#include "xplclient-private.h"
 
 static int ctx_init_curl(xplclient_t ctx)
 {
@@ -26,15 +28,42 @@ static int ctx_init_curl(xplclient_t ctx)
 	if (!ctx->headers)
 		goto err_out;
 
+	/* requests which carry a JSON body need an additional header */
+	ctx->post_headers = curl_slist_append(ctx->post_headers, "Accept: application/json");
+	if (!ctx->post_headers)
+		goto free_out;
+
+	ctx->post_headers = curl_slist_append(ctx->post_headers, "Content-Type: application/json");
+	if (!ctx->post_headers)
+		goto free_out;
+
+	ctx->tok = xpl_pool_get_parser();
+	if (!ctx->tok)
+		goto free_out;
+
+	ctx->recv_hwm = XPLCLIENT_DEFAULT_RECV_HWM;
+
 	if (curl_easy_setopt(ctx->curl, CURLOPT_HTTPHEADER, ctx->headers) != CURLE_OK)
 		goto free_out;
 
 	if (curl_easy_setopt(ctx->curl, CURLOPT_FOLLOWLOCATION, 1) != CURLE_OK)
 		goto free_out;
 
+	/* detect dead kept-alive connections in case the device vanishes silently */
+	if (curl_easy_setopt(ctx->curl, CURLOPT_TCP_KEEPALIVE, 1L) != CURLE_OK)
+		goto free_out;
+
+	/* connection re-use is enabled by default */
+	ctx->persistent = 1;
+
+	if (xpl_stats_ctx_new(ctx) == -1)
+		goto free_out;
+
 	return 0;
 
 free_out:
+	xpl_pool_put_parser(ctx->tok);
+	curl_slist_free_all(ctx->post_headers);
 	curl_slist_free_all(ctx->headers);
 err_out:
 	curl_easy_cleanup(ctx->curl);
@@ -46,9 +75,10 @@ xplclient_t xplclient_new_by_addr(const struct sockaddr *addr, socklen_t addrlen
 	struct sockaddr_storage sa;
 	struct sockaddr_in6 *sa6 = (struct sockaddr_in6 *)&sa;
 	struct sockaddr_in *sa4 = (struct sockaddr_in *)&sa;
-	char host[64]; /* > INET6_ADDRSTRLEN */
+	char host[NI_MAXHOST];
 	char port[8]; /* > 5 digits max */
-	char url[64];
+	char url[NI_MAXHOST + 32];
+	char *zone;
 	xplclient_t ctx;
 
 	ctx = calloc(1, sizeof(struct xplclient));
@@ -74,8 +104,19 @@ xplclient_t xplclient_new_by_addr(const struct sockaddr *addr, socklen_t addrlen
 		goto free_out;
 
 	/* build our url... */
-	if (snprintf(url, sizeof(url), "http://%s:%s/api", host, port) >= sizeof(url))
-		goto free_out; /* buffer too small -> URL truncated -> bail out */
+	if (sa.ss_family == AF_INET6) {
+		/* IPv6 literals need brackets, a zone index (link-local) must be escaped as %25 */
+		zone = strchr(host, '%');
+		if (zone)
+			*zone++ = '\0';
+
+		if (snprintf(url, sizeof(url), "http://[%s%s%s]:%s/api", host, zone ? "%25" : "", zone ? : "",
+		             port) >= sizeof(url))
+			goto free_out; /* buffer too small -> URL truncated -> bail out */
+	} else {
+		if (snprintf(url, sizeof(url), "http://%s:%s/api", host, port) >= sizeof(url))
+			goto free_out; /* buffer too small -> URL truncated -> bail out */
+	}
 
 	/* ...copy buffer */
 	ctx->url_prefix = strdup(url);
@@ -121,8 +162,32 @@ void xplclient_free(xplclient_t ctx)
 		return;
 
 	free(ctx->url_prefix);
+	xplclient_multi_free(ctx->bulk);
+	xpl_threadsafe_free(ctx);
+	xpl_shadow_free(ctx->shadow);
+	xpl_stats_ctx_free(ctx);
 	curl_easy_cleanup(ctx->curl);
 	curl_slist_free_all(ctx->headers);
+	curl_slist_free_all(ctx->post_headers);
+	xpl_pool_put_parser(ctx->tok);
 
 	free(ctx);
 }
+
+int xplclient_set_persistent(xplclient_t ctx, int enable)
+{
+	if (curl_easy_setopt(ctx->curl, CURLOPT_FORBID_REUSE, enable ? 0L : 1L) != CURLE_OK)
+		return -1;
+
+	if (curl_easy_setopt(ctx->curl, CURLOPT_FRESH_CONNECT, enable ? 0L : 1L) != CURLE_OK)
+		return -1;
+
+	ctx->persistent = enable ? 1 : 0;
+
+	return 0;
+}
+
+void xplclient_set_recv_hwm(xplclient_t ctx, size_t bytes)
+{
+	ctx->recv_hwm = bytes;
+}
@@ -0,0 +1,403 @@
+/*
+ * Copyright © 2017 Michael Heimpold <mhei@heimpold.de>
+ *
+ * SPDX-License-Identifier: LGPL-2.1
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <json.h>
+
+#include "xplclient.h"
+#include "xplclient-private.h"
+
+/* a polled path and its previous response */
+struct poller_entry {
+	struct poller_entry *next;
+
+	char *path;
+	struct json_object *last;
+
+	/* no response received yet */
+	int initial;
+};
+
+struct xplclient_poller {
+	xplclient_t ctx;
+
+	/* polled paths in the order of their adding */
+	struct poller_entry *head, **tail;
+	unsigned int count;
+
+	xplclient_poller_cb cb;
+	void *cb_ctx;
+};
+
+/* state of a single diff run */
+struct poller_diff {
+	xplclient_poller_t p;
+	const char *path;
+
+	/* key of the current node, grows and shrinks while descending */
+	char *key;
+	size_t len, size;
+
+	/* count of reported changes */
+	int changes;
+};
+
+xplclient_poller_t xplclient_poller_new(xplclient_t ctx, xplclient_poller_cb cb, void *cb_ctx)
+{
+	xplclient_poller_t p;
+
+	p = calloc(1, sizeof(struct xplclient_poller));
+	if (!p)
+		return NULL;
+
+	p->ctx = ctx;
+	p->tail = &p->head;
+	p->cb = cb;
+	p->cb_ctx = cb_ctx;
+
+	return p;
+}
+
+int xplclient_poller_add(xplclient_poller_t p, const char *path)
+{
+	struct poller_entry *e;
+
+	for (e = p->head; e; e = e->next)
+		if (strcmp(e->path, path) == 0)
+			return 0;
+
+	e = calloc(1, sizeof(struct poller_entry));
+	if (!e)
+		return -1;
+
+	e->path = strdup(path);
+	if (!e->path) {
+		free(e);
+		return -1;
+	}
+	e->initial = 1;
+
+	*p->tail = e;
+	p->tail = &e->next;
+	p->count++;
+
+	return 0;
+}
+
+/* append an element to the current key, returns the previous length to restore or -1 on error */
+static int poller_key_push(struct poller_diff *d, const char *elem)
+{
+	size_t old = d->len, l = strlen(elem);
+	char *k;
+
+	while (d->len + l + 2 > d->size) {
+		k = realloc(d->key, d->size ? d->size * 2 : 128);
+		if (!k)
+			return -1;
+		d->key = k;
+		d->size = d->size ? d->size * 2 : 128;
+	}
+
+	/* no separator in front of the first element, like xplclient_json_object_get_by_key expects */
+	if (d->len)
+		d->key[d->len++] = '/';
+	memcpy(d->key + d->len, elem, l + 1);
+	d->len += l;
+
+	return old;
+}
+
+static void poller_key_pop(struct poller_diff *d, int old)
+{
+	d->len = old;
+	d->key[d->len] = '\0';
+}
+
+static int poller_is_container(struct json_object *obj)
+{
+	return json_object_is_type(obj, json_type_object) || json_object_is_type(obj, json_type_array);
+}
+
+/* compare two leaves, JSON null is represented by NULL */
+static int poller_leaf_equal(struct json_object *a, struct json_object *b)
+{
+	if (!a || !b)
+		return a == b;
+
+	if (json_object_get_type(a) != json_object_get_type(b))
+		return 0;
+
+	switch (json_object_get_type(a)) {
+	case json_type_boolean:
+		return json_object_get_boolean(a) == json_object_get_boolean(b);
+	case json_type_int:
+		return json_object_get_int64(a) == json_object_get_int64(b);
+	case json_type_double:
+		return json_object_get_double(a) == json_object_get_double(b);
+	case json_type_string:
+		return json_object_get_string_len(a) == json_object_get_string_len(b) &&
+		       memcmp(json_object_get_string(a), json_object_get_string(b), json_object_get_string_len(a)) == 0;
+	default:
+		return 0;
+	}
+}
+
+static void poller_report(struct poller_diff *d, enum xplclient_poller_change what,
+                          struct json_object *old_value, struct json_object *new_value)
+{
+	d->changes++;
+
+	if (d->p->cb)
+		d->p->cb(d->p->cb_ctx, d->path, d->key ? d->key : "", what, old_value, new_value);
+}
+
+static int poller_walk_child(struct poller_diff *d, const char *elem, struct json_object *obj,
+                             enum xplclient_poller_change what);
+
+/* report all leaves below obj as added or removed */
+static int poller_walk(struct poller_diff *d, struct json_object *obj, enum xplclient_poller_change what)
+{
+	char idx[16];
+	int i, n;
+
+	if (!poller_is_container(obj)) {
+		if (what == XPLCLIENT_POLLER_ADDED)
+			poller_report(d, what, NULL, obj);
+		else
+			poller_report(d, what, obj, NULL);
+		return 0;
+	}
+
+	if (json_object_is_type(obj, json_type_object)) {
+		json_object_object_foreach(obj, key, val)
+			if (poller_walk_child(d, key, val, what) == -1)
+				return -1;
+		return 0;
+	}
+
+	n = json_object_array_length(obj);
+	for (i = 0; i < n; i++) {
+		snprintf(idx, sizeof(idx), "%d", i);
+		if (poller_walk_child(d, idx, json_object_array_get_idx(obj, i), what) == -1)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int poller_walk_child(struct poller_diff *d, const char *elem, struct json_object *obj,
+                             enum xplclient_poller_change what)
+{
+	int old;
+
+	old = poller_key_push(d, elem);
+	if (old == -1)
+		return -1;
+
+	if (poller_walk(d, obj, what) == -1)
+		return -1;
+
+	poller_key_pop(d, old);
+	return 0;
+}
+
+static int poller_diff(struct poller_diff *d, struct json_object *a, struct json_object *b);
+
+static int poller_diff_child(struct poller_diff *d, const char *elem, struct json_object *a, struct json_object *b)
+{
+	int old;
+
+	old = poller_key_push(d, elem);
+	if (old == -1)
+		return -1;
+
+	if (poller_diff(d, a, b) == -1)
+		return -1;
+
+	poller_key_pop(d, old);
+	return 0;
+}
+
+/* look up a member, returns whether the key exists */
+static int poller_member(struct json_object *obj, const char *key, struct json_object **val)
+{
+#if JSON_C_MINOR_VERSION > 10
+	return json_object_object_get_ex(obj, key, val);
+#else
+	/* a member with a null value cannot be told from a missing one here */
+	*val = json_object_object_get(obj, key);
+	return *val != NULL;
+#endif
+}
+
+/* structural diff of two trees, reporting each changed leaf */
+static int poller_diff(struct poller_diff *d, struct json_object *a, struct json_object *b)
+{
+	struct json_object *v;
+	char idx[16];
+	int i, na, nb, rv;
+
+	/* unchanged subtree, e.g. when the same object is passed twice */
+	if (a == b)
+		return 0;
+
+	if (json_object_is_type(a, json_type_object) && json_object_is_type(b, json_type_object)) {
+		json_object_object_foreach(a, ka, va) {
+			if (poller_member(b, ka, &v)) {
+				if (poller_diff_child(d, ka, va, v) == -1)
+					return -1;
+			} else {
+				if (poller_walk_child(d, ka, va, XPLCLIENT_POLLER_REMOVED) == -1)
+					return -1;
+			}
+		}
+
+		json_object_object_foreach(b, kb, vb) {
+			if (poller_member(a, kb, &v))
+				continue;
+
+			if (poller_walk_child(d, kb, vb, XPLCLIENT_POLLER_ADDED) == -1)
+				return -1;
+		}
+
+		return 0;
+	}
+
+	if (json_object_is_type(a, json_type_array) && json_object_is_type(b, json_type_array)) {
+		na = json_object_array_length(a);
+		nb = json_object_array_length(b);
+
+		for (i = 0; i < na || i < nb; i++) {
+			snprintf(idx, sizeof(idx), "%d", i);
+
+			if (i < na && i < nb)
+				rv = poller_diff_child(d, idx, json_object_array_get_idx(a, i), json_object_array_get_idx(b, i));
+			else if (i < na)
+				rv = poller_walk_child(d, idx, json_object_array_get_idx(a, i), XPLCLIENT_POLLER_REMOVED);
+			else
+				rv = poller_walk_child(d, idx, json_object_array_get_idx(b, i), XPLCLIENT_POLLER_ADDED);
+
+			if (rv == -1)
+				return -1;
+		}
+
+		return 0;
+	}
+
+	/* a container replaced by a leaf or vice versa: the whole subtree changed */
+	if (poller_is_container(a) || poller_is_container(b)) {
+		if (poller_walk(d, a, XPLCLIENT_POLLER_REMOVED) == -1)
+			return -1;
+		return poller_walk(d, b, XPLCLIENT_POLLER_ADDED);
+	}
+
+	if (!poller_leaf_equal(a, b))
+		poller_report(d, XPLCLIENT_POLLER_CHANGED, a, b);
+
+	return 0;
+}
+
+int xplclient_poller_poll(xplclient_poller_t p)
+{
+	struct xplclient_bulk_item *items;
+	struct poller_diff d;
+	struct poller_entry *e;
+	unsigned int i;
+	int ok, rv = -1;
+
+	if (!p->count)
+		return 0;
+
+	items = calloc(p->count, sizeof(struct xplclient_bulk_item));
+	if (!items)
+		return -1;
+
+	for (e = p->head, i = 0; e; e = e->next, i++)
+		items[i].path = e->path;
+
+	ok = xplclient_url_get_bulk(p->ctx, items, p->count);
+	if (ok == -1)
+		goto free_out;
+
+	/* not a single path could be read, the device is most likely gone */
+	if (ok == 0) {
+		errno = EIO;
+		goto free_out;
+	}
+
+	memset(&d, 0, sizeof(d));
+	d.p = p;
+
+	for (e = p->head, i = 0; e; e = e->next, i++) {
+		/* a failed path keeps its previous response, changes are reported on the next success */
+		if (items[i].err)
+			continue;
+
+		d.path = e->path;
+		d.len = 0;
+		if (d.key)
+			d.key[0] = '\0';
+
+		if (e->initial) {
+			rv = poller_walk(&d, items[i].result, XPLCLIENT_POLLER_ADDED);
+			e->initial = 0;
+		} else {
+			rv = poller_diff(&d, e->last, items[i].result);
+		}
+
+		/* the new response becomes the reference for the next poll */
+		json_object_put(e->last);
+		e->last = items[i].result;
+		items[i].result = NULL;
+
+		if (rv == -1)
+			goto key_free_out;
+	}
+
+	rv = d.changes;
+
+key_free_out:
+	free(d.key);
+
+free_out:
+	for (i = 0; i < p->count; i++)
+		json_object_put(items[i].result);
+	free(items);
+	return rv;
+}
+
+struct json_object *xplclient_poller_get_last(xplclient_poller_t p, const char *path)
+{
+	struct poller_entry *e;
+
+	for (e = p->head; e; e = e->next)
+		if (strcmp(e->path, path) == 0)
+			return e->last;
+
+	return NULL;
+}
+
+void xplclient_poller_free(xplclient_poller_t p)
+{
+	struct poller_entry *e;
+
+	if (!p)
+		return;
+
+	while ((e = p->head)) {
+		p->head = e->next;
+
+		json_object_put(e->last);
+		free(e->path);
+		free(e);
+	}
+
+	free(p);
+}
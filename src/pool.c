@@ -0,0 +1,133 @@
+/*
+ * Copyright © 2017 Michael Heimpold <mhei@heimpold.de>
+ *
+ * SPDX-License-Identifier: LGPL-2.1
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <json.h>
+
+#include "xplclient.h"
+#include "xplclient-private.h"
+
+/*
+ * Library-wide pool of receive resources: response parsers (whose internal buffers
+ * have already grown to a typical response size) and datagram rings of the searches.
+ * Short-lived contexts and requests take them from here instead of allocating them
+ * again and again.
+ */
+
+/* upper bound for the configurable limits */
+#define POOL_CAPACITY 64
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct json_tokener *pool_parsers[POOL_CAPACITY];
+static unsigned int pool_parser_count;
+static unsigned int pool_parser_max = XPLCLIENT_POOL_DEFAULT_PARSERS;
+
+static char *pool_rx_bufs[POOL_CAPACITY];
+static unsigned int pool_rx_buf_count;
+static unsigned int pool_rx_buf_max = XPLCLIENT_POOL_DEFAULT_RX_BUFFERS;
+
+struct json_tokener *xpl_pool_get_parser(void)
+{
+	struct json_tokener *tok = NULL;
+
+	pthread_mutex_lock(&pool_lock);
+	if (pool_parser_count)
+		tok = pool_parsers[--pool_parser_count];
+	pthread_mutex_unlock(&pool_lock);
+
+	if (tok) {
+		json_tokener_reset(tok);
+		return tok;
+	}
+
+	return json_tokener_new();
+}
+
+void xpl_pool_put_parser(struct json_tokener *tok)
+{
+	if (!tok)
+		return;
+
+	pthread_mutex_lock(&pool_lock);
+	if (pool_parser_count < pool_parser_max) {
+		pool_parsers[pool_parser_count++] = tok;
+		tok = NULL;
+	}
+	pthread_mutex_unlock(&pool_lock);
+
+	/* pool is full */
+	if (tok)
+		json_tokener_free(tok);
+}
+
+char *xpl_pool_get_rx_buf(void)
+{
+	char *buf = NULL;
+
+	pthread_mutex_lock(&pool_lock);
+	if (pool_rx_buf_count)
+		buf = pool_rx_bufs[--pool_rx_buf_count];
+	pthread_mutex_unlock(&pool_lock);
+
+	return buf ? : malloc(XPL_RECV_BATCH * XPL_MAX_DATAGRAM);
+}
+
+void xpl_pool_put_rx_buf(char *buf)
+{
+	if (!buf)
+		return;
+
+	pthread_mutex_lock(&pool_lock);
+	if (pool_rx_buf_count < pool_rx_buf_max) {
+		pool_rx_bufs[pool_rx_buf_count++] = buf;
+		buf = NULL;
+	}
+	pthread_mutex_unlock(&pool_lock);
+
+	free(buf);
+}
+
+/* release pooled items above the limits, must be called with the lock held */
+static void pool_trim(void)
+{
+	while (pool_parser_count > pool_parser_max)
+		json_tokener_free(pool_parsers[--pool_parser_count]);
+
+	while (pool_rx_buf_count > pool_rx_buf_max)
+		free(pool_rx_bufs[--pool_rx_buf_count]);
+}
+
+void xplclient_pool_set_limits(unsigned int parsers, unsigned int rx_buffers)
+{
+	pthread_mutex_lock(&pool_lock);
+
+	pool_parser_max = (parsers < POOL_CAPACITY) ? parsers : POOL_CAPACITY;
+	pool_rx_buf_max = (rx_buffers < POOL_CAPACITY) ? rx_buffers : POOL_CAPACITY;
+	pool_trim();
+
+	pthread_mutex_unlock(&pool_lock);
+}
+
+void xplclient_pool_flush(void)
+{
+	unsigned int parsers, rx_buffers;
+
+	pthread_mutex_lock(&pool_lock);
+
+	parsers = pool_parser_max;
+	rx_buffers = pool_rx_buf_max;
+
+	pool_parser_max = pool_rx_buf_max = 0;
+	pool_trim();
+
+	pool_parser_max = parsers;
+	pool_rx_buf_max = rx_buffers;
+
+	pthread_mutex_unlock(&pool_lock);
+}
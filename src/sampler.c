@@ -0,0 +1,472 @@
+/*
+ * Copyright © 2017 Michael Heimpold <mhei@heimpold.de>
+ *
+ * SPDX-License-Identifier: LGPL-2.1
+ */
+
+#include <endian.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <json.h>
+
+#include "xplclient.h"
+#include "xplclient-private.h"
+
+/* a sampled value and its ring buffer */
+struct sampler_channel {
+	/* struct of arrays, so that each column is contiguous (and written as such) */
+	uint64_t *ts;
+	double *values;
+
+	/* index of the oldest sample and count of samples */
+	unsigned int head;
+	unsigned int count;
+
+	/* samples overwritten since the last export */
+	uint64_t lost;
+
+	char *name;
+};
+
+/* channels which are read with the same request */
+struct sampler_group {
+	struct sampler_group *next;
+	struct xplclient_sampler *s;
+
+	xplclient_t ctx;
+	char *path;
+
+	/* keys inside the response and the channels they belong to, in the order of adding */
+	char **keys;
+	unsigned int *channels;
+	unsigned int count;
+
+	/* compiled keys, NULL after adding a channel until the next sample */
+	xplclient_json_path_t compiled;
+
+	/* values found by xplclient_json_path_get_multi */
+	struct json_object **found;
+};
+
+struct xplclient_sampler {
+	/* samples per channel */
+	unsigned int capacity;
+
+	struct sampler_channel *channels;
+	unsigned int count;
+
+	struct sampler_group *groups;
+
+	/* request engine, created on first use */
+	xplclient_multi_t multi;
+
+	/* count of samples stored by the current xplclient_sampler_sample */
+	int stored;
+};
+
+xplclient_sampler_t xplclient_sampler_new(unsigned int capacity)
+{
+	xplclient_sampler_t s;
+
+	if (!capacity) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	s = calloc(1, sizeof(struct xplclient_sampler));
+	if (!s)
+		return NULL;
+
+	s->capacity = capacity;
+
+	return s;
+}
+
+static void sampler_group_free(struct sampler_group *g)
+{
+	unsigned int i;
+
+	for (i = 0; i < g->count; i++)
+		free(g->keys[i]);
+	free(g->keys);
+	free(g->channels);
+	free(g->found);
+	xplclient_json_path_free(g->compiled);
+	free(g->path);
+	free(g);
+}
+
+static struct sampler_group *sampler_group_get(xplclient_sampler_t s, xplclient_t ctx, const char *path)
+{
+	struct sampler_group *g;
+
+	for (g = s->groups; g; g = g->next)
+		if (g->ctx == ctx && strcmp(g->path, path) == 0)
+			return g;
+
+	g = calloc(1, sizeof(struct sampler_group));
+	if (!g)
+		return NULL;
+
+	g->path = strdup(path);
+	if (!g->path) {
+		free(g);
+		return NULL;
+	}
+
+	g->s = s;
+	g->ctx = ctx;
+	g->next = s->groups;
+	s->groups = g;
+
+	return g;
+}
+
+int xplclient_sampler_add(xplclient_sampler_t s, xplclient_t ctx, const char *path, const char *key, const char *name)
+{
+	struct sampler_channel *channels, *c;
+	struct sampler_group *g;
+	void *p;
+
+	g = sampler_group_get(s, ctx, path);
+	if (!g)
+		return -1;
+
+	/* grow the arrays of the group first, a failure leaves all as it was */
+	p = realloc(g->keys, (g->count + 1) * sizeof(char *));
+	if (!p)
+		goto group_out;
+	g->keys = p;
+
+	p = realloc(g->channels, (g->count + 1) * sizeof(unsigned int));
+	if (!p)
+		goto group_out;
+	g->channels = p;
+
+	p = realloc(g->found, (g->count + 1) * sizeof(struct json_object *));
+	if (!p)
+		goto group_out;
+	g->found = p;
+
+	channels = realloc(s->channels, (s->count + 1) * sizeof(struct sampler_channel));
+	if (!channels)
+		goto group_out;
+	s->channels = channels;
+
+	c = &s->channels[s->count];
+	memset(c, 0, sizeof(*c));
+
+	g->keys[g->count] = strdup(key);
+	if (!g->keys[g->count])
+		goto group_out;
+
+	c->ts = calloc(s->capacity, sizeof(uint64_t));
+	c->values = calloc(s->capacity, sizeof(double));
+	if (name)
+		c->name = strdup(name);
+	else if (asprintf(&c->name, "%s%s/%s", ctx->url_prefix, path, key) == -1)
+		c->name = NULL;
+
+	if (!c->ts || !c->values || !c->name) {
+		free(c->name);
+		free(c->values);
+		free(c->ts);
+		free(g->keys[g->count]);
+		goto group_out;
+	}
+
+	/* the keys have to be compiled again */
+	xplclient_json_path_free(g->compiled);
+	g->compiled = NULL;
+
+	g->channels[g->count] = s->count;
+	g->count++;
+
+	return s->count++;
+
+group_out:
+	/* a group just created for this channel must not stay empty, it could not be sampled */
+	if (!g->count) {
+		struct sampler_group **pg;
+
+		for (pg = &s->groups; *pg != g; pg = &(*pg)->next)
+			;
+		*pg = g->next;
+		sampler_group_free(g);
+	}
+
+	return -1;
+}
+
+static uint64_t sampler_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sampler_push(xplclient_sampler_t s, struct sampler_channel *c, uint64_t ts, double value)
+{
+	unsigned int i = (c->head + c->count) % s->capacity;
+
+	/* full: i is the oldest sample, which is overwritten */
+	if (c->count == s->capacity) {
+		c->head = (c->head + 1) % s->capacity;
+		c->lost++;
+	} else {
+		c->count++;
+	}
+
+	c->ts[i] = ts;
+	c->values[i] = value;
+}
+
+/* completion callback of the request of a group */
+static int sampler_cb(void *cb_ctx, xplclient_t ctx, const char *path, struct json_object *result)
+{
+	struct sampler_group *g = (struct sampler_group *)cb_ctx;
+	uint64_t now;
+	unsigned int i;
+	double value;
+
+	if (!result)
+		return 0;
+
+	now = sampler_now();
+
+	xplclient_json_path_get_multi(g->compiled, result, g->found);
+
+	for (i = 0; i < g->count; i++) {
+		switch (json_object_get_type(g->found[i])) {
+		case json_type_int:
+		case json_type_double:
+		case json_type_boolean:
+			value = json_object_get_double(g->found[i]);
+			break;
+		default:
+			continue;
+		}
+
+		sampler_push(g->s, &g->s->channels[g->channels[i]], now, value);
+		g->s->stored++;
+	}
+
+	json_object_put(result);
+	return 0;
+}
+
+int xplclient_sampler_sample(xplclient_sampler_t s)
+{
+	struct sampler_group *g;
+
+	for (g = s->groups; g; g = g->next) {
+		if (g->compiled)
+			continue;
+
+		g->compiled = xplclient_json_path_compile_multi((const char * const *)g->keys, g->count);
+		if (!g->compiled)
+			return -1;
+	}
+
+	if (!s->multi) {
+		s->multi = xplclient_multi_new();
+		if (!s->multi)
+			return -1;
+	}
+
+	s->stored = 0;
+
+	for (g = s->groups; g; g = g->next)
+		if (xplclient_multi_add_get(s->multi, g->ctx, g->path, sampler_cb, g) == -1)
+			goto drop_out;
+
+	if (xplclient_multi_run(s->multi) == -1)
+		goto drop_out;
+
+	return s->stored;
+
+drop_out:
+	/* drop all pending requests, the engine cannot be trusted anymore */
+	xplclient_multi_free(s->multi);
+	s->multi = NULL;
+	return -1;
+}
+
+int xplclient_sampler_latest(xplclient_sampler_t s, unsigned int channel, uint64_t *timestamp, double *value)
+{
+	struct sampler_channel *c;
+	unsigned int i;
+
+	if (channel >= s->count || !s->channels[channel].count)
+		return -1;
+
+	c = &s->channels[channel];
+	i = (c->head + c->count - 1) % s->capacity;
+
+	if (timestamp)
+		*timestamp = c->ts[i];
+	if (value)
+		*value = c->values[i];
+
+	return 0;
+}
+
+/* write 64 bit words in little endian */
+static int sampler_write64(FILE *f, const void *data, size_t n)
+{
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+	return (fwrite(data, sizeof(uint64_t), n, f) == n) ? 0 : -1;
+#else
+	const char *p = data;
+	uint64_t v;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		memcpy(&v, p + i * sizeof(v), sizeof(v));
+		v = htole64(v);
+		if (fwrite(&v, sizeof(v), 1, f) != 1)
+			return -1;
+	}
+
+	return 0;
+#endif
+}
+
+/* write a column of a ring buffer, oldest first */
+static int sampler_write_column(FILE *f, xplclient_sampler_t s, const struct sampler_channel *c, const void *column)
+{
+	unsigned int first = c->count;
+
+	/* the samples may wrap around the end of the buffer */
+	if (c->head + c->count > s->capacity)
+		first = s->capacity - c->head;
+
+	if (sampler_write64(f, (const char *)column + c->head * sizeof(uint64_t), first) == -1)
+		return -1;
+
+	return sampler_write64(f, column, c->count - first);
+}
+
+long xplclient_sampler_export(xplclient_sampler_t s, const char *filename)
+{
+	struct xplclient_ts_header hdr;
+	struct xplclient_ts_channel ch;
+	struct sampler_channel *c;
+	uint64_t offset, name_offset;
+	unsigned int i;
+	char *tmpfile;
+	long total = 0;
+	FILE *f;
+	int err;
+
+	if (asprintf(&tmpfile, "%s.tmp", filename) == -1)
+		return -1;
+
+	f = fopen(tmpfile, "w");
+	if (!f)
+		goto free_out;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, XPLCLIENT_TS_MAGIC, sizeof(hdr.magic));
+	hdr.version = htole32(XPLCLIENT_TS_VERSION);
+	hdr.channels = htole32(s->count);
+	hdr.created_ns = htole64(sampler_now());
+
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+		goto close_out;
+
+	/* the columns follow the directory, the names follow the columns */
+	offset = sizeof(hdr) + (uint64_t)s->count * sizeof(ch);
+	name_offset = offset;
+	for (i = 0; i < s->count; i++)
+		name_offset += 2 * (uint64_t)s->channels[i].count * sizeof(uint64_t);
+
+	for (i = 0; i < s->count; i++) {
+		c = &s->channels[i];
+
+		ch.count = htole64(c->count);
+		ch.lost = htole64(c->lost);
+		ch.ts_offset = htole64(offset);
+		ch.value_offset = htole64(offset + (uint64_t)c->count * sizeof(uint64_t));
+		ch.name_offset = htole64(name_offset);
+
+		if (fwrite(&ch, sizeof(ch), 1, f) != 1)
+			goto close_out;
+
+		offset += 2 * (uint64_t)c->count * sizeof(uint64_t);
+		name_offset += strlen(c->name) + 1;
+		total += c->count;
+	}
+
+	for (i = 0; i < s->count; i++) {
+		c = &s->channels[i];
+
+		if (sampler_write_column(f, s, c, c->ts) == -1 ||
+		    sampler_write_column(f, s, c, c->values) == -1)
+			goto close_out;
+	}
+
+	for (i = 0; i < s->count; i++)
+		if (fwrite(s->channels[i].name, strlen(s->channels[i].name) + 1, 1, f) != 1)
+			goto close_out;
+
+	if (fclose(f) != 0)
+		goto unlink_out;
+
+	if (rename(tmpfile, filename) == -1)
+		goto unlink_out;
+
+	/* exported, so the rings start over */
+	for (i = 0; i < s->count; i++) {
+		s->channels[i].head = 0;
+		s->channels[i].count = 0;
+		s->channels[i].lost = 0;
+	}
+
+	free(tmpfile);
+	return total;
+
+close_out:
+	err = errno;
+	fclose(f);
+	errno = err;
+unlink_out:
+	err = errno;
+	unlink(tmpfile);
+	errno = err;
+free_out:
+	free(tmpfile);
+	return -1;
+}
+
+void xplclient_sampler_free(xplclient_sampler_t s)
+{
+	struct sampler_group *g;
+	unsigned int i;
+
+	if (!s)
+		return;
+
+	xplclient_multi_free(s->multi);
+
+	while ((g = s->groups)) {
+		s->groups = g->next;
+		sampler_group_free(g);
+	}
+
+	for (i = 0; i < s->count; i++) {
+		free(s->channels[i].ts);
+		free(s->channels[i].values);
+		free(s->channels[i].name);
+	}
+	free(s->channels);
+
+	free(s);
+}
@@ -6,37 +6,76 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 #include <errno.h>
 #include <string.h>
-#include <ctype.h>
 #include <stdlib.h>
 
 #include <json.h>
 
 #include "xplclient.h"
+#include "xplclient-private.h"
 
 struct sbs_ctx {
 	char *serial;
 	struct sockaddr *addr;
 	socklen_t *addrlen;
+	enum xplclient_sbs_mode mode;
 	int found;
+	/* identities of the matching devices seen so far */
+	char **seen;
 };
 
-/* trim away whitespace a leading zeros */
-static char *trim_serial(char *str)
+/* a device may respond more than once (e.g. via several interfaces), so it is identified
+ * by its MAC address, or by its address if it does not tell about it */
+static char *sbs_identity(const struct sockaddr *address, struct json_object *deviceinfo)
 {
-	char *p = str;
-	int l = strlen(p);
+	char host[INET_ADDRSTRLEN];
+	struct json_object *mac = NULL;
 
-	while (isspace(p[l - 1]))
-		p[--l] = 0;
+#if JSON_C_MINOR_VERSION > 10
+	json_object_object_get_ex(deviceinfo, "mac_address", &mac);
+#else
+	mac = json_object_object_get(deviceinfo, "mac_address");
+#endif
 
-	while (*p && (isspace(*p) || *p == '0'))
-		++p, --l;
+	if (mac)
+		return strdup(json_object_get_string(mac));
 
-	memmove(str, p, l + 1);
-	return str;
+	if (!inet_ntop(AF_INET, &((const struct sockaddr_in *)address)->sin_addr, host, sizeof(host)))
+		return NULL;
+
+	return strdup(host);
+}
+
+/* remember the device, returns 1 if it is a new one, zero if it was seen before, -1 on error */
+static int sbs_seen(struct sbs_ctx *sbs_ctx, const struct sockaddr *address, struct json_object *deviceinfo)
+{
+	char *id, **seen;
+	int i;
+
+	id = sbs_identity(address, deviceinfo);
+	if (!id)
+		return -1;
+
+	for (i = 0; i < sbs_ctx->found; i++) {
+		if (strcasecmp(sbs_ctx->seen[i], id) == 0) {
+			free(id);
+			return 0;
+		}
+	}
+
+	seen = realloc(sbs_ctx->seen, (sbs_ctx->found + 1) * sizeof(*seen));
+	if (!seen) {
+		free(id);
+		return -1;
+	}
+
+	seen[sbs_ctx->found] = id;
+	sbs_ctx->seen = seen;
+	return 1;
 }
 
 static int sbs_cb(void *ctx, const struct sockaddr *address, socklen_t addrlen, struct json_object *deviceinfo)
@@ -44,6 +83,10 @@ static int sbs_cb(void *ctx, const struct sockaddr *address, socklen_t addrlen,
 	struct sbs_ctx *sbs_ctx = (struct sbs_ctx *)ctx;
 	struct json_object *serial = NULL;
 
+	/* only IPv4 addresses fit into the caller's buffer of this legacy interface */
+	if (address->sa_family != AF_INET)
+		goto free_out;
+
 #if JSON_C_MINOR_VERSION > 10
 	json_object_object_get_ex(deviceinfo, "serial", &serial);
 #else
@@ -56,10 +99,10 @@ static int sbs_cb(void *ctx, const struct sockaddr *address, socklen_t addrlen,
 		if (!json_serial)
 			goto free_out;
 
-		trim_serial(json_serial);
+		xpl_trim_serial(json_serial);
 
-		if (strcasecmp(sbs_ctx->serial, json_serial) == 0) {
-			/* count every matching device */
+		/* count every matching device, but only once */
+		if (strcasecmp(sbs_ctx->serial, json_serial) == 0 && sbs_seen(sbs_ctx, address, deviceinfo) == 1) {
 			sbs_ctx->found++;
 
 			/* but only the first found wins - at least for this convinience helper */
@@ -77,26 +120,35 @@ static int sbs_cb(void *ctx, const struct sockaddr *address, socklen_t addrlen,
 free_out:
 	json_object_put(deviceinfo);
 
-	return 0;
+	if (sbs_ctx->mode == XPLCLIENT_SBS_FIRST_MATCH && sbs_ctx->found)
+		return XPLCLIENT_SEARCH_STOP;
+
+	return XPLCLIENT_SEARCH_CONTINUE;
 }
 
-int xplclient_search_by_serial(const char *serial, struct sockaddr *addr, socklen_t *addrlen)
+int xplclient_search_by_serial_ex(const char *serial, struct sockaddr *addr, socklen_t *addrlen,
+                                  enum xplclient_sbs_mode mode)
 {
 	struct sbs_ctx ctx;
-	int rv;
+	int rv, i;
 
 	ctx.serial = strdup(serial);
 	if (!ctx.serial)
 		return -1;
 
-	trim_serial(ctx.serial);
+	xpl_trim_serial(ctx.serial);
 
 	ctx.addr = addr;
 	ctx.addrlen = addrlen;
+	ctx.mode = mode;
 	ctx.found = 0;
+	ctx.seen = NULL;
 
 	rv = xplclient_search_devices(sbs_cb, (void *)&ctx, NULL, NULL, 0, 0);
 
+	for (i = 0; i < ctx.found; i++)
+		free(ctx.seen[i]);
+	free(ctx.seen);
 	free(ctx.serial);
 
 	if (rv)
@@ -104,3 +156,8 @@ int xplclient_search_by_serial(const char *serial, struct sockaddr *addr, sockle
 
 	return ctx.found;
 }
+
+int xplclient_search_by_serial(const char *serial, struct sockaddr *addr, socklen_t *addrlen)
+{
+	return xplclient_search_by_serial_ex(serial, addr, addrlen, XPLCLIENT_SBS_COLLECT_ALL);
+}
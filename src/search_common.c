@@ -0,0 +1,643 @@
+/*
+ * Copyright © 2016-2017 Michael Heimpold <mhei@heimpold.de>
+ *
+ * SPDX-License-Identifier: LGPL-2.1
+ */
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <json.h>
+
+#include "xplclient.h"
+#include "xplclient-private.h"
+
+int xpl_socket_setup_rx(int s)
+{
+	int size = XPL_SEARCH_RCVBUF, one = 1;
+
+	/* a burst of responses must fit into the socket buffer: try to exceed rmem_max
+	 * if we are privileged, otherwise take what the system allows */
+	if (setsockopt(s, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) == -1 &&
+	    setsockopt(s, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) == -1)
+		return -1;
+
+	/* let the kernel report the count of datagrams dropped due to a full buffer */
+	if (setsockopt(s, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one)) == -1)
+		return -1;
+
+	return 0;
+}
+
+static int open_search_socket(const struct xpl_iface *iface)
+{
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	int s, one = 1, zero = 0;
+
+	s = socket(iface->addr.ss_family, SOCK_DGRAM, 0);
+	if (s == -1)
+		return -1;
+
+	if (iface->addr.ss_family == AF_INET6) {
+		/* IPv4 is served by sockets of its own */
+		if (setsockopt(s, IPPROTO_IPV6, IPV6_V6ONLY, &one, sizeof(one)) == -1)
+			goto err_out;
+
+		if (setsockopt(s, IPPROTO_IPV6, IPV6_MULTICAST_IF, &iface->index, sizeof(iface->index)) == -1)
+			goto err_out;
+
+		if (setsockopt(s, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, &zero, sizeof(zero)) == -1)
+			goto err_out;
+	} else {
+		if (setsockopt(s, SOL_SOCKET, SO_BROADCAST, &one, sizeof(one)) == -1)
+			goto err_out;
+
+		if (iface->flags & IFF_MULTICAST) {
+			if (setsockopt(s, IPPROTO_IP, IP_MULTICAST_LOOP, &zero, sizeof(zero)) == -1)
+				goto err_out;
+		}
+	}
+
+	if (xpl_socket_setup_rx(s) == -1)
+		goto err_out;
+
+	/* bind to the interface address (port zero), so that responses arrive on this socket */
+	memcpy(&addr, &iface->addr, sizeof(addr));
+	if (addr.ss_family == AF_INET6) {
+		((struct sockaddr_in6 *)&addr)->sin6_scope_id = iface->index;
+		addrlen = sizeof(struct sockaddr_in6);
+	} else {
+		addrlen = sizeof(struct sockaddr_in);
+	}
+
+	if (bind(s, (const struct sockaddr *)&addr, addrlen) == -1)
+		goto err_out;
+
+	return s;
+
+err_out:
+	close(s);
+	return -1;
+}
+
+int xpl_send_query(int s, const struct sockaddr *dst, socklen_t dstlen)
+{
+	const struct sockaddr_in6 *dst6 = (const struct sockaddr_in6 *)dst;
+	const struct sockaddr_in *dst4 = (const struct sockaddr_in *)dst;
+	char host[INET6_ADDRSTRLEN + 2]; /* + brackets */
+	char httpmu_req[256];
+	unsigned int port;
+	int httpmu_len;
+
+	switch (dst->sa_family) {
+	case AF_INET:
+		if (!inet_ntop(AF_INET, &dst4->sin_addr, host, sizeof(host)))
+			return -1;
+		port = ntohs(dst4->sin_port);
+		break;
+	case AF_INET6:
+		/* literal IPv6 addresses must be enclosed in brackets */
+		host[0] = '[';
+		if (!inet_ntop(AF_INET6, &dst6->sin6_addr, host + 1, sizeof(host) - 2))
+			return -1;
+		strcat(host, "]");
+		port = ntohs(dst6->sin6_port);
+		break;
+	default:
+		errno = EAFNOSUPPORT;
+		return -1;
+	}
+
+	httpmu_len = snprintf(httpmu_req, sizeof(httpmu_req),
+				"GET /api/device HTTP/1.0\r\n"
+				"Host: %s:%u\r\n"
+				"NT: i2se:iodevice\r\n"
+				"Content-Type: application/json\r\n"
+				"Content-Length: 2\r\n"
+				"\r\n"
+				"{}",
+				host, port);
+
+	if (httpmu_len < 0 || httpmu_len >= sizeof(httpmu_req))
+		return -1;
+
+	if (sendto(s, httpmu_req, httpmu_len, 0, dst, dstlen) == -1)
+		return -1;
+
+	return 0;
+}
+
+/* compare a header field name (not NUL terminated) case-insensitively */
+static int http_header_is(const char *name, size_t len, const char *key)
+{
+	return len == strlen(key) && strncasecmp(name, key, len) == 0;
+}
+
+/* parse a decimal header value (not NUL terminated), surrounding whitespace is allowed */
+static long http_parse_len(const char *p, const char *end)
+{
+	long v = 0;
+	int digits = 0;
+
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+
+	while (p < end && *p >= '0' && *p <= '9') {
+		v = v * 10 + (*p++ - '0');
+		/* more than any datagram can carry */
+		if (++digits > 6)
+			return -1;
+	}
+
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+
+	/* line must contain single numeric value, anything else is garbage */
+	return (digits && p == end) ? v : -1;
+}
+
+/*
+ * Single pass over the HTTPMU headers of a datagram (which is not NUL terminated): locate the
+ * start of the body and the value of the Content-Length header. Nothing is copied or allocated.
+ * Returns the body offset, or -1 if the datagram is malformed.
+ */
+static long http_parse_notify(const char *buffer, size_t len, long *ct_len)
+{
+	const char *p = buffer, *end = buffer + len;
+	const char *eol, *colon;
+
+	*ct_len = -1;
+
+	/* skip the start line */
+	eol = memchr(p, '\r', end - p);
+	if (!eol || eol + 1 >= end || eol[1] != '\n')
+		return -1;
+	p = eol + 2;
+
+	while (p < end) {
+		eol = memchr(p, '\r', end - p);
+		if (!eol || eol + 1 >= end || eol[1] != '\n')
+			return -1;
+
+		/* empty line terminates the header */
+		if (eol == p)
+			return eol + 2 - buffer;
+
+		colon = memchr(p, ':', eol - p);
+		if (!colon)
+			return -1;
+
+		if (http_header_is(p, colon - p, "Content-Length")) {
+			long v = http_parse_len(colon + 1, eol);
+
+			/* conflicting duplicates are garbage */
+			if (v < 0 || (*ct_len != -1 && *ct_len != v))
+				return -1;
+			*ct_len = v;
+		}
+
+		p = eol + 2;
+	}
+
+	/* header is not terminated */
+	return -1;
+}
+
+int xpl_recv_ctx_init(struct xpl_recv_ctx *rx)
+{
+	int i;
+
+	memset(rx, 0, sizeof(*rx));
+
+	/* this is large, but only pages which actually received data get backed by memory;
+	 * pooled, so that repeated searches do not map and fault in the ring each time */
+	rx->buf = xpl_pool_get_rx_buf();
+	if (!rx->buf)
+		return -1;
+
+	rx->tok = xpl_pool_get_parser();
+	if (!rx->tok) {
+		xpl_pool_put_rx_buf(rx->buf);
+		return -1;
+	}
+
+	/* static part of the ring, the lengths are reset before each receive */
+	for (i = 0; i < XPL_RECV_BATCH; i++) {
+		rx->iovs[i].iov_base = rx->buf + i * XPL_MAX_DATAGRAM;
+		rx->iovs[i].iov_len = XPL_MAX_DATAGRAM;
+		rx->msgs[i].msg_hdr.msg_iov = &rx->iovs[i];
+		rx->msgs[i].msg_hdr.msg_iovlen = 1;
+		rx->msgs[i].msg_hdr.msg_name = &rx->addrs[i];
+		rx->msgs[i].msg_hdr.msg_control = rx->ctrl[i];
+	}
+
+	return 0;
+}
+
+void xpl_recv_ctx_cleanup(struct xpl_recv_ctx *rx)
+{
+	xpl_pool_put_parser(rx->tok);
+	xpl_pool_put_rx_buf(rx->buf);
+}
+
+int xpl_process_packet(struct xpl_recv_ctx *rx, const char *buffer, size_t len,
+                       const struct sockaddr *addr, socklen_t addrlen,
+                       xplclient_search_devices_cb cb, void *cb_ctx)
+{
+	struct json_object *root;
+	long body, ct_len;
+
+	body = http_parse_notify(buffer, len, &ct_len);
+
+	/* Safety checks:
+	 * - Content-Length header must be present
+	 * - len cannot be less or equal zero for valid JSON
+	 * - client supplied content-length must match packet length
+	 */
+	if (body < 0 || ct_len <= 0 || (long)len - body != ct_len) {
+		rx->stats.garbled++;
+		return -1;
+	}
+
+	/* the tokener is re-used for all packets of a session */
+	json_tokener_reset(rx->tok);
+
+	root = json_tokener_parse_ex(rx->tok, buffer + body, ct_len);
+#if JSON_C_MINOR_VERSION > 10
+	if (json_tokener_get_error(rx->tok) != json_tokener_success) {
+		json_object_put(root);
+#else
+	if (!root) {
+#endif
+		rx->stats.garbled++;
+		return -1;
+	}
+
+	rx->stats.processed++;
+
+	if (cb) {
+		if (cb(cb_ctx, addr, addrlen, root) == XPLCLIENT_SEARCH_STOP)
+			return XPL_RECV_STOP;
+	} else {
+		json_object_put(root);
+	}
+
+	return 0;
+}
+
+/* evaluate the drop counter reported by SO_RXQ_OVFL */
+static void recv_update_drops(struct xpl_recv_ctx *rx, struct msghdr *hdr, uint32_t *drops)
+{
+	struct cmsghdr *cmsg;
+	uint32_t v;
+
+	for (cmsg = CMSG_FIRSTHDR(hdr); cmsg; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SO_RXQ_OVFL)
+			continue;
+
+		memcpy(&v, CMSG_DATA(cmsg), sizeof(v));
+
+		/* counter is cumulative over the socket's lifetime */
+		if (v > *drops) {
+			rx->stats.dropped += v - *drops;
+			*drops = v;
+		}
+	}
+}
+
+int xpl_recv_packets(struct xpl_recv_ctx *rx, int s, uint32_t *drops, xplclient_search_devices_cb cb, void *cb_ctx)
+{
+	struct msghdr *hdr;
+	int i, n, rv;
+
+	while (1) {
+		for (i = 0; i < XPL_RECV_BATCH; i++) {
+			hdr = &rx->msgs[i].msg_hdr;
+			hdr->msg_namelen = sizeof(rx->addrs[i]);
+			hdr->msg_controllen = sizeof(rx->ctrl[i]);
+			hdr->msg_flags = 0;
+		}
+
+		/* MSG_TRUNC reports the real length, so that oversized datagrams are never parsed partially */
+		n = recvmmsg(s, rx->msgs, XPL_RECV_BATCH, MSG_DONTWAIT | MSG_TRUNC, NULL);
+		if (n == -1) {
+			/* socket is drained */
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+
+			/* real error */
+			return -1;
+		}
+
+		for (i = 0; i < n; i++) {
+			hdr = &rx->msgs[i].msg_hdr;
+			rx->stats.received++;
+
+			if (drops)
+				recv_update_drops(rx, hdr, drops);
+
+			if ((hdr->msg_flags & MSG_TRUNC) || rx->msgs[i].msg_len > XPL_MAX_DATAGRAM) {
+				rx->stats.truncated++;
+				continue;
+			}
+
+			rv = xpl_process_packet(rx, rx->iovs[i].iov_base, rx->msgs[i].msg_len,
+			                        (struct sockaddr *)&rx->addrs[i], hdr->msg_namelen, cb, cb_ctx);
+
+			/* the remaining packets of this batch are discarded */
+			if (rv == XPL_RECV_STOP)
+				return rv;
+		}
+
+		/* a partial batch means there is nothing more right now */
+		if (n < XPL_RECV_BATCH)
+			return 0;
+	}
+}
+
+/* trim away whitespace a leading zeros */
+char *xpl_trim_serial(char *str)
+{
+	char *p = str;
+	int l = strlen(p);
+
+	while (l > 0 && isspace(p[l - 1]))
+		p[--l] = 0;
+
+	while (*p && (isspace(*p) || *p == '0'))
+		++p, --l;
+
+	memmove(str, p, l + 1);
+	return str;
+}
+
+/* check whether the given interface address should be used for searching */
+static int search_if_usable(const struct xpl_iface *iface, const struct xplclient_search_opts *opts)
+{
+	const struct sockaddr_in6 *addr6 = (const struct sockaddr_in6 *)&iface->addr;
+
+	/* if restricted to a given interfaces skip over if not matching */
+	if (opts->interface && strcmp(opts->interface, iface->name) != 0)
+		return 0;
+
+	/* skip interfaces which unlikely connect to an XPL */
+	if (iface->flags & (IFF_LOOPBACK | IFF_POINTOPOINT))
+		return 0;
+
+	/* restricted to one address family? */
+	if (opts->family != AF_UNSPEC && opts->family != iface->addr.ss_family)
+		return 0;
+
+	switch (iface->addr.ss_family) {
+	case AF_INET:
+		return 1;
+	case AF_INET6:
+		/* there is no broadcast in IPv6, and the link-local address is the one
+		 * every IPv6 capable interface has exactly once */
+		return (iface->flags & IFF_MULTICAST) && IN6_IS_ADDR_LINKLOCAL(&addr6->sin6_addr);
+	default:
+		return 0;
+	}
+}
+
+/* check whether an IPv6 socket was already opened for the given interface */
+static int search_set_has_if6(const struct xpl_search_set *set, unsigned int ifindex)
+{
+	int i;
+
+	for (i = 0; i < set->count; i++)
+		if (set->socks[i].dst.ss_family == AF_INET6 && set->socks[i].ifindex == ifindex)
+			return 1;
+
+	return 0;
+}
+
+int xpl_search_set_open(struct xpl_search_set *set, const struct xplclient_search_opts *opts)
+{
+	struct xpl_iface *ifaces;
+	struct epoll_event ev;
+	struct sockaddr_in mc_addr;
+	struct sockaddr_in6 mc_addr6;
+	int i, c = 0;
+
+	memset(set, 0, sizeof(*set));
+
+	/* prepare destination addresses */
+	memset(&mc_addr, 0, sizeof(mc_addr));
+	mc_addr.sin_family = AF_INET;
+	mc_addr.sin_addr.s_addr = inet_addr(opts->mc_address ? : XPLCLIENT_DEFAULT_MC_GROUP);
+	mc_addr.sin_port = htons(opts->port ? : XPLCLIENT_DEFAULT_MC_PORT);
+
+	memset(&mc_addr6, 0, sizeof(mc_addr6));
+	mc_addr6.sin6_family = AF_INET6;
+	mc_addr6.sin6_port = mc_addr.sin_port;
+	if (inet_pton(AF_INET6, opts->mc_address6 ? : XPLCLIENT_DEFAULT_MC_GROUP6, &mc_addr6.sin6_addr) != 1) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* get (cached) network interface list */
+	if (xpl_iface_list(&ifaces, &c, &set->ifgen) == -1)
+		return -1;
+
+	set->socks = calloc(c ? : 1, sizeof(struct xpl_search_socket));
+	if (!set->socks)
+		goto err_out;
+
+	set->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (set->epfd == -1)
+		goto free_out;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+
+	for (i = 0; i < c; i++) {
+		struct xpl_search_socket *sock = &set->socks[set->count];
+
+		if (!search_if_usable(&ifaces[i], opts))
+			continue;
+
+		if (ifaces[i].addr.ss_family == AF_INET6 && search_set_has_if6(set, ifaces[i].index))
+			continue;
+
+		sock->fd = open_search_socket(&ifaces[i]);
+		if (sock->fd == -1)
+			continue;
+
+		sock->ifindex = ifaces[i].index;
+
+		if (ifaces[i].addr.ss_family == AF_INET6) {
+			/* link-local groups are only unique together with the interface */
+			mc_addr6.sin6_scope_id = ifaces[i].index;
+			memcpy(&sock->dst, &mc_addr6, sizeof(mc_addr6));
+			sock->dstlen = sizeof(mc_addr6);
+		} else {
+			/* query via multicast if possible, fall back to broadcast */
+			memcpy(&sock->dst, &mc_addr, sizeof(mc_addr));
+			sock->dstlen = sizeof(mc_addr);
+			if (!(ifaces[i].flags & IFF_MULTICAST))
+				((struct sockaddr_in *)&sock->dst)->sin_addr = ((struct sockaddr_in *)&ifaces[i].broadaddr)->sin_addr;
+		}
+
+		/* epoll hands us the socket directly, so no scanning is needed on wakeup */
+		ev.data.ptr = sock;
+		if (epoll_ctl(set->epfd, EPOLL_CTL_ADD, sock->fd, &ev) == -1) {
+			close(sock->fd);
+			continue;
+		}
+
+		set->count++;
+	}
+
+	/* no socket could be opened at all or no usable interface found */
+	if (set->count == 0) {
+		errno = ENODEV;
+		goto close_out;
+	}
+
+	free(ifaces);
+	return 0;
+
+close_out:
+	close(set->epfd);
+free_out:
+	free(set->socks);
+	set->socks = NULL;
+err_out:
+	free(ifaces);
+	return -1;
+}
+
+int xpl_search_set_query(struct xpl_search_set *set)
+{
+	unsigned int sent[2] = { 0, 0 }; /* per family: IPv4, IPv6 */
+	int i, err = 0;
+
+	for (i = 0; i < set->count; i++) {
+		/* e.g. ff02::c on a link without an IPv6 route, the other queries still count */
+		if (xpl_send_query(set->socks[i].fd, (struct sockaddr *)&set->socks[i].dst, set->socks[i].dstlen)) {
+			err = errno;
+			continue;
+		}
+
+		sent[set->socks[i].dst.ss_family == AF_INET6]++;
+		xpl_stats_iface(set->socks[i].ifindex, 1, 0);
+	}
+
+	if (set->count && !sent[0] && !sent[1]) {
+		errno = err;
+		return -1;
+	}
+
+	return 0;
+}
+
+int xpl_search_set_dispatch(struct xpl_search_set *set, struct xpl_recv_ctx *rx,
+                            xplclient_search_devices_cb cb, void *cb_ctx)
+{
+	struct epoll_event evs[XPL_RECV_BATCH];
+	struct xpl_search_socket *sock;
+	unsigned long processed;
+	int i, n, rv;
+
+	n = epoll_wait(set->epfd, evs, XPL_RECV_BATCH, 0);
+	if (n == -1)
+		return (errno == EINTR) ? 0 : -1;
+
+	/* only the sockets which are actually ready */
+	for (i = 0; i < n; i++) {
+		sock = evs[i].data.ptr;
+		processed = rx->stats.processed;
+
+		rv = xpl_recv_packets(rx, sock->fd, &sock->drops, cb, cb_ctx);
+
+		xpl_stats_iface(sock->ifindex, 0, rx->stats.processed - processed);
+
+		if (rv == XPL_RECV_STOP)
+			return XPL_RECV_STOP;
+	}
+
+	return 0;
+}
+
+int xpl_search_set_changed(struct xpl_search_set *set)
+{
+	return xpl_iface_generation() != set->ifgen;
+}
+
+void xpl_search_set_close(struct xpl_search_set *set)
+{
+	int i;
+
+	if (!set->socks)
+		return;
+
+	for (i = 0; i < set->count; i++)
+		close(set->socks[i].fd);
+
+	close(set->epfd);
+	free(set->socks);
+	set->socks = NULL;
+	set->count = 0;
+}
+
+int xpl_search_arm_timeout(int timerfd, const struct xplclient_search_opts *opts)
+{
+	struct itimerspec its;
+	unsigned int ms;
+
+	ms = opts->timeout_ms ? : ((opts->timeout > 0) ? opts->timeout : 3) * 1000;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = ms / 1000;
+	its.it_value.tv_nsec = (ms % 1000) * 1000000;
+
+	return timerfd_settime(timerfd, 0, &its, NULL);
+}
+
+void xpl_search_end_init(struct xpl_search_end *e, const struct xplclient_search_opts *opts)
+{
+	memset(e, 0, sizeof(*e));
+	e->quiet_ns = (uint64_t)opts->quiet_ms * 1000000;
+	e->expected = opts->expected;
+}
+
+int xpl_search_end_update(struct xpl_search_end *e, const struct xpl_recv_ctx *rx)
+{
+	if (rx->stats.processed == e->processed)
+		return 0;
+
+	e->processed = rx->stats.processed;
+	e->last_reply = xpl_monotonic_ns();
+
+	return e->expected && e->processed >= e->expected;
+}
+
+int xpl_search_end_poll_timeout(const struct xpl_search_end *e)
+{
+	uint64_t now, end;
+
+	if (!e->quiet_ns || !e->last_reply)
+		return -1;
+
+	now = xpl_monotonic_ns();
+	end = e->last_reply + e->quiet_ns;
+	if (now >= end)
+		return 0;
+
+	/* rounded up, so that we do not wake up too early and spin */
+	return (end - now + 999999) / 1000000;
+}
@@ -0,0 +1,450 @@
+/*
+ * Copyright © 2017 Michael Heimpold <mhei@heimpold.de>
+ *
+ * SPDX-License-Identifier: LGPL-2.1
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+
+#include <json.h>
+#include <curl/curl.h>
+
+#include "xplclient.h"
+#include "xplclient-private.h"
+
+/* the last response of a path */
+struct shadow_entry {
+	struct shadow_entry *next;
+
+	char *path;
+	struct json_object *root;
+
+	/* validators sent by the device, NULL if none */
+	char *etag;
+	char *last_modified;
+
+	/* hash and length of the body, compared for devices without validators */
+	uint64_t hash;
+	size_t len;
+
+	/* when the response was received or confirmed last */
+	uint64_t fetched;
+};
+
+struct xplclient_shadow {
+	pthread_mutex_t lock;
+
+	enum xplclient_shadow_mode mode;
+	uint64_t ttl_ns;
+
+	struct shadow_entry *entries;
+
+	struct xplclient_shadow_stats stats;
+};
+
+/* FNV-1a, 64 bit */
+#define SHADOW_HASH_INIT  0xcbf29ce484222325ULL
+#define SHADOW_HASH_PRIME 0x100000001b3ULL
+
+static void shadow_entry_free(struct shadow_entry *e)
+{
+	json_object_put(e->root);
+	free(e->last_modified);
+	free(e->etag);
+	free(e->path);
+	free(e);
+}
+
+int xplclient_set_shadow(xplclient_t ctx, enum xplclient_shadow_mode mode, unsigned int ttl_ms)
+{
+	struct xplclient_shadow *sh = ctx->shadow;
+
+	if (mode == XPLCLIENT_SHADOW_OFF) {
+		xpl_shadow_free(sh);
+		ctx->shadow = NULL;
+		return 0;
+	}
+
+	if (!sh) {
+		sh = calloc(1, sizeof(struct xplclient_shadow));
+		if (!sh)
+			return -1;
+
+		if (pthread_mutex_init(&sh->lock, NULL)) {
+			free(sh);
+			return -1;
+		}
+
+		ctx->shadow = sh;
+	}
+
+	pthread_mutex_lock(&sh->lock);
+	sh->mode = mode;
+	sh->ttl_ns = (uint64_t)ttl_ms * 1000000;
+	pthread_mutex_unlock(&sh->lock);
+
+	return 0;
+}
+
+void xpl_shadow_free(struct xplclient_shadow *sh)
+{
+	struct shadow_entry *e;
+
+	if (!sh)
+		return;
+
+	while ((e = sh->entries)) {
+		sh->entries = e->next;
+		shadow_entry_free(e);
+	}
+
+	pthread_mutex_destroy(&sh->lock);
+	free(sh);
+}
+
+/* must be called with the lock held */
+static struct shadow_entry *shadow_find(struct xplclient_shadow *sh, const char *path)
+{
+	struct shadow_entry *e;
+
+	for (e = sh->entries; e; e = e->next)
+		if (strcmp(e->path, path) == 0)
+			return e;
+
+	return NULL;
+}
+
+/* whether a write to path may change the response of entry path p: one is a prefix of the other */
+static int shadow_related(const char *p, const char *path)
+{
+	size_t lp = strlen(p), lpath = strlen(path);
+	size_t l = (lp < lpath) ? lp : lpath;
+
+	return strncmp(p, path, l) == 0 &&
+	       (lp == lpath || (lp > lpath ? p[l] : path[l]) == '/' || (l && p[l - 1] == '/'));
+}
+
+void xplclient_shadow_invalidate(xplclient_t ctx, const char *path)
+{
+	struct xplclient_shadow *sh = ctx->shadow;
+	struct shadow_entry **pe, *e;
+
+	if (!sh)
+		return;
+
+	pthread_mutex_lock(&sh->lock);
+
+	pe = &sh->entries;
+	while ((e = *pe)) {
+		if (!path || shadow_related(e->path, path)) {
+			*pe = e->next;
+			shadow_entry_free(e);
+		} else {
+			pe = &e->next;
+		}
+	}
+
+	pthread_mutex_unlock(&sh->lock);
+}
+
+void xplclient_shadow_get_stats(xplclient_t ctx, struct xplclient_shadow_stats *stats)
+{
+	struct xplclient_shadow *sh = ctx->shadow;
+	struct shadow_entry *e;
+
+	memset(stats, 0, sizeof(*stats));
+
+	if (!sh)
+		return;
+
+	pthread_mutex_lock(&sh->lock);
+
+	*stats = sh->stats;
+	for (e = sh->entries; e; e = e->next)
+		stats->entries++;
+
+	pthread_mutex_unlock(&sh->lock);
+}
+
+/* Hand out a cached tree which was referenced with the lock held. json-c's reference counting
+ * is not atomic (unless it was built with threading support), so in thread-safe mode the cached
+ * trees are only referenced with the lock held, and each caller gets a copy of its own. */
+static struct json_object *shadow_hand_out(xplclient_t ctx, struct json_object *root)
+{
+	struct json_object *copy;
+
+	if (!ctx->mt)
+		return root;
+
+	/* the reference keeps the tree alive while it is copied without the lock */
+	copy = xpl_json_copy(root);
+
+	pthread_mutex_lock(&ctx->shadow->lock);
+	json_object_put(root);
+	pthread_mutex_unlock(&ctx->shadow->lock);
+
+	return copy;
+}
+
+struct json_object *xpl_shadow_begin(xplclient_t ctx, const char *path, struct xpl_shadow_req *sr)
+{
+	struct xplclient_shadow *sh = ctx->shadow;
+	struct json_object *root = NULL;
+	struct curl_slist *l, *n;
+	struct shadow_entry *e;
+	char *hdr;
+
+	memset(sr, 0, sizeof(*sr));
+	sr->hash = SHADOW_HASH_INIT;
+
+	pthread_mutex_lock(&sh->lock);
+
+	e = shadow_find(sh, path);
+
+	/* hot path: no need to ask the device at all */
+	if (e && sh->mode == XPLCLIENT_SHADOW_TTL && xpl_monotonic_ns() - e->fetched < sh->ttl_ns) {
+		root = json_object_get(e->root);
+		sh->stats.fresh++;
+		goto unlock_out;
+	}
+
+	/* the default headers of the context, plus the conditional ones */
+	for (l = ctx->headers; l; l = l->next) {
+		n = curl_slist_append(sr->headers, l->data);
+		if (!n)
+			goto fail_out;
+		sr->headers = n;
+	}
+
+	if (e && e->etag) {
+		if (asprintf(&hdr, "If-None-Match: %s", e->etag) == -1)
+			goto fail_out;
+		n = curl_slist_append(sr->headers, hdr);
+		free(hdr);
+		if (!n)
+			goto fail_out;
+		sr->headers = n;
+	}
+
+	if (e && e->last_modified) {
+		if (asprintf(&hdr, "If-Modified-Since: %s", e->last_modified) == -1)
+			goto fail_out;
+		n = curl_slist_append(sr->headers, hdr);
+		free(hdr);
+		if (!n)
+			goto fail_out;
+		sr->headers = n;
+	}
+
+	/* without validators, the body is only parsed if it differs from the known one */
+	sr->buffer = e && !e->etag && !e->last_modified;
+
+	goto unlock_out;
+
+fail_out:
+	/* not fatal, the request is just done unconditionally */
+	curl_slist_free_all(sr->headers);
+	sr->headers = NULL;
+	sr->buffer = 0;
+
+unlock_out:
+	pthread_mutex_unlock(&sh->lock);
+
+	/* if a copy fails, the request is just done unconditionally, too */
+	return root ? shadow_hand_out(ctx, root) : NULL;
+}
+
+void xpl_shadow_req_reset(struct xpl_shadow_req *sr)
+{
+	free(sr->etag);
+	free(sr->last_modified);
+	sr->etag = sr->last_modified = NULL;
+
+	sr->len = 0;
+	sr->hash = SHADOW_HASH_INIT;
+}
+
+void xpl_shadow_req_cleanup(struct xpl_shadow_req *sr)
+{
+	xpl_shadow_req_reset(sr);
+	curl_slist_free_all(sr->headers);
+	sr->headers = NULL;
+	free(sr->body);
+	sr->body = NULL;
+	sr->size = 0;
+}
+
+/* store a copy of a header value without the leading whitespace and the trailing line end */
+static char *shadow_header_value(const char *p, size_t len)
+{
+	while (len && (*p == ' ' || *p == '\t')) {
+		p++;
+		len--;
+	}
+
+	while (len && (p[len - 1] == '\r' || p[len - 1] == '\n' || p[len - 1] == ' '))
+		len--;
+
+	return len ? strndup(p, len) : NULL;
+}
+
+size_t xpl_shadow_header_cb(char *buffer, size_t size, size_t nitems, void *userdata)
+{
+	struct xpl_shadow_req *sr = (struct xpl_shadow_req *)userdata;
+	size_t len = size * nitems;
+
+	/* a new response (e.g. after a redirect) starts with its status line */
+	if (len >= 5 && strncmp(buffer, "HTTP/", 5) == 0) {
+		xpl_shadow_req_reset(sr);
+		return len;
+	}
+
+	if (len > 5 && strncasecmp(buffer, "ETag:", 5) == 0) {
+		free(sr->etag);
+		sr->etag = shadow_header_value(buffer + 5, len - 5);
+	} else if (len > 14 && strncasecmp(buffer, "Last-Modified:", 14) == 0) {
+		free(sr->last_modified);
+		sr->last_modified = shadow_header_value(buffer + 14, len - 14);
+	}
+
+	return len;
+}
+
+int xpl_shadow_recv(struct xpl_shadow_req *sr, const char *ptr, size_t len)
+{
+	size_t i, size;
+	char *p;
+
+	for (i = 0; i < len; i++)
+		sr->hash = (sr->hash ^ (unsigned char)ptr[i]) * SHADOW_HASH_PRIME;
+
+	if (!sr->buffer) {
+		sr->len += len;
+		return 0;
+	}
+
+	if (sr->len + len > sr->size) {
+		for (size = sr->size ? sr->size : 4096; size < sr->len + len; size *= 2)
+			;
+
+		p = realloc(sr->body, size);
+		if (!p)
+			return -1;
+
+		sr->body = p;
+		sr->size = size;
+	}
+
+	memcpy(sr->body + sr->len, ptr, len);
+	sr->len += len;
+
+	return 0;
+}
+
+/* parse a buffered body */
+static struct json_object *shadow_parse(struct curl_recv_data *d, struct xpl_shadow_req *sr)
+{
+	struct json_object *root;
+	uint64_t start = xpl_monotonic_ns();
+
+	root = json_tokener_parse_ex(d->tok, sr->body, sr->len);
+
+	/* a top-level number is only terminated by the end of the body */
+	if (!root && json_tokener_get_error(d->tok) == json_tokener_continue)
+		root = json_tokener_parse_ex(d->tok, "", 1);
+
+	d->parse_ns += xpl_monotonic_ns() - start;
+
+	return root;
+}
+
+struct json_object *xpl_shadow_finish(xplclient_t ctx, const char *path, CURL *curl, struct curl_recv_data *d)
+{
+	struct xplclient_shadow *sh = ctx->shadow;
+	struct xpl_shadow_req *sr = d->shadow;
+	struct json_object *root = NULL, *cached = NULL, *stored = NULL;
+	struct shadow_entry *e;
+	long code = 0;
+
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+
+	pthread_mutex_lock(&sh->lock);
+
+	e = shadow_find(sh, path);
+
+	/* not modified: the cached tree is still valid */
+	if (code == 304 && e) {
+		cached = json_object_get(e->root);
+		e->fetched = xpl_monotonic_ns();
+		sh->stats.not_modified++;
+		goto unlock_out;
+	}
+
+	/* the very same bytes as last time, so the parsing can be skipped */
+	if (sr->buffer && code >= 200 && code < 300 && e && e->len == sr->len && e->hash == sr->hash) {
+		cached = json_object_get(e->root);
+		e->fetched = xpl_monotonic_ns();
+		sh->stats.unchanged++;
+		goto unlock_out;
+	}
+
+	pthread_mutex_unlock(&sh->lock);
+
+	/* parsing is done without holding the lock */
+	root = sr->buffer ? (d->error ? NULL : shadow_parse(d, sr)) : xpl_recv_data_finish(d);
+
+	/* only successful responses are remembered, in thread-safe mode as a copy of its own */
+	if (root && code >= 200 && code < 300)
+		stored = ctx->mt ? xpl_json_copy(root) : json_object_get(root);
+
+	pthread_mutex_lock(&sh->lock);
+
+	sh->stats.fetched++;
+
+	if (!stored)
+		goto unlock_out;
+
+	e = shadow_find(sh, path);
+	if (!e) {
+		e = calloc(1, sizeof(struct shadow_entry));
+		if (!e)
+			goto unlock_out;
+
+		e->path = strdup(path);
+		if (!e->path) {
+			free(e);
+			goto unlock_out;
+		}
+
+		e->next = sh->entries;
+		sh->entries = e;
+	}
+
+	json_object_put(e->root);
+	e->root = stored;
+	stored = NULL;
+
+	free(e->etag);
+	free(e->last_modified);
+	e->etag = sr->etag;
+	e->last_modified = sr->last_modified;
+	sr->etag = sr->last_modified = NULL;
+
+	e->hash = sr->hash;
+	e->len = sr->len;
+
+	e->fetched = xpl_monotonic_ns();
+
+unlock_out:
+	pthread_mutex_unlock(&sh->lock);
+
+	/* not stored for lack of memory, it was never shared */
+	json_object_put(stored);
+
+	return cached ? shadow_hand_out(ctx, cached) : root;
+}
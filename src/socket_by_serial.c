@@ -6,15 +6,65 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <errno.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
 #include <json.h>
 
 #include "xplclient.h"
+#include "xplclient-private.h"
+
+/* return the port for remote access of a JSON COM port object, or -1 with errno set */
+static int serial_port_from_info(struct json_object *root)
+{
+	struct json_object *val;
+	int port, mode;
+
+	/* get currently configured port for remote access */
+	val = xplclient_json_object_get_by_key(root, "port");
+	if (!val)
+		goto inval_out;
+	port = json_object_get_int(val);
+
+	/* simple sanity checks for port */
+	if (port <= 0 || port > 65535)
+		goto inval_out;
+
+	/* check whether remote access is enable at least */
+	val = xplclient_json_object_get_by_key(root, "mode");
+	if (!val)
+		goto inval_out;
+	mode = json_object_get_int(val);
+
+	/* mode has bit flags:
+	 *   0x1 = virtual channel
+	 *   0x2 = raw socket
+	 *   0x4 = telnet
+	 */
+	if (mode <= 1)
+		goto inval_out;
+
+	return port;
+
+inval_out:
+	errno = EINVAL;
+	return -1;
+}
+
+/* whether a connect error means that the device is not reachable at its (cached) address anymore,
+ * in contrast to e.g. a refused connection which proves that the device is still there */
+static int serial_addr_gone(int err)
+{
+	return err == ETIMEDOUT || err == EHOSTUNREACH || err == ENETUNREACH || err == EHOSTDOWN;
+}
 
 int xplclient_socket_by_serial(const char *serial, unsigned int comport)
 {
@@ -24,12 +74,13 @@ int xplclient_socket_by_serial(const char *serial, unsigned int comport)
 	socklen_t addrlen;
 	xplclient_t xpl;
 	char path[64];
-	struct json_object *root, *val;
-	int port, mode;
+	struct json_object *root;
+	int port;
 	int rv, s = -1;
+	uint64_t start;
 
 	/* search for device */
-	rv = xplclient_search_by_serial(serial, (struct sockaddr *)&sa, &addrlen);
+	rv = xplclient_resolve_serial(serial, (struct sockaddr *)&sa, &addrlen, NULL);
 	if (rv < 0)
 		return -1;
 	/* if no device is found with this serial we adjust errno */
@@ -49,35 +100,15 @@ int xplclient_socket_by_serial(const char *serial, unsigned int comport)
 	/* get JSON COM port object */
 	root = xplclient_url_get(xpl, path);
 	if (!root) {
+		/* the cached address might be outdated */
+		xplclient_cache_invalidate(serial);
 		errno = ENXIO;
 		goto free1_out;
 	}
 
-	/* get currently configured port for remote access */
-	val = xplclient_json_object_get_by_key(root, "port");
-	if (!val)
-		goto free2_out;
-	port = json_object_get_int(val);
-
-	/* simple sanity checks for port */
-	if (port <= 0 || port > 65535)
-		goto free2_out;
-
-	/* check whether remote access is enable at least */
-	val = xplclient_json_object_get_by_key(root, "mode");
-	if (!val)
-		goto free2_out;
-	mode = json_object_get_int(val);
-
-	/* mode has bit flags:
-	 *   0x1 = virtual channel
-	 *   0x2 = raw socket
-	 *   0x4 = telnet
-	 */
-	if (mode <= 1) {
-		errno = EINVAL;
+	port = serial_port_from_info(root);
+	if (port == -1)
 		goto free2_out;
-	}
 
 	/* now create a socket... */
 	s = socket(sa.ss_family, SOCK_STREAM, 0);
@@ -96,8 +127,17 @@ int xplclient_socket_by_serial(const char *serial, unsigned int comport)
 	}
 
 	/* ... and finally let's connect to this port */
-	if (connect(s, (struct sockaddr *)&sa, addrlen) == -1)
+	start = xpl_monotonic_ns();
+	rv = connect(s, (struct sockaddr *)&sa, addrlen);
+	xpl_stats_serial_connect(xpl_monotonic_ns() - start);
+
+	if (rv == -1) {
+		rv = errno;
+		if (serial_addr_gone(rv))
+			xplclient_cache_invalidate(serial);
+		errno = rv;
 		goto close_out;
+	}
 
 	/* everything ok, jump over the following close part */
 	goto free2_out;
@@ -113,3 +153,345 @@ free1_out:
 	xplclient_free(xpl);
 	return s;
 }
+
+/* a device of a bulk open, the serial ports of the same device share its context */
+struct bulk_dev {
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	xplclient_t ctx;
+};
+
+/* state of one item of a bulk open */
+struct bulk_port {
+	struct xplclient_socket_item *item;
+	struct bulk_dev *dev;
+
+	/* port for remote access, zero until queried */
+	int port;
+
+	/* start of the connect */
+	uint64_t start;
+};
+
+/* milliseconds until the deadline, rounded up */
+static int bulk_remaining_ms(uint64_t deadline)
+{
+	uint64_t now = xpl_monotonic_ns();
+
+	return (now < deadline) ? (deadline - now + 999999) / 1000000 : 0;
+}
+
+static int serial_socket_setopts(int s, const struct xplclient_socket_opts *opts)
+{
+	int one = 1, v;
+
+	if (opts->nodelay && setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) == -1)
+		return -1;
+
+	if (!opts->keepalive_idle)
+		return 0;
+
+	if (setsockopt(s, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one)) == -1)
+		return -1;
+
+	v = opts->keepalive_idle;
+	if (setsockopt(s, IPPROTO_TCP, TCP_KEEPIDLE, &v, sizeof(v)) == -1 ||
+	    setsockopt(s, IPPROTO_TCP, TCP_KEEPINTVL, &v, sizeof(v)) == -1)
+		return -1;
+
+	v = XPLCLIENT_SOCKET_KEEPALIVE_PROBES;
+	return setsockopt(s, IPPROTO_TCP, TCP_KEEPCNT, &v, sizeof(v));
+}
+
+/* completion callback of the port query of an item */
+static int bulk_port_cb(void *cb_ctx, xplclient_t ctx, const char *path, struct json_object *result)
+{
+	struct bulk_port *bp = (struct bulk_port *)cb_ctx;
+
+	if (!result) {
+		/* the cached address might be outdated */
+		xplclient_cache_invalidate(bp->item->serial);
+		bp->item->err = ENXIO;
+		return 0;
+	}
+
+	bp->port = serial_port_from_info(result);
+	if (bp->port == -1) {
+		bp->port = 0;
+		bp->item->err = errno;
+	}
+
+	json_object_put(result);
+	return 0;
+}
+
+/* start the non-blocking connect of an item, on success its error is EINPROGRESS until finished */
+static void bulk_connect_start(struct bulk_port *bp, const struct xplclient_socket_opts *opts)
+{
+	struct sockaddr_storage sa;
+	int s;
+
+	memcpy(&sa, &bp->dev->addr, bp->dev->addrlen);
+
+	switch (sa.ss_family) {
+	case AF_INET:
+		((struct sockaddr_in *)&sa)->sin_port = htons(bp->port);
+		break;
+	case AF_INET6:
+		((struct sockaddr_in6 *)&sa)->sin6_port = htons(bp->port);
+		break;
+	default:
+		bp->item->err = EAFNOSUPPORT;
+		return;
+	}
+
+	s = socket(sa.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (s == -1) {
+		bp->item->err = errno;
+		return;
+	}
+
+	if (serial_socket_setopts(s, opts) == -1)
+		goto close_out;
+
+	bp->start = xpl_monotonic_ns();
+
+	if (connect(s, (struct sockaddr *)&sa, bp->dev->addrlen) == -1 && errno != EINPROGRESS) {
+		/* save the error first, invalidating the cache entry does file I/O */
+		bp->item->err = errno;
+		if (serial_addr_gone(bp->item->err))
+			xplclient_cache_invalidate(bp->item->serial);
+		goto close_err_out;
+	}
+
+	bp->item->fd = s;
+	bp->item->err = EINPROGRESS;
+	return;
+
+close_out:
+	bp->item->err = errno;
+close_err_out:
+	close(s);
+}
+
+/* check the outcome of a connect which signalled completion */
+static void bulk_connect_finish(struct bulk_port *bp)
+{
+	socklen_t len = sizeof(int);
+	int err, flags;
+
+	if (getsockopt(bp->item->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1)
+		err = errno;
+
+	/* hand out a blocking socket, as xplclient_socket_by_serial does */
+	if (!err) {
+		flags = fcntl(bp->item->fd, F_GETFL);
+		if (flags == -1 || fcntl(bp->item->fd, F_SETFL, flags & ~O_NONBLOCK) == -1)
+			err = errno;
+	}
+
+	xpl_stats_serial_connect(xpl_monotonic_ns() - bp->start);
+
+	if (err) {
+		if (serial_addr_gone(err))
+			xplclient_cache_invalidate(bp->item->serial);
+		close(bp->item->fd);
+		bp->item->fd = -1;
+	}
+
+	bp->item->err = err;
+}
+
+int xplclient_socket_by_serial_bulk(struct xplclient_socket_item *items, unsigned int count,
+                                    const struct xplclient_socket_opts *opts)
+{
+	struct xplclient_socket_opts defaults;
+	const char **serials = NULL;
+	struct sockaddr_storage *addrs = NULL;
+	socklen_t *addrlens = NULL;
+	struct bulk_dev *devs = NULL;
+	struct bulk_port *ports = NULL;
+	struct pollfd *pfds = NULL;
+	xplclient_multi_t m = NULL;
+	unsigned int i, j, n, ndevs = 0;
+	uint64_t deadline;
+	char path[64];
+	int running, ms, rv = -1;
+
+	if (!opts) {
+		memset(&defaults, 0, sizeof(defaults));
+		defaults.nodelay = 1;
+		opts = &defaults;
+	}
+
+	deadline = xpl_monotonic_ns() + (uint64_t)(opts->timeout_ms ? : XPLCLIENT_SOCKET_DEFAULT_TIMEOUT) * 1000000;
+
+	/* whatever is not finished at the deadline reports the timeout */
+	for (i = 0; i < count; i++) {
+		items[i].fd = -1;
+		items[i].err = ETIMEDOUT;
+	}
+
+	if (!count)
+		return 0;
+
+	serials = calloc(count, sizeof(char *));
+	addrs = calloc(count, sizeof(struct sockaddr_storage));
+	addrlens = calloc(count, sizeof(socklen_t));
+	devs = calloc(count, sizeof(struct bulk_dev));
+	ports = calloc(count, sizeof(struct bulk_port));
+	pfds = calloc(count, sizeof(struct pollfd));
+	if (!serials || !addrs || !addrlens || !devs || !ports || !pfds)
+		goto free_out;
+
+	for (i = 0; i < count; i++)
+		serials[i] = items[i].serial;
+
+	/* a single search for all devices which are not cached, leaving time for the rest */
+	if (xpl_resolve_serials(serials, count, addrs, addrlens, bulk_remaining_ms(deadline) / 2) == -1)
+		goto free_out;
+
+	/* query the ports of all items, over one connection per device */
+	m = xplclient_multi_new();
+	if (!m)
+		goto free_out;
+
+	if (xpl_multi_set_max_host_connections(m, 1) == -1)
+		goto free_out;
+
+	for (i = 0; i < count; i++) {
+		ports[i].item = &items[i];
+
+		if (!addrlens[i]) {
+			items[i].err = ENODEV;
+			continue;
+		}
+
+		for (j = 0; j < ndevs; j++)
+			if (devs[j].addrlen == addrlens[i] && memcmp(&devs[j].addr, &addrs[i], addrlens[i]) == 0)
+				break;
+
+		if (j == ndevs) {
+			memcpy(&devs[j].addr, &addrs[i], addrlens[i]);
+			devs[j].addrlen = addrlens[i];
+			devs[j].ctx = xplclient_new_by_addr((struct sockaddr *)&addrs[i], addrlens[i]);
+			if (!devs[j].ctx) {
+				items[i].err = ENOMEM;
+				continue;
+			}
+			ndevs++;
+		}
+		ports[i].dev = &devs[j];
+
+		if (snprintf(path, sizeof(path), "/channel/physical/serial/%u", items[i].comport) >= sizeof(path)) {
+			items[i].err = EINVAL;
+			continue;
+		}
+
+		if (xplclient_multi_add_get(m, devs[j].ctx, path, bulk_port_cb, &ports[i]) == -1)
+			items[i].err = ENOMEM;
+	}
+
+	do {
+		if (xplclient_multi_perform(m, &running) == -1)
+			goto free_out;
+
+		if (!running)
+			break;
+
+		ms = bulk_remaining_ms(deadline);
+		if (ms && xplclient_multi_wait(m, ms) == -1)
+			goto free_out;
+	} while (ms);
+
+	/* abort the queries which did not finish in time */
+	xplclient_multi_free(m);
+	m = NULL;
+
+	/* connect all ports concurrently */
+	for (i = 0; i < count; i++)
+		if (ports[i].port)
+			bulk_connect_start(&ports[i], opts);
+
+	while (1) {
+		for (i = 0, n = 0; i < count; i++) {
+			if (items[i].err != EINPROGRESS)
+				continue;
+
+			pfds[n].fd = items[i].fd;
+			pfds[n].events = POLLOUT;
+			pfds[n].revents = 0;
+			n++;
+		}
+
+		ms = bulk_remaining_ms(deadline);
+		if (!n || !ms)
+			break;
+
+		if (poll(pfds, n, ms) == -1) {
+			if (errno == EINTR)
+				continue;
+			goto free_out;
+		}
+
+		/* the descriptors were collected in the order of the items */
+		for (i = 0, n = 0; i < count; i++) {
+			if (items[i].err != EINPROGRESS)
+				continue;
+
+			if (pfds[n++].revents)
+				bulk_connect_finish(&ports[i]);
+		}
+	}
+
+	rv = 0;
+	for (i = 0; i < count; i++) {
+		if (items[i].err == EINPROGRESS) {
+			xplclient_cache_invalidate(items[i].serial);
+			close(items[i].fd);
+			items[i].fd = -1;
+			items[i].err = ETIMEDOUT;
+		}
+
+		if (items[i].fd != -1)
+			rv++;
+	}
+
+free_out:
+	/* the batch failed as a whole, so do not leave any half-opened socket behind */
+	if (rv == -1) {
+		for (i = 0; i < count; i++) {
+			if (items[i].fd != -1)
+				close(items[i].fd);
+			items[i].fd = -1;
+		}
+	}
+
+	xplclient_multi_free(m);
+	for (j = 0; j < ndevs; j++)
+		xplclient_free(devs[j].ctx);
+
+	free(pfds);
+	free(ports);
+	free(devs);
+	free(addrlens);
+	free(addrs);
+	free(serials);
+	return rv;
+}
+
+int xplclient_socket_by_serial_ex(const char *serial, unsigned int comport, const struct xplclient_socket_opts *opts)
+{
+	struct xplclient_socket_item item;
+
+	item.serial = serial;
+	item.comport = comport;
+
+	if (xplclient_socket_by_serial_bulk(&item, 1, opts) == -1)
+		return -1;
+
+	if (item.fd == -1)
+		errno = item.err;
+
+	return item.fd;
+}
@@ -0,0 +1,387 @@
+/*
+ * Copyright © 2017 Michael Heimpold <mhei@heimpold.de>
+ *
+ * SPDX-License-Identifier: LGPL-2.1
+ */
+
+#include <net/if.h>
+
+#include <time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <curl/curl.h>
+
+#include "xplclient.h"
+#include "xplclient-private.h"
+
+/* interfaces tracked by the discovery counters, further ones are not accounted */
+#define STATS_MAX_IFACES 32
+
+/* request counters of a context */
+struct xplclient_ctx_stats {
+	/* only taken by the requests of this context, so that contexts do not contend */
+	pthread_mutex_t lock;
+
+	/* counters returned by xplclient_get_stats */
+	struct xplclient_request_stats stats;
+
+	/* the context's part of the library-wide counters, these are reset independently */
+	struct xplclient_request_stats global;
+
+	/* list of all contexts, to sum up the library-wide counters */
+	struct xplclient_ctx_stats *next;
+	struct xplclient_ctx_stats **pprev;
+};
+
+/* protects the library-wide counters which are not per request */
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct xplclient_global_stats global_stats;
+
+static struct xplclient_iface_stats iface_stats[STATS_MAX_IFACES];
+static unsigned int iface_count;
+
+/* the request counters are summed up when read: the ones of all contexts, plus those of
+ * already freed contexts; the list lock is taken before the lock of a context */
+static pthread_mutex_t ctx_list_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct xplclient_ctx_stats *ctx_list;
+static struct xplclient_request_stats retired_stats;
+
+/* the hook is read for each request, but rarely changed */
+static pthread_rwlock_t hook_lock = PTHREAD_RWLOCK_INITIALIZER;
+static xplclient_stats_cb stats_hook;
+static void *stats_hook_ctx;
+
+uint64_t xpl_monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void hist_add(struct xplclient_histogram *h, uint64_t us)
+{
+	unsigned int i;
+
+	for (i = 0; i < XPLCLIENT_HIST_BUCKETS - 1; i++)
+		if (us < XPLCLIENT_HIST_BUCKET_LIMIT(i))
+			break;
+
+	h->buckets[i]++;
+	h->count++;
+	h->sum_us += us;
+	if (us > h->max_us)
+		h->max_us = us;
+}
+
+static void request_stats_add(struct xplclient_request_stats *s, const struct xplclient_request_sample *sample)
+{
+	s->requests++;
+	if (sample->failed)
+		s->failed++;
+
+	s->bytes_sent += sample->bytes_sent;
+	s->bytes_received += sample->bytes_received;
+
+	hist_add(&s->dns, sample->dns_us);
+	hist_add(&s->connect, sample->connect_us);
+	hist_add(&s->ttfb, sample->ttfb_us);
+	hist_add(&s->total, sample->total_us);
+	hist_add(&s->parse, sample->parse_us);
+}
+
+static void hist_merge(struct xplclient_histogram *h, const struct xplclient_histogram *src)
+{
+	unsigned int i;
+
+	for (i = 0; i < XPLCLIENT_HIST_BUCKETS; i++)
+		h->buckets[i] += src->buckets[i];
+
+	h->count += src->count;
+	h->sum_us += src->sum_us;
+	if (src->max_us > h->max_us)
+		h->max_us = src->max_us;
+}
+
+static void request_stats_merge(struct xplclient_request_stats *s, const struct xplclient_request_stats *src)
+{
+	s->requests += src->requests;
+	s->failed += src->failed;
+
+	s->bytes_sent += src->bytes_sent;
+	s->bytes_received += src->bytes_received;
+
+	hist_merge(&s->dns, &src->dns);
+	hist_merge(&s->connect, &src->connect);
+	hist_merge(&s->ttfb, &src->ttfb);
+	hist_merge(&s->total, &src->total);
+	hist_merge(&s->parse, &src->parse);
+}
+
+int xpl_stats_ctx_new(xplclient_t ctx)
+{
+	struct xplclient_ctx_stats *cs;
+
+	cs = calloc(1, sizeof(struct xplclient_ctx_stats));
+	if (!cs)
+		return -1;
+
+	if (pthread_mutex_init(&cs->lock, NULL)) {
+		free(cs);
+		return -1;
+	}
+
+	pthread_mutex_lock(&ctx_list_lock);
+	cs->next = ctx_list;
+	if (ctx_list)
+		ctx_list->pprev = &cs->next;
+	cs->pprev = &ctx_list;
+	ctx_list = cs;
+	pthread_mutex_unlock(&ctx_list_lock);
+
+	ctx->stats = cs;
+	return 0;
+}
+
+void xpl_stats_ctx_free(xplclient_t ctx)
+{
+	struct xplclient_ctx_stats *cs = ctx->stats;
+
+	if (!cs)
+		return;
+
+	/* the requests of a freed context still count library-wide */
+	pthread_mutex_lock(&ctx_list_lock);
+	request_stats_merge(&retired_stats, &cs->global);
+	*cs->pprev = cs->next;
+	if (cs->next)
+		cs->next->pprev = cs->pprev;
+	pthread_mutex_unlock(&ctx_list_lock);
+
+	pthread_mutex_destroy(&cs->lock);
+	free(cs);
+	ctx->stats = NULL;
+}
+
+/* timing information of the last transfer of a handle in microseconds */
+static uint64_t curl_time_us(CURL *curl, CURLINFO info)
+{
+#if LIBCURL_VERSION_NUM >= 0x073d00
+	curl_off_t t;
+
+	if (curl_easy_getinfo(curl, info, &t) != CURLE_OK || t < 0)
+		return 0;
+
+	return t;
+#else
+	double t;
+
+	if (curl_easy_getinfo(curl, info, &t) != CURLE_OK || t < 0)
+		return 0;
+
+	return t * 1000000;
+#endif
+}
+
+/* body size of the last transfer of a handle */
+static uint64_t curl_size(CURL *curl, CURLINFO info)
+{
+#if LIBCURL_VERSION_NUM >= 0x073700
+	curl_off_t n;
+
+	if (curl_easy_getinfo(curl, info, &n) != CURLE_OK || n < 0)
+		return 0;
+#else
+	double n;
+
+	if (curl_easy_getinfo(curl, info, &n) != CURLE_OK || n < 0)
+		return 0;
+#endif
+
+	return n;
+}
+
+void xpl_stats_request(xplclient_t ctx, CURL *curl, const char *path, const struct curl_recv_data *d, int failed)
+{
+	struct xplclient_request_sample sample;
+	xplclient_stats_cb hook;
+	void *hook_ctx;
+	uint64_t connect;
+	long hdr;
+
+	memset(&sample, 0, sizeof(sample));
+	sample.path = path;
+	sample.failed = failed;
+
+#if LIBCURL_VERSION_NUM >= 0x073d00
+	sample.dns_us = curl_time_us(curl, CURLINFO_NAMELOOKUP_TIME_T);
+	connect = curl_time_us(curl, CURLINFO_CONNECT_TIME_T);
+	sample.ttfb_us = curl_time_us(curl, CURLINFO_STARTTRANSFER_TIME_T);
+	sample.total_us = curl_time_us(curl, CURLINFO_TOTAL_TIME_T);
+#else
+	sample.dns_us = curl_time_us(curl, CURLINFO_NAMELOOKUP_TIME);
+	connect = curl_time_us(curl, CURLINFO_CONNECT_TIME);
+	sample.ttfb_us = curl_time_us(curl, CURLINFO_STARTTRANSFER_TIME);
+	sample.total_us = curl_time_us(curl, CURLINFO_TOTAL_TIME);
+#endif
+
+	/* cURL reports the times since the start of the request, the connect includes the lookup */
+	sample.connect_us = (connect > sample.dns_us) ? connect - sample.dns_us : 0;
+	sample.parse_us = d->parse_ns / 1000;
+
+#if LIBCURL_VERSION_NUM >= 0x073700
+	sample.bytes_sent = curl_size(curl, CURLINFO_SIZE_UPLOAD_T);
+	sample.bytes_received = curl_size(curl, CURLINFO_SIZE_DOWNLOAD_T);
+#else
+	sample.bytes_sent = curl_size(curl, CURLINFO_SIZE_UPLOAD);
+	sample.bytes_received = curl_size(curl, CURLINFO_SIZE_DOWNLOAD);
+#endif
+
+	if (curl_easy_getinfo(curl, CURLINFO_REQUEST_SIZE, &hdr) == CURLE_OK && hdr > 0)
+		sample.bytes_sent += hdr;
+	if (curl_easy_getinfo(curl, CURLINFO_HEADER_SIZE, &hdr) == CURLE_OK && hdr > 0)
+		sample.bytes_received += hdr;
+
+	pthread_mutex_lock(&ctx->stats->lock);
+	request_stats_add(&ctx->stats->stats, &sample);
+	request_stats_add(&ctx->stats->global, &sample);
+	pthread_mutex_unlock(&ctx->stats->lock);
+
+	/* without a hook, no library-wide lock is taken at all */
+	if (!__atomic_load_n(&stats_hook, __ATOMIC_RELAXED))
+		return;
+
+	pthread_rwlock_rdlock(&hook_lock);
+	hook = stats_hook;
+	hook_ctx = stats_hook_ctx;
+	pthread_rwlock_unlock(&hook_lock);
+
+	if (hook)
+		hook(hook_ctx, ctx, &sample);
+}
+
+void xpl_stats_resolve(uint64_t ns)
+{
+	pthread_mutex_lock(&stats_lock);
+	hist_add(&global_stats.resolve, ns / 1000);
+	pthread_mutex_unlock(&stats_lock);
+}
+
+void xpl_stats_serial_connect(uint64_t ns)
+{
+	pthread_mutex_lock(&stats_lock);
+	hist_add(&global_stats.serial_connect, ns / 1000);
+	pthread_mutex_unlock(&stats_lock);
+}
+
+void xpl_stats_iface(unsigned int ifindex, unsigned long queries, unsigned long replies)
+{
+	struct xplclient_iface_stats *s = NULL;
+	unsigned int i;
+
+	pthread_mutex_lock(&stats_lock);
+
+	for (i = 0; i < iface_count; i++) {
+		if (iface_stats[i].ifindex == ifindex) {
+			s = &iface_stats[i];
+			break;
+		}
+	}
+
+	if (!s && iface_count < STATS_MAX_IFACES) {
+		s = &iface_stats[iface_count++];
+		memset(s, 0, sizeof(*s));
+		s->ifindex = ifindex;
+
+		/* the name at the time of the first search, the index stays the same anyway */
+		if (!if_indextoname(ifindex, s->name))
+			s->name[0] = '\0';
+	}
+
+	if (s) {
+		s->queries += queries;
+		s->replies += replies;
+	}
+
+	pthread_mutex_unlock(&stats_lock);
+}
+
+void xplclient_set_stats_hook(xplclient_stats_cb cb, void *cb_ctx)
+{
+	pthread_rwlock_wrlock(&hook_lock);
+	__atomic_store_n(&stats_hook, cb, __ATOMIC_RELAXED);
+	stats_hook_ctx = cb_ctx;
+	pthread_rwlock_unlock(&hook_lock);
+}
+
+void xplclient_get_stats(xplclient_t ctx, struct xplclient_request_stats *stats)
+{
+	pthread_mutex_lock(&ctx->stats->lock);
+	*stats = ctx->stats->stats;
+	pthread_mutex_unlock(&ctx->stats->lock);
+}
+
+void xplclient_reset_stats(xplclient_t ctx)
+{
+	pthread_mutex_lock(&ctx->stats->lock);
+	memset(&ctx->stats->stats, 0, sizeof(ctx->stats->stats));
+	pthread_mutex_unlock(&ctx->stats->lock);
+}
+
+void xplclient_get_global_stats(struct xplclient_global_stats *stats)
+{
+	struct xplclient_ctx_stats *cs;
+
+	pthread_mutex_lock(&stats_lock);
+	*stats = global_stats;
+	pthread_mutex_unlock(&stats_lock);
+
+	pthread_mutex_lock(&ctx_list_lock);
+
+	stats->requests = retired_stats;
+	for (cs = ctx_list; cs; cs = cs->next) {
+		pthread_mutex_lock(&cs->lock);
+		request_stats_merge(&stats->requests, &cs->global);
+		pthread_mutex_unlock(&cs->lock);
+	}
+
+	pthread_mutex_unlock(&ctx_list_lock);
+}
+
+unsigned int xplclient_get_iface_stats(struct xplclient_iface_stats *stats, unsigned int max)
+{
+	unsigned int count;
+
+	pthread_mutex_lock(&stats_lock);
+	count = iface_count;
+	memcpy(stats, iface_stats, ((count < max) ? count : max) * sizeof(*stats));
+	pthread_mutex_unlock(&stats_lock);
+
+	return count;
+}
+
+void xplclient_reset_global_stats(void)
+{
+	struct xplclient_ctx_stats *cs;
+
+	pthread_mutex_lock(&stats_lock);
+	memset(&global_stats, 0, sizeof(global_stats));
+	memset(iface_stats, 0, sizeof(iface_stats));
+	iface_count = 0;
+	pthread_mutex_unlock(&stats_lock);
+
+	pthread_mutex_lock(&ctx_list_lock);
+
+	memset(&retired_stats, 0, sizeof(retired_stats));
+	for (cs = ctx_list; cs; cs = cs->next) {
+		pthread_mutex_lock(&cs->lock);
+		memset(&cs->global, 0, sizeof(cs->global));
+		pthread_mutex_unlock(&cs->lock);
+	}
+
+	pthread_mutex_unlock(&ctx_list_lock);
+}
@@ -0,0 +1,201 @@
+/*
+ * Copyright © 2017 Michael Heimpold <mhei@heimpold.de>
+ *
+ * SPDX-License-Identifier: LGPL-2.1
+ */
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/timerfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <poll.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "xplclient.h"
+#include "xplclient-private.h"
+
+/* the probes are paced in ticks of one millisecond */
+#define SWEEP_TICK_NS    1000000
+#define SWEEP_TICKS_PER_SEC 1000
+
+/* parse an IPv4 range in CIDR notation into the first and last host address (host byte order) */
+static int sweep_parse_range(const char *cidr, uint32_t *first, uint32_t *last)
+{
+	char buf[INET_ADDRSTRLEN + 3]; /* + "/nn" */
+	unsigned long prefix = 32;
+	struct in_addr addr;
+	char *slash, *end;
+	uint32_t mask;
+
+	if (snprintf(buf, sizeof(buf), "%s", cidr) >= sizeof(buf))
+		goto inval_out;
+
+	slash = strchr(buf, '/');
+	if (slash) {
+		*slash++ = '\0';
+		prefix = strtoul(slash, &end, 10);
+		if (*slash == '\0' || *end != '\0' || prefix > 32)
+			goto inval_out;
+	}
+
+	if (inet_pton(AF_INET, buf, &addr) != 1)
+		goto inval_out;
+
+	/* refuse ranges which could not be swept in reasonable time anyway */
+	if (prefix < XPLCLIENT_SWEEP_MIN_PREFIX)
+		goto inval_out;
+
+	mask = ~0u << (32 - prefix);
+	*first = ntohl(addr.s_addr) & mask;
+	*last = *first | ~mask;
+
+	/* skip network and broadcast address, except for /31 and /32 ranges which have none */
+	if (prefix < 31) {
+		(*first)++;
+		(*last)--;
+	}
+
+	return 0;
+
+inval_out:
+	errno = EINVAL;
+	return -1;
+}
+
+int xpl_search_sweep(xplclient_search_devices_cb cb, void *cb_ctx, const struct xplclient_search_opts *opts)
+{
+	struct sockaddr_in dst;
+	struct xpl_search_end end;
+	struct xpl_recv_ctx rx;
+	struct itimerspec its;
+	struct pollfd fds[2];
+	uint32_t next, last, drops = 0;
+	uint64_t expirations, credit = 0;
+	unsigned int rate;
+	int sending = 1, rv = -1;
+
+	if (sweep_parse_range(opts->sweep, &next, &last) == -1)
+		return -1;
+
+	rate = opts->sweep_rate ? : XPLCLIENT_SWEEP_DEFAULT_RATE;
+
+	xpl_search_end_init(&end, opts);
+
+	memset(&dst, 0, sizeof(dst));
+	dst.sin_family = AF_INET;
+	dst.sin_port = htons(opts->port ? : XPLCLIENT_DEFAULT_MC_PORT);
+
+	if (xpl_recv_ctx_init(&rx) == -1)
+		return -1;
+
+	/* a single socket for all probes, so memory does not depend on the size of the range */
+	fds[0].fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	fds[0].events = POLLIN;
+	if (fds[0].fd == -1)
+		goto cleanup_out;
+
+	if (xpl_socket_setup_rx(fds[0].fd) == -1)
+		goto close_out;
+
+	/* the timer paces the probes first, then it is re-armed for the response timeout */
+	fds[1].fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	fds[1].events = POLLIN;
+	if (fds[1].fd == -1)
+		goto close_out;
+
+	memset(&its, 0, sizeof(its));
+	its.it_interval.tv_nsec = SWEEP_TICK_NS;
+	its.it_value = its.it_interval;
+
+	if (timerfd_settime(fds[1].fd, 0, &its, NULL) == -1)
+		goto close_timer_out;
+
+	while (1) {
+		/* the quiet period only applies once all probes are out */
+		switch (poll(fds, 2, sending ? -1 : xpl_search_end_poll_timeout(&end))) {
+		case -1:
+			if (errno == EINTR)
+				continue;
+			goto close_timer_out;
+		case 0:
+			/* no response within the quiet period */
+			goto ok_out;
+		}
+
+		/* unexpected result? */
+		if ((fds[0].revents | fds[1].revents) & ~POLLIN)
+			goto close_timer_out;
+
+		if (fds[0].revents) {
+			/* received packets, callback may be satisfied already */
+			if (xpl_recv_packets(&rx, fds[0].fd, &drops, cb, cb_ctx) == XPL_RECV_STOP)
+				goto ok_out;
+
+			/* as many devices answered as expected */
+			if (xpl_search_end_update(&end, &rx))
+				goto ok_out;
+		}
+
+		if (!fds[1].revents)
+			continue;
+
+		if (read(fds[1].fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+			continue;
+
+		/* timeout after the last probe elapsed */
+		if (!sending)
+			goto ok_out;
+
+		/* send as many probes as the rate allows for the elapsed ticks */
+		credit += expirations * rate;
+
+		while (sending && credit >= SWEEP_TICKS_PER_SEC) {
+			dst.sin_addr.s_addr = htonl(next);
+
+			if (xpl_send_query(fds[0].fd, (struct sockaddr *)&dst, sizeof(dst)) == -1 &&
+			    (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)) {
+				/* send queue is full, so we are too fast anyway: retry this host later */
+				credit = 0;
+				break;
+			}
+
+			/* other errors (e.g. unreachable host) only affect this single host */
+			credit -= SWEEP_TICKS_PER_SEC;
+
+			if (next++ == last)
+				sending = 0;
+		}
+
+		if (sending)
+			continue;
+
+		/* all probes are out, now give the last hosts time to respond */
+		if (xpl_search_arm_timeout(fds[1].fd, opts) == -1)
+			goto close_timer_out;
+
+		/* the quiet period starts now, the last probes need the time, too */
+		if (end.last_reply)
+			end.last_reply = xpl_monotonic_ns();
+	}
+
+ok_out:
+	/* indicate success */
+	rv = 0;
+
+close_timer_out:
+	close(fds[1].fd);
+close_out:
+	close(fds[0].fd);
+cleanup_out:
+	if (opts->stats)
+		*opts->stats = rx.stats;
+
+	xpl_recv_ctx_cleanup(&rx);
+	return rv;
+}
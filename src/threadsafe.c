@@ -0,0 +1,266 @@
+/*
+ * Copyright © 2017 Michael Heimpold <mhei@heimpold.de>
+ *
+ * SPDX-License-Identifier: LGPL-2.1
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <json.h>
+#include <curl/curl.h>
+
+#include "xplclient.h"
+#include "xplclient-private.h"
+
+/*
+ * Thread-safe mode: instead of the context's single handle, each request uses one of a
+ * small set of handles owned by the context, bounded by the per-device concurrency limit.
+ * All these handles are attached to a library-wide share handle, so DNS results, the
+ * connection cache and TLS sessions are common to all contexts and threads. The share
+ * uses a separate lock per kind of data, so threads do not serialize on a single lock.
+ */
+
+struct xplclient_mt {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	/* idle handles */
+	struct xpl_handle *idle;
+
+	/* count of handles in use and limit */
+	unsigned int busy;
+	unsigned int max;
+};
+
+/* guards the creation of the share, which is done again after xplclient_global_cleanup */
+static pthread_mutex_t share_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t share_locks[CURL_LOCK_DATA_LAST];
+static int share_locks_ready;
+static CURLSH *share;
+
+static void share_lock_cb(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr)
+{
+	pthread_mutex_lock(&share_locks[data]);
+}
+
+static void share_unlock_cb(CURL *handle, curl_lock_data data, void *userptr)
+{
+	pthread_mutex_unlock(&share_locks[data]);
+}
+
+/* create the share, called with share_mutex held */
+static CURLSH *share_new(void)
+{
+	CURLSH *sh;
+	int i;
+
+	/* the locks are kept across a cleanup, they might still be in use by a stale handle */
+	if (!share_locks_ready) {
+		for (i = 0; i < CURL_LOCK_DATA_LAST; i++)
+			pthread_mutex_init(&share_locks[i], NULL);
+		share_locks_ready = 1;
+	}
+
+	sh = curl_share_init();
+	if (!sh)
+		return NULL;
+
+	if (curl_share_setopt(sh, CURLSHOPT_LOCKFUNC, share_lock_cb) != CURLSHE_OK ||
+	    curl_share_setopt(sh, CURLSHOPT_UNLOCKFUNC, share_unlock_cb) != CURLSHE_OK ||
+	    curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS) != CURLSHE_OK ||
+	    curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION) != CURLSHE_OK) {
+		curl_share_cleanup(sh);
+		return NULL;
+	}
+
+#if LIBCURL_VERSION_NUM >= 0x073900
+	/* sharing the connection cache is only supported since 7.57.0 */
+	if (curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT) != CURLSHE_OK) {
+		curl_share_cleanup(sh);
+		return NULL;
+	}
+#endif
+
+	return sh;
+}
+
+/* get the share, it is created on first use; a failure is not remembered, so a later call tries again */
+static CURLSH *share_get(void)
+{
+	CURLSH *sh;
+
+	pthread_mutex_lock(&share_mutex);
+	if (!share)
+		share = share_new();
+	sh = share;
+	pthread_mutex_unlock(&share_mutex);
+
+	return sh;
+}
+
+static void handle_free(struct xpl_handle *h)
+{
+	curl_easy_cleanup(h->curl);
+	xpl_pool_put_parser(h->tok);
+	free(h);
+}
+
+int xplclient_set_threadsafe(xplclient_t ctx, unsigned int max_concurrency)
+{
+	struct xplclient_mt *mt;
+	CURLSH *sh;
+
+	if (ctx->mt) {
+		errno = EALREADY;
+		return -1;
+	}
+
+	sh = share_get();
+	if (!sh) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	mt = calloc(1, sizeof(struct xplclient_mt));
+	if (!mt)
+		return -1;
+
+	mt->max = max_concurrency ? : XPLCLIENT_DEFAULT_MAX_CONCURRENCY;
+
+	if (pthread_mutex_init(&mt->lock, NULL))
+		goto free_out;
+
+	if (pthread_cond_init(&mt->cond, NULL))
+		goto destroy_out;
+
+	/* the handles of the requests are duplicated from this one */
+	if (curl_easy_setopt(ctx->curl, CURLOPT_SHARE, sh) != CURLE_OK)
+		goto cond_out;
+
+	ctx->mt = mt;
+
+	/* cached trees may be shared with the caller so far, which is not safe across threads */
+	xplclient_shadow_invalidate(ctx, NULL);
+
+	return 0;
+
+cond_out:
+	pthread_cond_destroy(&mt->cond);
+destroy_out:
+	pthread_mutex_destroy(&mt->lock);
+free_out:
+	free(mt);
+	return -1;
+}
+
+struct xpl_handle *xpl_handle_acquire(xplclient_t ctx, struct xpl_handle *local)
+{
+	struct xplclient_mt *mt = ctx->mt;
+	struct xpl_handle *h;
+	CURLSH *sh;
+
+	if (!mt) {
+		/* single-threaded: the context's own handle */
+		local->curl = ctx->curl;
+		local->tok = ctx->tok;
+		local->next = NULL;
+		return local;
+	}
+
+	pthread_mutex_lock(&mt->lock);
+
+	/* per-device concurrency limit */
+	while (mt->busy >= mt->max)
+		pthread_cond_wait(&mt->cond, &mt->lock);
+
+	mt->busy++;
+
+	h = mt->idle;
+	if (h)
+		mt->idle = h->next;
+
+	pthread_mutex_unlock(&mt->lock);
+
+	if (h)
+		return h;
+
+	/* a new handle is created outside of the lock */
+	h = calloc(1, sizeof(struct xpl_handle));
+	if (!h)
+		goto err_out;
+
+	h->curl = curl_easy_duphandle(ctx->curl);
+	if (!h->curl)
+		goto free_out;
+
+	sh = share_get();
+	if (!sh || curl_easy_setopt(h->curl, CURLOPT_SHARE, sh) != CURLE_OK)
+		goto cleanup_out;
+
+	h->tok = xpl_pool_get_parser();
+	if (!h->tok)
+		goto cleanup_out;
+
+	return h;
+
+cleanup_out:
+	curl_easy_cleanup(h->curl);
+free_out:
+	free(h);
+err_out:
+	pthread_mutex_lock(&mt->lock);
+	mt->busy--;
+	pthread_cond_signal(&mt->cond);
+	pthread_mutex_unlock(&mt->lock);
+	return NULL;
+}
+
+void xpl_handle_release(xplclient_t ctx, struct xpl_handle *h)
+{
+	struct xplclient_mt *mt = ctx->mt;
+
+	if (!mt) {
+		/* the parser might have been replaced after a large response */
+		ctx->tok = h->tok;
+		return;
+	}
+
+	pthread_mutex_lock(&mt->lock);
+
+	h->next = mt->idle;
+	mt->idle = h;
+	mt->busy--;
+	pthread_cond_signal(&mt->cond);
+
+	pthread_mutex_unlock(&mt->lock);
+}
+
+void xpl_threadsafe_free(xplclient_t ctx)
+{
+	struct xplclient_mt *mt = ctx->mt;
+	struct xpl_handle *h;
+
+	if (!mt)
+		return;
+
+	while ((h = mt->idle)) {
+		mt->idle = h->next;
+		handle_free(h);
+	}
+
+	pthread_cond_destroy(&mt->cond);
+	pthread_mutex_destroy(&mt->lock);
+	free(mt);
+	ctx->mt = NULL;
+}
+
+void xpl_share_cleanup(void)
+{
+	pthread_mutex_lock(&share_mutex);
+	if (share)
+		curl_share_cleanup(share);
+	share = NULL;
+	pthread_mutex_unlock(&share_mutex);
+}
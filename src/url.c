@@ -13,108 +13,289 @@
 #include <curl/curl.h>
 
 #include "xplclient.h"
+#include "xplclient-private.h"
 
-struct curl_recv_data {
-	size_t size;
-	char *payload;
-};
+void xpl_recv_data_init(struct curl_recv_data *d, struct json_tokener *tok)
+{
+	memset(d, 0, sizeof(*d));
+
+	json_tokener_reset(tok);
+	d->tok = tok;
+}
 
-static size_t curl_recv_cb(void *ptr, size_t size, size_t nmemb, void *userdata)
+size_t xpl_curl_recv_cb(void *ptr, size_t size, size_t nmemb, void *userdata)
 {
 	struct curl_recv_data *d = (struct curl_recv_data *)userdata;
 	size_t len = size * nmemb; /* data length */
-	char *new_payload;
+	enum json_tokener_error jerr;
+	struct json_object *obj;
+	uint64_t start;
+	int rv;
 
-	/* try to expand buffer */
-	new_payload = (char *)realloc(d->payload, d->size + len);
-	if (!new_payload) {
-		/* return with the data we have */
-		return -1;
-	} else {
-		d->payload = new_payload;
+	d->size += len;
+
+	start = xpl_monotonic_ns();
+
+	/* a buffered body is parsed later, if it turns out to differ from the last one */
+	if (d->shadow) {
+		rv = xpl_shadow_recv(d->shadow, ptr, len);
+		if (rv || d->shadow->buffer) {
+			d->parse_ns += xpl_monotonic_ns() - start;
+			return (rv == 0) ? len : 0;
+		}
 	}
 
-	/* append new data to now increased buffer */
-	memcpy(&d->payload[d->size], ptr, len);
+	/* swallow the rest, so that the connection can be kept */
+	if (d->error || d->root)
+		return len;
 
-	d->size += len;
+	if (d->stream) {
+		rv = xpl_json_stream_feed(d->stream, ptr, len);
+		d->parse_ns += xpl_monotonic_ns() - start;
+
+		switch (rv) {
+		case 0:
+			break;
+		case XPL_RECV_STOP:
+			/* the caller got what it wanted, abort the transfer */
+			d->stopped = 1;
+			return 0;
+		default:
+			d->error = 1;
+		}
+
+		return len;
+	}
+
+	/* parse the chunk right away, so that no copy of the body is needed */
+	obj = json_tokener_parse_ex(d->tok, ptr, len);
+	d->parse_ns += xpl_monotonic_ns() - start;
+	if (obj) {
+		d->root = obj;
+		return len;
+	}
+
+	jerr = json_tokener_get_error(d->tok);
+	if (jerr != json_tokener_continue)
+		d->error = 1;
 
 	return len;
 }
 
-static struct json_object *do_curl_request(xplclient_t ctx, const char *path, struct json_object *data)
+struct json_object *xpl_recv_data_finish(struct curl_recv_data *d)
+{
+	struct json_object *root;
+
+	if (d->error || d->stream)
+		return NULL;
+
+	/* a top-level number is only terminated by the end of the body */
+	if (!d->root)
+		d->root = json_tokener_parse_ex(d->tok, "", 1);
+
+	root = d->root;
+	d->root = NULL;
+
+	return root;
+}
+
+void xpl_recv_data_cleanup(struct curl_recv_data *d)
+{
+	json_object_put(d->root);
+	d->root = NULL;
+}
+
+void xpl_recv_data_trim(xplclient_t ctx, struct curl_recv_data *d, struct json_tokener **tokp)
 {
-	struct curl_recv_data recvdata = { 0, NULL };
-	struct json_object *root = NULL;
 	struct json_tokener *tok;
+
+	/* the parser's buffers grew beyond the high-water mark: start over with a small
+	 * one instead of keeping the memory for the lifetime of the context */
+	if (d->size <= ctx->recv_hwm || d->tok != *tokp)
+		return;
+
+	tok = json_tokener_new();
+	if (!tok)
+		return;
+
+	json_tokener_free(*tokp);
+	*tokp = tok;
+}
+
+/* errors which indicate that the device dropped a kept-alive connection under our feet */
+static int curl_conn_dropped(CURLcode rc)
+{
+	return rc == CURLE_SEND_ERROR || rc == CURLE_RECV_ERROR || rc == CURLE_GOT_NOTHING;
+}
+
+/* perform a request, the response body is passed to the parser state in recvdata */
+static int do_curl_request(xplclient_t ctx, struct xpl_handle *h, const char *path,
+                           struct json_object *data, struct curl_recv_data *recvdata)
+{
+	struct xpl_shadow_req *sr = recvdata->shadow;
+	struct curl_slist *headers;
 	char url[128];
-	CURL *curl;
-	struct curl_slist *headers = NULL;
+	long connects;
+	CURLcode rc;
+	int rv = -1;
 
 	if (snprintf(url, sizeof(url), "%s%s", ctx->url_prefix, path) >= sizeof(url))
-		return NULL;
+		return -1;
 
-	curl = curl_easy_init();
-	if (!curl)
-		return NULL;
+	headers = data ? ctx->post_headers : ctx->headers;
+	if (sr && sr->headers)
+		headers = sr->headers;
 
-	headers = curl_slist_append(headers, "Accept: application/json");
+	/* the handles are reused for all requests, so (re-)set all per-request options */
+	if (curl_easy_setopt(h->curl, CURLOPT_HTTPHEADER, headers) != CURLE_OK)
+		return -1;
+
+	if (curl_easy_setopt(h->curl, CURLOPT_URL, url) != CURLE_OK)
+		return -1;
+
+	if (curl_easy_setopt(h->curl, CURLOPT_WRITEFUNCTION, xpl_curl_recv_cb) != CURLE_OK)
+		return -1;
+
+	if (curl_easy_setopt(h->curl, CURLOPT_WRITEDATA, (void *)recvdata) != CURLE_OK)
+		return -1;
 
 	if (data) {
-		headers = curl_slist_append(headers, "Content-Type: application/json");
+		if (curl_easy_setopt(h->curl, CURLOPT_POSTFIELDS, json_object_to_json_string(data)) != CURLE_OK)
+			return -1;
+	} else {
+		/* a previous request might have been a POST */
+		if (curl_easy_setopt(h->curl, CURLOPT_HTTPGET, 1L) != CURLE_OK)
+			return -1;
 	}
 
-	if (!headers)
-		goto free_out;
+	/* the shadow needs the validators of the response */
+	if (sr) {
+		if (curl_easy_setopt(h->curl, CURLOPT_HEADERFUNCTION, xpl_shadow_header_cb) != CURLE_OK ||
+		    curl_easy_setopt(h->curl, CURLOPT_HEADERDATA, (void *)sr) != CURLE_OK)
+			goto out;
+	}
 
-	if (curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers) != CURLE_OK)
-		goto free_out;
+	rc = curl_easy_perform(h->curl);
 
-	if (curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1) != CURLE_OK)
-		goto free_out;
+	/* When we re-used a kept-alive connection and the device closed it meanwhile, then
+	 * retry exactly once on a fresh connection. Only GETs are retried: the request
+	 * may already have reached the device, and replaying a write is not safe.
+	 */
+	if (!data && curl_conn_dropped(rc) && ctx->persistent && !recvdata->stream &&
+	    curl_easy_getinfo(h->curl, CURLINFO_NUM_CONNECTS, &connects) == CURLE_OK && connects == 0) {
+		xpl_recv_data_cleanup(recvdata);
+		xpl_recv_data_init(recvdata, h->tok);
+		if (sr) {
+			xpl_shadow_req_reset(sr);
+			recvdata->shadow = sr;
+		}
 
-	if (curl_easy_setopt(curl, CURLOPT_URL, url) != CURLE_OK)
-		goto free_out;
+		if (curl_easy_setopt(h->curl, CURLOPT_FRESH_CONNECT, 1L) != CURLE_OK)
+			goto out;
 
-	if (curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_recv_cb) != CURLE_OK)
-		goto free_out;
+		rc = curl_easy_perform(h->curl);
 
-	if (curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&recvdata) != CURLE_OK)
-		goto free_out;
+		curl_easy_setopt(h->curl, CURLOPT_FRESH_CONNECT, 0L);
+	}
 
-	if (data) {
-		if (curl_easy_setopt(curl, CURLOPT_POSTFIELDS, json_object_to_json_string(data)) != CURLE_OK)
-			goto free_out;
+	/* a write error is how the extraction callback stops the transfer early */
+	if (rc == CURLE_OK || (rc == CURLE_WRITE_ERROR && recvdata->stopped))
+		rv = 0;
+
+	xpl_stats_request(ctx, h->curl, path, recvdata, rv || recvdata->error);
+
+out:
+	/* do not keep a reference to the caller's data */
+	if (data)
+		curl_easy_setopt(h->curl, CURLOPT_POSTFIELDS, NULL);
+
+	if (sr) {
+		curl_easy_setopt(h->curl, CURLOPT_HEADERFUNCTION, NULL);
+		curl_easy_setopt(h->curl, CURLOPT_HEADERDATA, NULL);
+		curl_easy_setopt(h->curl, CURLOPT_HTTPHEADER, ctx->headers);
 	}
 
-	if (curl_easy_perform(curl) != CURLE_OK)
-		goto free_out;
+	return rv;
+}
 
-	if (!recvdata.payload)
-		goto free_out;
+static struct json_object *do_curl_parse(xplclient_t ctx, const char *path, struct json_object *data)
+{
+	struct xpl_handle local, *h;
+	struct curl_recv_data recvdata;
+	struct json_object *root = NULL;
+	struct xpl_shadow_req sreq;
+	int shadow = ctx->shadow && !data;
 
-	tok = json_tokener_new();
-	if (!tok)
-		goto free_out;
+	/* a hot path may be answered without asking the device */
+	if (shadow) {
+		root = xpl_shadow_begin(ctx, path, &sreq);
+		if (root)
+			return root;
+	}
 
-	root = json_tokener_parse_ex(tok, recvdata.payload, recvdata.size);
+	h = xpl_handle_acquire(ctx, &local);
+	if (!h)
+		goto shadow_out;
 
-	json_tokener_free(tok);
+	xpl_recv_data_init(&recvdata, h->tok);
+	if (shadow)
+		recvdata.shadow = &sreq;
 
-free_out:
-	curl_easy_cleanup(curl);
-	curl_slist_free_all(headers);
-	free(recvdata.payload);
+	if (do_curl_request(ctx, h, path, data, &recvdata) == 0)
+		root = shadow ? xpl_shadow_finish(ctx, path, h->curl, &recvdata) : xpl_recv_data_finish(&recvdata);
 
+	xpl_recv_data_cleanup(&recvdata);
+	xpl_recv_data_trim(ctx, &recvdata, &h->tok);
+
+	xpl_handle_release(ctx, h);
+
+	/* the device's state changed, so the cached responses may be outdated */
+	if (data && ctx->shadow)
+		xplclient_shadow_invalidate(ctx, path);
+
+shadow_out:
+	if (shadow)
+		xpl_shadow_req_cleanup(&sreq);
 	return root;
 }
 
 struct json_object *xplclient_url_get(xplclient_t ctx, const char *path)
 {
-	return do_curl_request(ctx, path, NULL);
+	return do_curl_parse(ctx, path, NULL);
 }
 
 struct json_object *xplclient_url_set(xplclient_t ctx, const char *path, struct json_object *data)
 {
-	return do_curl_request(ctx, path, data);
+	return do_curl_parse(ctx, path, data);
+}
+
+int xplclient_url_get_extract(xplclient_t ctx, const char *path, xplclient_json_path_t paths,
+                              xplclient_json_extract_cb cb, void *cb_ctx)
+{
+	struct xpl_handle local, *h;
+	struct curl_recv_data recvdata;
+	int rv = -1;
+
+	h = xpl_handle_acquire(ctx, &local);
+	if (!h)
+		return -1;
+
+	xpl_recv_data_init(&recvdata, h->tok);
+
+	recvdata.stream = xpl_json_stream_new(paths, cb, cb_ctx);
+	if (!recvdata.stream)
+		goto release_out;
+
+	if (do_curl_request(ctx, h, path, NULL, &recvdata) == -1)
+		goto free_out;
+
+	/* stopped by the callback, or the whole body was well-formed */
+	if (!recvdata.error && (recvdata.stopped || xpl_json_stream_done(recvdata.stream)))
+		rv = xpl_json_stream_found(recvdata.stream);
+
+free_out:
+	xpl_json_stream_free(recvdata.stream);
+release_out:
+	xpl_handle_release(ctx, h);
+	return rv;
 }
@@ -0,0 +1,244 @@
+/*
+ * Copyright © 2017 Michael Heimpold <mhei@heimpold.de>
+ *
+ * SPDX-License-Identifier: LGPL-2.1
+ */
+
+#include <sys/timerfd.h>
+
+#include <time.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <json.h>
+
+#include "xplclient.h"
+#include "xplclient-private.h"
+
+/* a pending (merged) write */
+struct writer_entry {
+	struct writer_entry *next;
+
+	char *path;
+	struct json_object *data;
+};
+
+struct xplclient_writer {
+	xplclient_t ctx;
+
+	/* maximum time a write is held back */
+	unsigned int delay_ms;
+
+	/* pending writes in the order of their first set */
+	struct writer_entry *head, **tail;
+
+	/* deadline of the oldest pending write */
+	struct timespec deadline;
+
+	/* one-shot timer expiring at the deadline */
+	int timerfd;
+
+	xplclient_writer_cb cb;
+	void *cb_ctx;
+};
+
+xplclient_writer_t xplclient_writer_new(xplclient_t ctx, unsigned int delay_ms, xplclient_writer_cb cb, void *cb_ctx)
+{
+	xplclient_writer_t w;
+
+	w = calloc(1, sizeof(struct xplclient_writer));
+	if (!w)
+		return NULL;
+
+	w->ctx = ctx;
+	w->delay_ms = delay_ms ? : XPLCLIENT_WRITER_DEFAULT_DELAY;
+	w->tail = &w->head;
+	w->cb = cb;
+	w->cb_ctx = cb_ctx;
+
+	w->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (w->timerfd == -1) {
+		free(w);
+		return NULL;
+	}
+
+	return w;
+}
+
+int xplclient_writer_get_fd(xplclient_writer_t w)
+{
+	return w->timerfd;
+}
+
+static void writer_entry_free(struct writer_entry *e)
+{
+	json_object_put(e->data);
+	free(e->path);
+	free(e);
+}
+
+/* merge new data into a pending write, the later value of a key wins; all of it is copied,
+ * since the pending data must not change when the caller modifies its object later */
+static int writer_merge(struct writer_entry *e, struct json_object *data)
+{
+	struct json_object *val;
+
+	if (json_object_is_type(e->data, json_type_object) && json_object_is_type(data, json_type_object)) {
+		json_object_object_foreach(data, key, v) {
+			val = xpl_json_copy(v);
+			if (v && !val)
+				return -1;
+			json_object_object_add(e->data, key, val);
+		}
+		return 0;
+	}
+
+	/* anything else cannot be merged, so the latest body replaces the pending one;
+	 * NULL is a valid body, too (JSON null) */
+	val = xpl_json_copy(data);
+	if (data && !val)
+		return -1;
+
+	json_object_put(e->data);
+	e->data = val;
+	return 0;
+}
+
+static int writer_arm(xplclient_writer_t w)
+{
+	struct itimerspec its;
+
+	clock_gettime(CLOCK_MONOTONIC, &w->deadline);
+	w->deadline.tv_sec += w->delay_ms / 1000;
+	w->deadline.tv_nsec += (w->delay_ms % 1000) * 1000000;
+	if (w->deadline.tv_nsec >= 1000000000) {
+		w->deadline.tv_sec++;
+		w->deadline.tv_nsec -= 1000000000;
+	}
+
+	memset(&its, 0, sizeof(its));
+	its.it_value = w->deadline;
+
+	return timerfd_settime(w->timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static int writer_expired(xplclient_writer_t w)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec > w->deadline.tv_sec ||
+	       (now.tv_sec == w->deadline.tv_sec && now.tv_nsec >= w->deadline.tv_nsec);
+}
+
+int xplclient_writer_set(xplclient_writer_t w, const char *path, struct json_object *data)
+{
+	struct writer_entry *e;
+
+	for (e = w->head; e; e = e->next)
+		if (strcmp(e->path, path) == 0)
+			break;
+
+	if (e) {
+		if (writer_merge(e, data) == -1)
+			return -1;
+	} else {
+		e = calloc(1, sizeof(struct writer_entry));
+		if (!e)
+			return -1;
+
+		e->path = strdup(path);
+		e->data = xpl_json_copy(data);
+		if (!e->path || (data && !e->data)) {
+			writer_entry_free(e);
+			return -1;
+		}
+
+		/* first pending write starts the deadline */
+		if (!w->head && writer_arm(w) == -1) {
+			writer_entry_free(e);
+			return -1;
+		}
+
+		*w->tail = e;
+		w->tail = &e->next;
+	}
+
+	/* without an event loop driving us, the deadline is checked here */
+	if (writer_expired(w))
+		return xplclient_writer_flush(w);
+
+	return 0;
+}
+
+int xplclient_writer_flush(xplclient_writer_t w)
+{
+	struct writer_entry *e, *list = w->head;
+	struct json_object *result;
+	struct itimerspec its;
+	int rv = 0;
+
+	/* detach first, so that callbacks may queue new writes */
+	w->head = NULL;
+	w->tail = &w->head;
+
+	memset(&its, 0, sizeof(its));
+	timerfd_settime(w->timerfd, 0, &its, NULL);
+
+	while ((e = list)) {
+		list = e->next;
+
+		result = xplclient_url_set(w->ctx, e->path, e->data);
+		if (!result)
+			rv = -1;
+
+		if (w->cb)
+			w->cb(w->cb_ctx, e->path, e->data, result);
+		else
+			json_object_put(result);
+
+		writer_entry_free(e);
+	}
+
+	return rv;
+}
+
+int xplclient_writer_process(xplclient_writer_t w)
+{
+	uint64_t expirations;
+
+	/* just drain the timer, the deadline itself is authoritative */
+	if (read(w->timerfd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN)
+		return -1;
+
+	if (!w->head || !writer_expired(w))
+		return 0;
+
+	return xplclient_writer_flush(w);
+}
+
+int xplclient_writer_pending(xplclient_writer_t w)
+{
+	struct writer_entry *e;
+	int c = 0;
+
+	for (e = w->head; e; e = e->next)
+		c++;
+
+	return c;
+}
+
+void xplclient_writer_free(xplclient_writer_t w)
+{
+	if (!w)
+		return;
+
+	/* pending writes are not lost */
+	xplclient_writer_flush(w);
+
+	close(w->timerfd);
+	free(w);
+}
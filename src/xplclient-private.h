@@ -0,0 +1,360 @@
+/*
+ * Copyright © 2017 Michael Heimpold <mhei@heimpold.de>
+ *
+ * SPDX-License-Identifier: LGPL-2.1
+ */
+#ifndef XPLCLIENT_PRIVATE_H
+#define XPLCLIENT_PRIVATE_H
+
+/* Internal helpers shared between the library's translation units - not installed */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <net/if.h>
+
+#include <json.h>
+
+#include "xplclient.h"
+
+struct xpl_json_stream;
+struct xpl_shadow_req;
+
+/* parser state of a response body, fed with each received chunk */
+struct curl_recv_data {
+	/* incremental parser, building the whole object tree */
+	struct json_tokener *tok;
+
+	/* root object, set once the body is complete */
+	struct json_object *root;
+
+	/* the body is not valid JSON (or the callback stopped), the rest is discarded */
+	int error;
+
+	/* if set, only selected values are extracted instead of building the tree */
+	struct xpl_json_stream *stream;
+
+	/* the extraction callback asked to stop the transfer */
+	int stopped;
+
+	/* count of body bytes received */
+	size_t size;
+
+	/* time spent parsing the body in nanoseconds */
+	uint64_t parse_ns;
+
+	/* set for a GET of a context with the device shadow enabled */
+	struct xpl_shadow_req *shadow;
+};
+
+/* prepare for a new response body, tok is reset and used for parsing */
+void xpl_recv_data_init(struct curl_recv_data *d, struct json_tokener *tok);
+
+/* cURL write callback feeding a struct curl_recv_data */
+size_t xpl_curl_recv_cb(void *ptr, size_t size, size_t nmemb, void *userdata);
+
+/* the transfer completed: returns the parsed root object (caller takes over), NULL on error */
+struct json_object *xpl_recv_data_finish(struct curl_recv_data *d);
+
+/* drop a partially received body */
+void xpl_recv_data_cleanup(struct curl_recv_data *d);
+
+/* replace the parser *tokp if the last body exceeded the receive high-water mark */
+void xpl_recv_data_trim(xplclient_t ctx, struct curl_recv_data *d, struct json_tokener **tokp);
+
+/* the state a single request is performed with */
+struct xpl_handle {
+	CURL *curl;
+	struct json_tokener *tok;
+
+	/* next idle handle of a thread-safe context */
+	struct xpl_handle *next;
+};
+
+/* get a handle for a request, waits for the concurrency limit of a thread-safe context;
+ * otherwise the context's own handle is returned in local */
+struct xpl_handle *xpl_handle_acquire(xplclient_t ctx, struct xpl_handle *local);
+void xpl_handle_release(xplclient_t ctx, struct xpl_handle *h);
+
+/* the device shadow's part of a GET request */
+struct xpl_shadow_req {
+	/* default and conditional request headers, NULL for the default ones only */
+	struct curl_slist *headers;
+
+	/* validators of the response */
+	char *etag;
+	char *last_modified;
+
+	/* the body is collected instead of parsed right away */
+	int buffer;
+	char *body;
+	size_t size;
+
+	/* length and hash of the body */
+	size_t len;
+	uint64_t hash;
+};
+
+/* prepare a GET of path: returns the cached tree if it is fresh enough to skip the request,
+ * otherwise NULL and sr is set up for the request */
+struct json_object *xpl_shadow_begin(xplclient_t ctx, const char *path, struct xpl_shadow_req *sr);
+
+/* the request completed: returns the cached or the parsed tree and updates the shadow */
+struct json_object *xpl_shadow_finish(xplclient_t ctx, const char *path, CURL *curl, struct curl_recv_data *d);
+
+/* cURL header callback collecting the validators into a struct xpl_shadow_req */
+size_t xpl_shadow_header_cb(char *buffer, size_t size, size_t nitems, void *userdata);
+
+/* hash a chunk of the body, and collect it if it is buffered */
+int xpl_shadow_recv(struct xpl_shadow_req *sr, const char *ptr, size_t len);
+
+/* forget what was received, e.g. when a request is retried */
+void xpl_shadow_req_reset(struct xpl_shadow_req *sr);
+void xpl_shadow_req_cleanup(struct xpl_shadow_req *sr);
+
+/* free the device shadow of a context */
+void xpl_shadow_free(struct xplclient_shadow *sh);
+
+/* monotonic clock in nanoseconds */
+uint64_t xpl_monotonic_ns(void);
+
+/* create the request counters of a context, and fold them into the library-wide ones when
+ * the context is freed */
+int xpl_stats_ctx_new(xplclient_t ctx);
+void xpl_stats_ctx_free(xplclient_t ctx);
+
+/* account a finished request to the context's and the global counters and call the hook */
+void xpl_stats_request(xplclient_t ctx, CURL *curl, const char *path, const struct curl_recv_data *d, int failed);
+
+/* account the duration of a serial number resolution and a serial port connect */
+void xpl_stats_resolve(uint64_t ns);
+void xpl_stats_serial_connect(uint64_t ns);
+
+/* account search queries sent and responses received on an interface */
+void xpl_stats_iface(unsigned int ifindex, unsigned long queries, unsigned long replies);
+
+/* free the thread-safe state of a context */
+void xpl_threadsafe_free(xplclient_t ctx);
+
+/* release the library-wide share handle */
+void xpl_share_cleanup(void);
+
+struct xpl_recv_ctx;
+
+/* a socket used to send out search queries on one interface */
+struct xpl_search_socket {
+	int fd;
+
+	/* multicast or broadcast address (including port) to send the query to */
+	struct sockaddr_storage dst;
+	socklen_t dstlen;
+
+	/* interface index, used to open only one IPv6 socket per interface */
+	unsigned int ifindex;
+
+	/* last value of the kernel's drop counter */
+	uint32_t drops;
+};
+
+/* all sockets used for a search */
+struct xpl_search_set {
+	int count;
+	struct xpl_search_socket *socks;
+
+	/* epoll fd watching all sockets, readable when any socket is */
+	int epfd;
+
+	/* generation of the interface list the set was created from */
+	unsigned long ifgen;
+};
+
+/* open search sockets for each usable interface and address family, returns -1 with errno set on error */
+int xpl_search_set_open(struct xpl_search_set *set, const struct xplclient_search_opts *opts);
+
+/* send the query packet on all sockets of the set, fails only if not a single one was sent */
+int xpl_search_set_query(struct xpl_search_set *set);
+
+/* process the pending packets of all ready sockets without blocking */
+int xpl_search_set_dispatch(struct xpl_search_set *set, struct xpl_recv_ctx *rx,
+                            xplclient_search_devices_cb cb, void *cb_ctx);
+
+/* check whether the interfaces changed since the set was opened */
+int xpl_search_set_changed(struct xpl_search_set *set);
+
+/* close all sockets of the set */
+void xpl_search_set_close(struct xpl_search_set *set);
+
+/* probe all hosts of the range opts->sweep via unicast and collect the responses */
+int xpl_search_sweep(xplclient_search_devices_cb cb, void *cb_ctx, const struct xplclient_search_opts *opts);
+
+/* an address of a network interface */
+struct xpl_iface {
+	char name[IFNAMSIZ];
+	unsigned int index;
+	unsigned int flags;
+	struct sockaddr_storage addr;
+	struct sockaddr_storage broadaddr;
+};
+
+/* get a copy of the (cached) interface address list, caller must free list */
+int xpl_iface_list(struct xpl_iface **list, int *count, unsigned long *gen);
+
+/* current generation of the interface list, changes whenever the kernel reports a change */
+unsigned long xpl_iface_generation(void);
+
+/* send a search query packet to the given destination address (IPv4 or IPv6) */
+int xpl_send_query(int s, const struct sockaddr *dst, socklen_t dstlen);
+
+/* largest possible UDP payload (rounded up), so that no response is ever truncated */
+#define XPL_MAX_DATAGRAM 65536
+
+/* count of datagrams received with a single system call */
+#define XPL_RECV_BATCH 16
+
+/* requested socket receive buffer size, large enough for bursts of some hundred responses */
+#define XPL_SEARCH_RCVBUF (1024 * 1024)
+
+/* receive state of a search session, re-used for all packets */
+struct xpl_recv_ctx {
+	/* ring of XPL_RECV_BATCH datagram buffers, XPL_MAX_DATAGRAM bytes each */
+	char *buf;
+
+	/* preallocated recvmmsg structures for the ring */
+	struct mmsghdr msgs[XPL_RECV_BATCH];
+	struct iovec iovs[XPL_RECV_BATCH];
+	struct sockaddr_storage addrs[XPL_RECV_BATCH];
+	char ctrl[XPL_RECV_BATCH][CMSG_SPACE(sizeof(uint32_t))];
+
+	struct json_tokener *tok;
+
+	/* counters of this session */
+	struct xplclient_search_stats stats;
+};
+
+int xpl_recv_ctx_init(struct xpl_recv_ctx *rx);
+void xpl_recv_ctx_cleanup(struct xpl_recv_ctx *rx);
+
+/* enlarge the receive buffer of a socket and enable drop reporting */
+int xpl_socket_setup_rx(int s);
+
+/* return value of xpl_recv_packets/xpl_process_packet besides 0 (success) and -1 (error):
+ * callback asked to stop the search */
+#define XPL_RECV_STOP 2
+
+/* parse a received NOTIFY packet and pass it to the callback */
+int xpl_process_packet(struct xpl_recv_ctx *rx, const char *buffer, size_t len,
+                       const struct sockaddr *addr, socklen_t addrlen,
+                       xplclient_search_devices_cb cb, void *cb_ctx);
+
+/* receive and process all pending NOTIFY packets of a socket in batches; drops points
+ * to the last kernel drop counter seen on this socket (may be NULL) */
+int xpl_recv_packets(struct xpl_recv_ctx *rx, int s, uint32_t *drops, xplclient_search_devices_cb cb, void *cb_ctx);
+
+/* end conditions of a search besides the timeout, see struct xplclient_search_opts */
+struct xpl_search_end {
+	uint64_t quiet_ns;
+	unsigned int expected;
+
+	/* time of the last valid response (monotonic), zero if there was none yet */
+	uint64_t last_reply;
+
+	/* count of valid responses when last checked */
+	unsigned long processed;
+};
+
+/* arm a timer with the (hard) timeout of a search */
+int xpl_search_arm_timeout(int timerfd, const struct xplclient_search_opts *opts);
+
+void xpl_search_end_init(struct xpl_search_end *e, const struct xplclient_search_opts *opts);
+
+/* account the responses received meanwhile, returns 1 if the expected count is reached */
+int xpl_search_end_update(struct xpl_search_end *e, const struct xpl_recv_ctx *rx);
+
+/* poll timeout in milliseconds until the quiet period elapses, -1 if there is none (yet) */
+int xpl_search_end_poll_timeout(const struct xpl_search_end *e);
+
+/* limit the parallel connections of a request engine to a single host */
+int xpl_multi_set_max_host_connections(xplclient_multi_t m, long max);
+
+/* library-wide pool of response parsers and datagram rings (XPL_RECV_BATCH * XPL_MAX_DATAGRAM bytes) */
+struct json_tokener *xpl_pool_get_parser(void);
+void xpl_pool_put_parser(struct json_tokener *tok);
+char *xpl_pool_get_rx_buf(void);
+void xpl_pool_put_rx_buf(char *buf);
+
+/* trim away whitespace and leading zeros of a serial number (in-place) */
+char *xpl_trim_serial(char *str);
+
+/*
+ * Resolve several serial numbers at once: fresh cache entries are used directly, all others
+ * are looked up by a single search which ends when all devices responded or after timeout_ms.
+ * The address length of a serial number which was not found is set to zero.
+ * Returns the count of resolved serial numbers or -1 on error.
+ */
+int xpl_resolve_serials(const char * const *serials, unsigned int count,
+                        struct sockaddr_storage *addrs, socklen_t *addrlens, unsigned int timeout_ms);
+
+/*
+ * The compiled paths form a prefix tree: paths sharing leading elements share the
+ * tree nodes, so that each element is looked up only once per evaluation.
+ */
+struct json_path_node {
+	/* path element, NUL terminated (points into the string buffer) */
+	const char *key;
+
+	/* element as array index, -1 if it is not a number */
+	long index;
+
+	/* parent, first child and next sibling, zero means none (node 0 is the root) */
+	unsigned int parent;
+	unsigned int child;
+	unsigned int sibling;
+
+	/* first path ending at this node, -1 if none */
+	int leaf;
+};
+
+struct xplclient_json_path {
+	/* count of compiled paths */
+	unsigned int count;
+
+	/* tree nodes, the first one is the root */
+	struct json_path_node *nodes;
+	unsigned int node_count;
+
+	/* next path ending at the same node (for duplicates), -1 if none */
+	int *next_leaf;
+
+	/* node of the first path */
+	unsigned int first_leaf;
+
+	/* copy of all paths, split into NUL terminated elements */
+	char *strings;
+};
+
+/* copy a JSON value including all nested values, so that nothing is shared with the original;
+ * returns NULL on error (and for JSON null) */
+struct json_object *xpl_json_copy(struct json_object *data);
+
+/* array index addressed by a path element, -1 if it is not numeric */
+long xpl_json_path_index(const char *s);
+
+/* descend one level of a compiled path: object member or array element */
+struct json_object *xpl_json_path_step(const struct json_path_node *node, struct json_object *obj);
+
+/* streaming extraction of the values of compiled paths from a JSON document */
+struct xpl_json_stream *xpl_json_stream_new(xplclient_json_path_t paths, xplclient_json_extract_cb cb, void *cb_ctx);
+void xpl_json_stream_free(struct xpl_json_stream *js);
+
+/* scan the next chunk of the document, returns 0, -1 if malformed or XPL_RECV_STOP if the callback asked to */
+int xpl_json_stream_feed(struct xpl_json_stream *js, const char *buf, size_t len);
+
+/* whether the document is complete */
+int xpl_json_stream_done(struct xpl_json_stream *js);
+
+/* count of values passed to the callback so far */
+unsigned int xpl_json_stream_found(struct xpl_json_stream *js);
+
+#endif /* XPLCLIENT_PRIVATE_H */
@@ -17,9 +17,14 @@
 
 #define XPLCLIENT_DEFAULT_MC_PORT 4109
 #define XPLCLIENT_DEFAULT_MC_GROUP "239.255.255.250"
+#define XPLCLIENT_DEFAULT_MC_GROUP6 "ff02::c"
 
 #define XPLCLIENT_JSON_OBJECT_GET_BY_KEY_MAXDEPTH 8
 
+/* return values of xplclient_search_devices_cb */
+#define XPLCLIENT_SEARCH_CONTINUE 0
+#define XPLCLIENT_SEARCH_STOP     1
+
 /**
  * Callback function type used by xplclient_search_devices.
  *
@@ -28,27 +33,116 @@
  * @param addrlen    This argument specifies the size of address.
  * @param deviceinfo Pointer to the root JSON object of the NOTIFY response. Callee is responsible to
  *                   free the object!
- * @return Return value is ignored at the moment, however, return 0 on sucess, -1 on error.
+ * @return XPLCLIENT_SEARCH_STOP to end the search immediately, XPLCLIENT_SEARCH_CONTINUE to collect
+ *         further responses until the timeout expires. Negative values (errors) are treated like
+ *         XPLCLIENT_SEARCH_CONTINUE at the moment.
  */
 typedef int (*xplclient_search_devices_cb)(void *ctx, const struct sockaddr *address, socklen_t addrlen, struct json_object *deviceinfo);
 
+/* counters of a search */
+struct xplclient_search_stats {
+	/* datagrams received */
+	unsigned long received;
+
+	/* valid responses passed to the callback */
+	unsigned long processed;
+
+	/* datagrams which were no valid NOTIFY response */
+	unsigned long garbled;
+
+	/* datagrams larger than the receive buffer */
+	unsigned long truncated;
+
+	/* datagrams dropped by the kernel because the socket buffer was full */
+	unsigned long dropped;
+};
+
+/* default count of unicast probes per second of a sweep, a /16 network takes about 7s */
+#define XPLCLIENT_SWEEP_DEFAULT_RATE 10000
+
+/* smallest network prefix length accepted for a sweep */
+#define XPLCLIENT_SWEEP_MIN_PREFIX 16
+
+/* parameters of xplclient_search_devices_ex */
+struct xplclient_search_opts {
+	/* name of the interface to use, NULL means all interfaces */
+	const char *interface;
+
+	/* multicast address, NULL means default address */
+	const char *mc_address;
+
+	/* IPv6 multicast address, NULL means default (link-local) address */
+	const char *mc_address6;
+
+	/* address family to search with: AF_INET, AF_INET6 or AF_UNSPEC (zero) for both in parallel */
+	int family;
+
+	/* UDP port, zero means default port */
+	unsigned int port;
+
+	/* timeout in seconds (for a sweep: after the last probe), zero or below zero means default timeout of 3s */
+	int timeout;
+
+	/* IPv4 range in CIDR notation (e.g. "192.168.0.0/16"): instead of multicasting, probe every
+	 * host of the range via unicast - for networks which drop multicast and broadcast traffic;
+	 * NULL means normal multicast search */
+	const char *sweep;
+
+	/* probes per second sent during a sweep, zero means XPLCLIENT_SWEEP_DEFAULT_RATE */
+	unsigned int sweep_rate;
+
+	/* if not NULL, the counters of the search are stored here */
+	struct xplclient_search_stats *stats;
+
+	/* timeout in milliseconds, takes precedence over timeout if not zero */
+	unsigned int timeout_ms;
+
+	/* adaptive end: once responses arrived, end the search as soon as no further response
+	 * arrived for this time in milliseconds - the timeout still bounds the whole search;
+	 * zero means wait for the timeout */
+	unsigned int quiet_ms;
+
+	/* end the search as soon as this count of valid responses arrived, zero means no limit */
+	unsigned int expected;
+};
+
 /**
  * Search for XPL devices in local network(s).
  *
  * If no explicite interface name is given, all available interfaces are used to send out a multicast query.
  * XPL devices usually respond to such queries with a NOTIFY message which contain few device informations.
  * Caller can specify a non-standard multicast address and/or port, if not given, then default values are used.
+ * IPv6 capable interfaces are queried in parallel via the link-local group XPLCLIENT_DEFAULT_MC_GROUP6,
+ * responses of both address families are passed to the same callback.
  *
  * @param cb         Callback function which is called for every found device.
  * @param cb_ctx     Context parameter passed to the callback function as first parameter.
  * @param interface  Name of the interface to use, if NULL is given, then all interfaces are searched in parallel.
- * @param mc_address Multicast address to use when sending the queries, use NULL to use default address.
+ * @param mc_address IPv4 multicast address to use when sending the queries, use NULL to use default address.
  * @param port       UDP port to use for the multicast query, use zero to use default value.
  * @param timeout    Timeout in seconds for collecting responses, a value of zero or below zero results in the default of 3s.
  * @return Zero on success, -1 with errno set on error.
  */
 int xplclient_search_devices(xplclient_search_devices_cb cb, void *cb_ctx, const char *interface, const char *mc_address, unsigned int port, int timeout);
 
+/**
+ * Same as xplclient_search_devices, but the parameters are passed as structure which allows
+ * to retrieve additional information, e.g. the counters of the search.
+ *
+ * When opts->sweep is given, a single socket sends the query to each host of the range via
+ * unicast, paced to opts->sweep_rate probes per second, and the timeout starts after the last
+ * probe. The interface and multicast parameters are ignored in this mode.
+ *
+ * The search ends early, i.e. before the timeout, when no response arrived for opts->quiet_ms
+ * after the last one, or when opts->expected devices responded.
+ *
+ * @param cb         Callback function which is called for every found device.
+ * @param cb_ctx     Context parameter passed to the callback function as first parameter.
+ * @param opts       Search parameters, see struct xplclient_search_opts.
+ * @return Zero on success, -1 with errno set on error.
+ */
+int xplclient_search_devices_ex(xplclient_search_devices_cb cb, void *cb_ctx, const struct xplclient_search_opts *opts);
+
 /**
  * Search for a XPL device with given serial number in local network(s).
  *
@@ -57,18 +151,106 @@ int xplclient_search_devices(xplclient_search_devices_cb cb, void *cb_ctx, const
  * Usually, only one device with a given serial number should exists at all, thus only the first device's first address
  * (in case the device has multiple ones) is returned due to the limited interface. However, this should be sufficient
  * for most use-cases.
+ * Due to the interface, only responses via IPv4 are considered; use xplclient_resolve_serial for IPv6 addresses.
  *
  * @param serial     The serial number of the desired target device.
- * @param addr       Pointer to a pointer which will receive the address of the target device (if found).
- *                   This will be malloc-ed, callee is responsible for to free it after use.
+ * @param addr       Pointer to a buffer which will receive the address of the target device (if found),
+ *                   should be large enough to hold a struct sockaddr_in. May be NULL.
  * @param addrlen    Pointer to a socklen_t variable which will receive the length of the address (if target is found).
  * @return The count of matching devices (i.e. zero if no one was found at all), -1 with errno set on error.
+ *         A device which responds more than once (e.g. via several interfaces) is counted once.
  */
 int xplclient_search_by_serial(const char *serial, struct sockaddr *addr, socklen_t *addrlen);
 
+/* modes for xplclient_search_by_serial_ex */
+enum xplclient_sbs_mode {
+	XPLCLIENT_SBS_COLLECT_ALL, /* wait for the timeout and count all matching devices */
+	XPLCLIENT_SBS_FIRST_MATCH  /* return as soon as the first matching device responded */
+};
+
+/**
+ * Same as xplclient_search_by_serial, but the caller can choose whether the search returns
+ * with the first matching response (XPLCLIENT_SBS_FIRST_MATCH) or collects duplicates until
+ * the default timeout expires (XPLCLIENT_SBS_COLLECT_ALL, this is what xplclient_search_by_serial does).
+ * In first match mode, the return value is 1 if the device was found.
+ */
+int xplclient_search_by_serial_ex(const char *serial, struct sockaddr *addr, socklen_t *addrlen,
+                                  enum xplclient_sbs_mode mode);
+
+/* default time in seconds a resolved serial number is considered valid without asking again */
+#define XPLCLIENT_CACHE_DEFAULT_TTL 300
+
+/* time in milliseconds to wait for the response of a unicast query to a known address */
+#define XPLCLIENT_CACHE_REVALIDATE_TIMEOUT 250
+
+/* statistics of the serial number resolution cache */
+struct xplclient_cache_stats {
+	/* lookups answered from a valid cache entry */
+	unsigned long hits;
+
+	/* lookups of expired entries which were confirmed by a unicast query */
+	unsigned long revalidations;
+
+	/* lookups which required a multicast search */
+	unsigned long misses;
+
+	/* current count of cached devices */
+	unsigned long entries;
+};
+
+/**
+ * Resolve a serial number to the address of the XPL device.
+ *
+ * The library keeps a process-wide cache of serial numbers (trimmed, case-insensitive) and the
+ * corresponding addresses and NOTIFY information. Valid entries are returned without any network
+ * traffic. Expired entries are revalidated by a unicast query to the last known address first;
+ * only if this fails, a multicast search (in first match mode) is started. All devices which
+ * respond to such a search are added to the cache, too.
+ *
+ * @param serial     The serial number of the desired target device.
+ * @param addr       Pointer to a buffer which will receive the address of the target device (if found),
+ *                   should be large enough to hold a struct sockaddr_storage.
+ * @param addrlen    Pointer to a socklen_t variable which will receive the length of the address.
+ * @param deviceinfo Pointer to a variable which receives the NOTIFY information of the device, may be NULL.
+ *                   Callee is responsible to free the object!
+ * @return 1 if the device was found, zero if not, -1 with errno set on error.
+ */
+int xplclient_resolve_serial(const char *serial, struct sockaddr *addr, socklen_t *addrlen,
+                             struct json_object **deviceinfo);
+
+/**
+ * Set the time in seconds a cache entry is valid. A value of zero disables the cache.
+ */
+void xplclient_cache_set_ttl(unsigned int ttl);
+
+/**
+ * Persist the resolution cache in the given file.
+ *
+ * Existing entries of the file are loaded immediately, afterwards the file is rewritten whenever
+ * an address is added or changes. Passing NULL stops persisting.
+ *
+ * @return Zero on success, -1 with errno set on error.
+ */
+int xplclient_cache_set_file(const char *filename);
+
+/**
+ * Remove the entry of the given serial number, e.g. when the address turned out to be unusable.
+ */
+void xplclient_cache_invalidate(const char *serial);
+
+/**
+ * Remove all entries from the resolution cache.
+ */
+void xplclient_cache_flush(void);
+
+/**
+ * Query the statistics of the resolution cache.
+ */
+void xplclient_cache_get_stats(struct xplclient_cache_stats *stats);
+
 /**
  * This function assumes that the XPL device with the given serial number is a serial device. It searches
- * for this device by using xplclient_search_by_serial and queries the API whether remote access is possible
+ * for this device by using xplclient_resolve_serial (i.e. benefits from the resolution cache) and queries the API whether remote access is possible
  * and which port to use. Finally it tries to open a socket to this port and return this connected socket.
  * Note: Since this function uses xplclient context helpers application is required to call xplclient_init
  *       prior to use this function.
@@ -79,12 +261,214 @@ int xplclient_search_by_serial(const char *serial, struct sockaddr *addr, sockle
  */
 int xplclient_socket_by_serial(const char *serial, unsigned int comport);
 
+/* default overall time in milliseconds for xplclient_socket_by_serial_ex and _bulk */
+#define XPLCLIENT_SOCKET_DEFAULT_TIMEOUT 5000
+
+/* count of unanswered keepalive probes after which the connection is considered dead */
+#define XPLCLIENT_SOCKET_KEEPALIVE_PROBES 3
+
+/* options for xplclient_socket_by_serial_ex and xplclient_socket_by_serial_bulk */
+struct xplclient_socket_opts {
+	/* overall time in milliseconds for resolving, querying the port and connecting, zero means default;
+	 * at most half of it is spent on searching devices which are not in the resolution cache */
+	unsigned int timeout_ms;
+
+	/* set TCP_NODELAY, so that the small writes typical for serial traffic are sent immediately */
+	int nodelay;
+
+	/* send keepalive probes after this idle time in seconds (and in this interval), zero disables them */
+	unsigned int keepalive_idle;
+};
+
+/**
+ * Same as xplclient_socket_by_serial, but the whole operation is bounded by opts->timeout_ms:
+ * the search, the query of the port and the connect (which is done non-blocking). The returned
+ * socket is blocking, as the one of xplclient_socket_by_serial.
+ *
+ * @param serial     The serial number of the desired target device.
+ * @param comport    The physical port number of the target device to connect to (numbering starts at 1).
+ * @param opts       Options, NULL means the default timeout and TCP_NODELAY set.
+ * @return The socket filedescriptor on success, or -1 with errno set on error (ETIMEDOUT if the
+ *         deadline elapsed, ENODEV if the device was not found).
+ */
+int xplclient_socket_by_serial_ex(const char *serial, unsigned int comport, const struct xplclient_socket_opts *opts);
+
+/* one serial port of xplclient_socket_by_serial_bulk */
+struct xplclient_socket_item {
+	/* serial number of the device and physical port number (numbering starts at 1) */
+	const char *serial;
+	unsigned int comport;
+
+	/* result: the connected socket, or -1 on error */
+	int fd;
+
+	/* result: zero on success, or the errno value describing the error */
+	int err;
+};
+
+/**
+ * Open sockets to many serial ports at once, bounded by a single deadline.
+ *
+ * All serial numbers which are not in the resolution cache are looked up by a single search,
+ * the ports are queried over one connection per device and all connects run concurrently.
+ * A failing port does not fail the whole batch, its item just reports the error.
+ *
+ * @param items      The ports to open, the results are stored here.
+ * @param count      Count of elements of items.
+ * @param opts       Options, NULL means the default timeout and TCP_NODELAY set.
+ * @return The count of opened sockets, or -1 with errno set if the batch could not be run at all.
+ */
+int xplclient_socket_by_serial_bulk(struct xplclient_socket_item *items, unsigned int count,
+                                    const struct xplclient_socket_opts *opts);
+
+/* Long-lived device discovery which keeps a table of devices and reports changes only */
+typedef struct xplclient_discovery * xplclient_discovery_t;
+
+/* default interval between two queries in milliseconds */
+#define XPLCLIENT_DISCOVERY_DEFAULT_INTERVAL 10000
+
+/* default count of unanswered queries after which a device is considered vanished */
+#define XPLCLIENT_DISCOVERY_DEFAULT_EXPIRY 3
+
+enum xplclient_discovery_event {
+	XPLCLIENT_DISCOVERY_ADDED,   /* device responded for the first time */
+	XPLCLIENT_DISCOVERY_CHANGED, /* device's NOTIFY information or its address of a family changed */
+	XPLCLIENT_DISCOVERY_VANISHED /* device did not respond for a while and was removed */
+};
+
+/**
+ * Callback function type used by the discovery to report device table changes.
+ *
+ * @param cb_ctx     Context parameter passed to xplclient_discovery_new.
+ * @param event      What happened to the device.
+ * @param address    (Last known) address of the XPL device.
+ * @param addrlen    This argument specifies the size of address.
+ * @param deviceinfo Pointer to the root JSON object of the (last) NOTIFY response. The object
+ *                   is owned by the device table, use json_object_get to keep a reference.
+ * @return Return value is ignored at the moment, however, return 0 on sucess, -1 on error.
+ */
+typedef int (*xplclient_discovery_cb)(void *cb_ctx, enum xplclient_discovery_event event,
+                                      const struct sockaddr *address, socklen_t addrlen,
+                                      struct json_object *deviceinfo);
+
+/**
+ * Create a new discovery which periodically queries for XPL devices.
+ *
+ * The sockets are kept open for the whole lifetime of the discovery. Devices are tracked by
+ * their (trimmed) serial number, or by their MAC address if no serial is reported.
+ * The discovery does not block: the application must watch the file descriptor returned by
+ * xplclient_discovery_get_fd for readability and call xplclient_discovery_process then.
+ * The parameters interface, mc_address and port have the same meaning as for xplclient_search_devices.
+ *
+ * @param interval_ms Interval between two queries in milliseconds, zero results in the default.
+ * @param cb          Callback function which is called for every change of the device table.
+ * @param cb_ctx      Context parameter passed to the callback function as first parameter.
+ * @return The new discovery, or NULL with errno set on error.
+ */
+xplclient_discovery_t xplclient_discovery_new(const char *interface, const char *mc_address, unsigned int port,
+                                              unsigned int interval_ms, xplclient_discovery_cb cb, void *cb_ctx);
+
+/**
+ * Set the count of unanswered queries after which a device is reported as vanished.
+ */
+void xplclient_discovery_set_expiry(xplclient_discovery_t d, unsigned int rounds);
+
+/**
+ * Return a file descriptor which becomes readable when xplclient_discovery_process should be called.
+ */
+int xplclient_discovery_get_fd(xplclient_discovery_t d);
+
+/**
+ * Process all pending responses and timer events without blocking.
+ *
+ * @return Zero on success, -1 with errno set on error.
+ */
+int xplclient_discovery_process(xplclient_discovery_t d);
+
+/**
+ * Query the counters of all datagrams received by the discovery so far.
+ */
+void xplclient_discovery_get_stats(xplclient_discovery_t d, struct xplclient_search_stats *stats);
+
+/**
+ * Send out a new query immediately (in addition to the periodic ones).
+ *
+ * @return Zero on success, -1 with errno set on error.
+ */
+int xplclient_discovery_query(xplclient_discovery_t d);
+
+/**
+ * Call the given callback for every device currently in the device table. In contrast to the
+ * discovery callback, callee is responsible to free the passed deviceinfo object.
+ *
+ * @return The count of devices in the table.
+ */
+int xplclient_discovery_foreach(xplclient_discovery_t d, xplclient_search_devices_cb cb, void *cb_ctx);
+
+/**
+ * Free all resources used by the given discovery.
+ */
+void xplclient_discovery_free(xplclient_discovery_t d);
+
 /**
  * Must be called from application prior the use of all other functions. Main purpose is
  * to call libcurl's initialize function.
  */
 int xplclient_global_init(void);
 
+/**
+ * Release all library-wide resources, i.e. the pooled receive resources, the state shared
+ * by thread-safe contexts and libcurl's global state. May be called when the application
+ * does not use the library anymore, no other function may be called afterwards.
+ */
+void xplclient_global_cleanup(void);
+
+/* thread-safe state of a context */
+struct xplclient_mt;
+
+/* device shadow of a context */
+struct xplclient_shadow;
+
+/* request counters of a context */
+struct xplclient_ctx_stats;
+
+/* count of buckets of a latency histogram */
+#define XPLCLIENT_HIST_BUCKETS 16
+
+/* upper bound (exclusive, in microseconds) of bucket i of a latency histogram: 50us, 100us,
+ * 200us ... 819.2ms; the last bucket counts everything above */
+#define XPLCLIENT_HIST_BUCKET_LIMIT(i) (50ULL << (i))
+
+/* distribution of a duration */
+struct xplclient_histogram {
+	/* count of samples, sum and maximum of all samples in microseconds */
+	unsigned long count;
+	uint64_t sum_us;
+	uint64_t max_us;
+
+	/* count of samples per bucket, see XPLCLIENT_HIST_BUCKET_LIMIT */
+	unsigned long buckets[XPLCLIENT_HIST_BUCKETS];
+};
+
+/* counters of the requests to a device */
+struct xplclient_request_stats {
+	/* performed requests, and those which failed (transfer error or malformed response) */
+	unsigned long requests;
+	unsigned long failed;
+
+	/* bytes sent and received, including the HTTP headers */
+	uint64_t bytes_sent;
+	uint64_t bytes_received;
+
+	/* name resolution, TCP connect (zero on a re-used connection), time to first byte
+	 * of the response, total time of the request and time spent parsing the response */
+	struct xplclient_histogram dns;
+	struct xplclient_histogram connect;
+	struct xplclient_histogram ttfb;
+	struct xplclient_histogram total;
+	struct xplclient_histogram parse;
+};
+
 /* XPL client library context - used in multiple functions to minimize parameters */
 struct xplclient {
 	/* first part of the URL string up to the port which is passed to cURL */
@@ -95,6 +479,30 @@ struct xplclient {
 
 	/* headers to with each request */
 	struct curl_slist *headers;
+
+	/* headers to send with requests carrying a JSON body */
+	struct curl_slist *post_headers;
+
+	/* whether the connection is kept open between requests */
+	int persistent;
+
+	/* incremental parser for the response bodies, fed while they are received */
+	struct json_tokener *tok;
+
+	/* responses larger than this (in bytes) do not leave a grown parser behind */
+	size_t recv_hwm;
+
+	/* request engine of xplclient_url_get_bulk, created on first use */
+	struct xplclient_multi *bulk;
+
+	/* handles used by concurrent requests, only in thread-safe mode */
+	struct xplclient_mt *mt;
+
+	/* counters of the requests of this context, with a lock of their own */
+	struct xplclient_ctx_stats *stats;
+
+	/* last responses of GET requests, NULL if disabled */
+	struct xplclient_shadow *shadow;
 };
 
 typedef struct xplclient * xplclient_t;
@@ -124,6 +532,235 @@ xplclient_t xplclient_new_by_url(const char *url);
  */
 void xplclient_free(xplclient_t ctx);
 
+/**
+ * Enable or disable the persistent connection mode of the given XPL client context.
+ *
+ * In persistent mode (which is the default), all requests of a context share the same
+ * cURL handle, so that DNS lookup results and the HTTP keep-alive connection to the
+ * device are re-used across calls. If the device closed the connection meanwhile, a GET
+ * request is transparently retried once on a new connection; a failed write is reported
+ * to the caller instead, since it may already have reached the device.
+ * When disabled, a new connection is opened for every request and closed afterwards.
+ *
+ * @param ctx        The XPL client context.
+ * @param enable     Non-zero to enable connection re-use, zero to disable it.
+ * @return Zero on success, -1 on error.
+ */
+int xplclient_set_persistent(xplclient_t ctx, int enable);
+
+/* default receive high-water mark of a context in bytes */
+#define XPLCLIENT_DEFAULT_RECV_HWM (1024 * 1024)
+
+/**
+ * Set the receive high-water mark of the given XPL client context.
+ *
+ * The response parser of a context and its buffers are kept between requests, they grow
+ * to the size of the largest response seen. After a response larger than the high-water
+ * mark, the memory is released again instead of being kept for the lifetime of the context.
+ *
+ * @param ctx        The XPL client context.
+ * @param bytes      The high-water mark in bytes.
+ */
+void xplclient_set_recv_hwm(xplclient_t ctx, size_t bytes);
+
+/* default count of requests a thread-safe context performs at the same time */
+#define XPLCLIENT_DEFAULT_MAX_CONCURRENCY 4
+
+/**
+ * Make the given XPL client context usable by multiple threads at the same time.
+ *
+ * By default, a context performs all requests with a single cURL handle and must not be
+ * used by more than one thread at a time. In thread-safe mode, xplclient_url_get,
+ * xplclient_url_set and xplclient_url_get_extract may be called concurrently: each request
+ * takes one of a set of handles owned by the context, at most max_concurrency requests
+ * to the device are in flight, further callers wait until a handle is returned.
+ * The handles of all thread-safe contexts share DNS results, TLS sessions and the cache of
+ * kept-alive connections, so that all threads talking to a device re-use its connections.
+ *
+ * All other functions on the context (e.g. xplclient_set_persistent, xplclient_url_get_bulk
+ * or a coalescing writer) still need to be serialized by the caller. Options should be set
+ * before enabling this mode, since the handles are created as copies of the context's one.
+ * The searches, discovery and the library-wide pool and cache are thread-safe anyway.
+ *
+ * @param ctx             The XPL client context.
+ * @param max_concurrency Maximum count of parallel requests to the device, 0 for the default.
+ * @return Zero on success, -1 on error.
+ */
+int xplclient_set_threadsafe(xplclient_t ctx, unsigned int max_concurrency);
+
+/* modes of the device shadow of a context */
+enum xplclient_shadow_mode {
+	/* each GET fetches and parses the whole response (default) */
+	XPLCLIENT_SHADOW_OFF,
+	/* each GET asks the device, an unchanged response re-uses the cached tree */
+	XPLCLIENT_SHADOW_VALIDATE,
+	/* like XPLCLIENT_SHADOW_VALIDATE, but a response younger than the TTL is returned
+	 * without asking the device at all */
+	XPLCLIENT_SHADOW_TTL,
+};
+
+/* counters of the device shadow of a context */
+struct xplclient_shadow_stats {
+	/* GETs answered from the shadow without a request (XPLCLIENT_SHADOW_TTL only) */
+	unsigned long fresh;
+	/* GETs the device answered with 304 Not Modified */
+	unsigned long not_modified;
+	/* GETs with the very same body as last time, so that parsing was skipped */
+	unsigned long unchanged;
+	/* GETs whose response was parsed */
+	unsigned long fetched;
+	/* paths currently known */
+	unsigned long entries;
+};
+
+/**
+ * Enable or disable the device shadow of the given XPL client context.
+ *
+ * The shadow keeps the parsed response of each path read with xplclient_url_get. When the
+ * device sent an ETag or Last-Modified header, the next GET of the path is sent with
+ * If-None-Match or If-Modified-Since, and a 304 Not Modified response returns the cached
+ * tree. For devices without these validators, the body is hashed while it is received
+ * and only parsed if it differs from the last one. In XPLCLIENT_SHADOW_TTL mode, a
+ * response younger than ttl_ms is returned without any request at all, which suits
+ * hot read paths which tolerate slightly outdated values.
+ *
+ * A write with xplclient_url_set drops the affected paths, i.e. the path itself and all
+ * paths below or above it. Changes the device makes on its own are only seen after the
+ * TTL. The other request functions (e.g. xplclient_url_get_bulk) are not affected.
+ *
+ * With the shadow enabled, the object returned by xplclient_url_get is shared with the
+ * shadow and must not be modified; it still has to be released with json_object_put.
+ * In thread-safe mode (see xplclient_set_threadsafe), each caller gets a copy of its own
+ * instead, since json-c's reference counting is not safe across threads; enabling that
+ * mode drops all cached responses. Disabling the shadow frees all cached responses.
+ *
+ * @param ctx        The XPL client context.
+ * @param mode       The mode, see enum xplclient_shadow_mode.
+ * @param ttl_ms     Time in milliseconds a response is used without asking the device,
+ *                   only used in XPLCLIENT_SHADOW_TTL mode.
+ * @return Zero on success, -1 on error.
+ */
+int xplclient_set_shadow(xplclient_t ctx, enum xplclient_shadow_mode mode, unsigned int ttl_ms);
+
+/**
+ * Drop the cached responses of the given path and of all paths below or above it from the
+ * device shadow, so that the next GETs fetch and parse them again. Pass NULL to drop all.
+ */
+void xplclient_shadow_invalidate(xplclient_t ctx, const char *path);
+
+/**
+ * Query the counters of the device shadow of the given XPL client context. All counters
+ * are zero if the shadow is disabled.
+ */
+void xplclient_shadow_get_stats(xplclient_t ctx, struct xplclient_shadow_stats *stats);
+
+/* measurements of a single request, passed to the statistics hook */
+struct xplclient_request_sample {
+	/* path of the request, relative to the context's URL */
+	const char *path;
+
+	/* whether the transfer failed or the response was malformed */
+	int failed;
+
+	/* durations in microseconds, see struct xplclient_request_stats */
+	uint64_t dns_us;
+	uint64_t connect_us;
+	uint64_t ttfb_us;
+	uint64_t total_us;
+	uint64_t parse_us;
+
+	uint64_t bytes_sent;
+	uint64_t bytes_received;
+};
+
+/* discovery counters of a network interface */
+struct xplclient_iface_stats {
+	char name[16];
+	unsigned int ifindex;
+
+	/* search queries sent and valid responses received on this interface */
+	unsigned long queries;
+	unsigned long replies;
+};
+
+/* library-wide counters */
+struct xplclient_global_stats {
+	/* sum of the requests of all contexts (including already freed ones) */
+	struct xplclient_request_stats requests;
+
+	/* duration of xplclient_resolve_serial */
+	struct xplclient_histogram resolve;
+
+	/* duration of the TCP connect to the serial port of xplclient_socket_by_serial */
+	struct xplclient_histogram serial_connect;
+};
+
+/**
+ * Callback function prototype of the statistics hook, called after each request from the
+ * thread which performed it (i.e. possibly from several threads at the same time).
+ *
+ * @param cb_ctx     Context parameter passed to xplclient_set_stats_hook.
+ * @param ctx        The XPL client context the request was performed with.
+ * @param sample     The measurements of the request, only valid during the call.
+ */
+typedef void (*xplclient_stats_cb)(void *cb_ctx, xplclient_t ctx, const struct xplclient_request_sample *sample);
+
+/**
+ * Install a hook which is called with the measurements of every request, e.g. to export
+ * them to a monitoring system. Pass NULL to remove the hook.
+ */
+void xplclient_set_stats_hook(xplclient_stats_cb cb, void *cb_ctx);
+
+/**
+ * Query the request counters of the given XPL client context.
+ */
+void xplclient_get_stats(xplclient_t ctx, struct xplclient_request_stats *stats);
+
+/**
+ * Reset the request counters of the given XPL client context.
+ */
+void xplclient_reset_stats(xplclient_t ctx);
+
+/**
+ * Query the library-wide counters.
+ */
+void xplclient_get_global_stats(struct xplclient_global_stats *stats);
+
+/**
+ * Query the discovery counters per network interface of all searches so far.
+ *
+ * @param stats      Array receiving the counters.
+ * @param max        Count of elements of the array.
+ * @return Count of interfaces seen, might be larger than max.
+ */
+unsigned int xplclient_get_iface_stats(struct xplclient_iface_stats *stats, unsigned int max);
+
+/**
+ * Reset the library-wide and per interface counters.
+ */
+void xplclient_reset_global_stats(void);
+
+/* default count of idle response parsers and search receive rings kept in the library-wide pool */
+#define XPLCLIENT_POOL_DEFAULT_PARSERS    16
+#define XPLCLIENT_POOL_DEFAULT_RX_BUFFERS 2
+
+/**
+ * Set the limits of the library-wide pool of receive resources.
+ *
+ * Response parsers of freed contexts and finished requests, and the receive rings of
+ * finished searches (about 1 MiB each) are kept in a pool, so that short-lived contexts
+ * and repeated searches do not need to allocate them again. Limits above 64 are capped.
+ *
+ * @param parsers    Maximum count of idle response parsers to keep.
+ * @param rx_buffers Maximum count of idle search receive rings to keep.
+ */
+void xplclient_pool_set_limits(unsigned int parsers, unsigned int rx_buffers);
+
+/**
+ * Release all idle resources of the library-wide pool.
+ */
+void xplclient_pool_flush(void);
+
 
 /**
  * FIXME
@@ -135,6 +772,405 @@ struct json_object *xplclient_url_get(xplclient_t ctx, const char *path);
  */
 struct json_object *xplclient_url_set(xplclient_t ctx, const char *path, struct json_object *data);
 
+/* maximum count of parallel connections to the device used by xplclient_url_get_bulk */
+#define XPLCLIENT_BULK_MAX_CONNECTIONS 4
+
+/* one path of a bulk read */
+struct xplclient_bulk_item {
+	/* path of the request, e.g. "/v1/ai/1" */
+	const char *path;
+
+	/* key inside the response (see xplclient_json_object_get_by_key), NULL for the whole response */
+	const char *key;
+
+	/* result: the value (callee is responsible to free it), or NULL on error */
+	struct json_object *result;
+
+	/* result: zero on success, EIO if the request failed, ENOENT if the key does not exist */
+	int err;
+};
+
+/**
+ * Read many paths of one XPL device with a single call.
+ *
+ * The requests are issued in parallel over up to XPLCLIENT_BULK_MAX_CONNECTIONS connections
+ * (multiplexed over one connection if the device speaks HTTP/2), the connections are kept
+ * open for later calls. The call returns when all requests completed. A failing path does
+ * not fail the whole batch, its item just reports the error.
+ *
+ * @param ctx        The XPL client context.
+ * @param items      The paths (and optional keys) to read, the results are stored here.
+ * @param count      Count of elements of items.
+ * @return The count of items which were read successfully, or -1 if the batch could not be run at all.
+ */
+int xplclient_url_get_bulk(xplclient_t ctx, struct xplclient_bulk_item *items, unsigned int count);
+
+/* Coalescing writer - merges bursts of writes to the same path into a single request */
+typedef struct xplclient_writer * xplclient_writer_t;
+
+/* default time in milliseconds a write is held back to be merged with later ones */
+#define XPLCLIENT_WRITER_DEFAULT_DELAY 10
+
+/**
+ * Callback function type used to report the outcome of a (merged) write.
+ *
+ * @param cb_ctx     Context parameter passed to xplclient_writer_new.
+ * @param path       The path which was written.
+ * @param data       The merged JSON body which was sent. The object is owned by the writer.
+ * @param result     Pointer to the parsed JSON response of the device, or NULL if the request failed.
+ *                   Callee is responsible to free the object!
+ * @return Return value is ignored at the moment, however, return 0 on sucess, -1 on error.
+ */
+typedef int (*xplclient_writer_cb)(void *cb_ctx, const char *path, struct json_object *data, struct json_object *result);
+
+/**
+ * Create a coalescing writer for the given XPL client context.
+ *
+ * Writes passed to xplclient_writer_set are not sent immediately. Further writes to the same path
+ * within the delay are merged into the pending JSON body (for objects, the later value of a key
+ * wins; any other body replaces the pending one). All pending writes are sent when the delay of
+ * the oldest one has elapsed, or on xplclient_writer_flush.
+ *
+ * The deadline is checked on every xplclient_writer_set. To get it honoured without further writes,
+ * poll the descriptor returned by xplclient_writer_get_fd and call xplclient_writer_process when
+ * it becomes readable.
+ *
+ * @param ctx        The XPL client context to send the writes with.
+ * @param delay_ms   Maximum time in milliseconds a write is held back, zero means default.
+ * @param cb         Callback which is called with the device's response to each sent write, may be NULL.
+ * @param cb_ctx     Context parameter passed to the callback function as first parameter.
+ * @return The new writer or NULL on error.
+ */
+xplclient_writer_t xplclient_writer_new(xplclient_t ctx, unsigned int delay_ms, xplclient_writer_cb cb, void *cb_ctx);
+
+/**
+ * Queue a write of data to path. The data is copied (including nested values), so caller
+ * may release or modify it afterwards.
+ *
+ * @return Zero on success, -1 on error (or if a flush triggered by the deadline failed).
+ */
+int xplclient_writer_set(xplclient_writer_t w, const char *path, struct json_object *data);
+
+/**
+ * Send all pending writes now.
+ *
+ * @return Zero on success, -1 if at least one of the writes failed.
+ */
+int xplclient_writer_flush(xplclient_writer_t w);
+
+/**
+ * Return the descriptor which becomes readable when the deadline of the pending writes elapsed.
+ */
+int xplclient_writer_get_fd(xplclient_writer_t w);
+
+/**
+ * Send the pending writes if their deadline elapsed, call this when the descriptor is readable.
+ *
+ * @return Zero on success, -1 if at least one of the writes failed.
+ */
+int xplclient_writer_process(xplclient_writer_t w);
+
+/**
+ * Return the count of pending (merged) writes.
+ */
+int xplclient_writer_pending(xplclient_writer_t w);
+
+/**
+ * Send all pending writes and free all resources used by the writer.
+ */
+void xplclient_writer_free(xplclient_writer_t w);
+
+/* Change-detection poller - reports only the leaves which changed between two polls of a path */
+typedef struct xplclient_poller * xplclient_poller_t;
+
+/* Values passed as what parameter to xplclient_poller_cb */
+enum xplclient_poller_change {
+	XPLCLIENT_POLLER_CHANGED,
+	XPLCLIENT_POLLER_ADDED,
+	XPLCLIENT_POLLER_REMOVED,
+};
+
+/**
+ * Callback function type used to report a changed leaf.
+ *
+ * @param cb_ctx     Context parameter passed to xplclient_poller_new.
+ * @param path       The polled path, e.g. "/v1/ai/1".
+ * @param key        The key of the leaf inside the response, in the syntax of
+ *                   xplclient_json_object_get_by_key, array elements are addressed by their
+ *                   index (e.g. "channels/3/value"). An empty string for a response which is a leaf.
+ * @param what       Kind of the change, see enum xplclient_poller_change.
+ * @param old_value  Previous value, NULL for added leaves (or JSON null). The object is owned by the poller.
+ * @param new_value  Current value, NULL for removed leaves (or JSON null). The object is owned by the poller.
+ * @return Return value is ignored at the moment, however, return 0 on sucess, -1 on error.
+ */
+typedef int (*xplclient_poller_cb)(void *cb_ctx, const char *path, const char *key, enum xplclient_poller_change what,
+                                   struct json_object *old_value, struct json_object *new_value);
+
+/**
+ * Create a change-detection poller for the given XPL client context.
+ *
+ * The poller keeps the previous response of each added path. Each xplclient_poller_poll reads
+ * all paths (in parallel, see xplclient_url_get_bulk), compares the responses structurally with
+ * the previous ones, and calls the callback only for leaves which were added, removed or changed.
+ * On the first successful poll of a path, all its leaves are reported as added.
+ *
+ * @param ctx        The XPL client context to poll with.
+ * @param cb         Callback which is called for each changed leaf, may be NULL.
+ * @param cb_ctx     Context parameter passed to the callback function as first parameter.
+ * @return The new poller or NULL on error.
+ */
+xplclient_poller_t xplclient_poller_new(xplclient_t ctx, xplclient_poller_cb cb, void *cb_ctx);
+
+/**
+ * Add a path to poll, e.g. "/v1/ai/1". Adding a path twice has no effect.
+ *
+ * @return Zero on success, -1 on error.
+ */
+int xplclient_poller_add(xplclient_poller_t p, const char *path);
+
+/**
+ * Read all paths once and report the changes since the previous poll. A path which cannot be
+ * read keeps its previous response, so that its changes are reported on the next successful poll.
+ *
+ * @return The count of reported changes, or -1 on error (errno is EIO if none of the paths could be read).
+ */
+int xplclient_poller_poll(xplclient_poller_t p);
+
+/**
+ * Return the latest response of a polled path.
+ *
+ * @return The response (no new reference), or NULL if the path was not read successfully yet.
+ */
+struct json_object *xplclient_poller_get_last(xplclient_poller_t p, const char *path);
+
+/**
+ * Free all resources used by the poller.
+ */
+void xplclient_poller_free(xplclient_poller_t p);
+
+/* Time-series sampler - keeps numeric values of many devices in preallocated ring buffers */
+typedef struct xplclient_sampler * xplclient_sampler_t;
+
+/*
+ * Layout of the files written by xplclient_sampler_export. All fields are little endian
+ * (the byte order of all supported platforms), all offsets are counted from the start of
+ * the file and 8 byte aligned, so that the columns can be used in place after mmap(2).
+ *
+ *   struct xplclient_ts_header
+ *   struct xplclient_ts_channel[channels]
+ *   per channel: uint64_t timestamps[count] (ns since the epoch), double values[count]
+ *   per channel: the NUL terminated name
+ */
+#define XPLCLIENT_TS_MAGIC      "XPLTS\0\0\0"
+#define XPLCLIENT_TS_VERSION    1
+
+struct xplclient_ts_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t channels;
+
+	/* wall clock time of the export in ns since the epoch */
+	uint64_t created_ns;
+};
+
+struct xplclient_ts_channel {
+	/* count of samples */
+	uint64_t count;
+
+	/* samples which were overwritten in the ring buffer before this export */
+	uint64_t lost;
+
+	/* offsets of the timestamp and value columns and of the name */
+	uint64_t ts_offset;
+	uint64_t value_offset;
+	uint64_t name_offset;
+};
+
+/**
+ * Create a sampler keeping up to capacity samples (timestamp and value) per channel. When a
+ * ring buffer is full, the oldest sample is overwritten.
+ *
+ * @return The new sampler or NULL on error.
+ */
+xplclient_sampler_t xplclient_sampler_new(unsigned int capacity);
+
+/**
+ * Add a channel, i.e. a numeric value inside the response of a path of a device. All channels
+ * of the same context and path are read with a single request. The ring buffer of the channel
+ * is allocated here, so sampling does not allocate any memory for the samples.
+ *
+ * @param s          The sampler.
+ * @param ctx        The XPL client context of the device, must stay valid as long as the sampler.
+ * @param path       Path of the request, e.g. "/v1/ai/1".
+ * @param key        Key of the value inside the response (see xplclient_json_path_compile).
+ * @param name       Name of the channel in exported files, NULL means "<url><path>/<key>".
+ * @return The index of the new channel (numbering starts at zero), or -1 on error.
+ */
+int xplclient_sampler_add(xplclient_sampler_t s, xplclient_t ctx, const char *path, const char *key, const char *name);
+
+/**
+ * Read all channels once, the requests to different devices run in parallel. Values which are
+ * missing or not numeric (booleans count as 0 and 1) are skipped.
+ *
+ * @return The count of stored samples, or -1 on error.
+ */
+int xplclient_sampler_sample(xplclient_sampler_t s);
+
+/**
+ * Return the latest sample of a channel.
+ *
+ * @return Zero on success, -1 if the channel holds no sample (yet).
+ */
+int xplclient_sampler_latest(xplclient_sampler_t s, unsigned int channel, uint64_t *timestamp, double *value);
+
+/**
+ * Write all samples taken since the previous export (or the creation) to the given file,
+ * see struct xplclient_ts_header for the format, and empty the ring buffers. The file is
+ * replaced atomically.
+ *
+ * @return The count of exported samples, or -1 with errno set on error (the samples are kept then).
+ */
+long xplclient_sampler_export(xplclient_sampler_t s, const char *filename);
+
+/**
+ * Free all resources used by the sampler.
+ */
+void xplclient_sampler_free(xplclient_sampler_t s);
+
+/* Asynchronous request engine - drives requests to many XPL devices concurrently */
+typedef struct xplclient_multi * xplclient_multi_t;
+
+/**
+ * Callback function type used to deliver the result of an asynchronous request.
+ *
+ * @param cb_ctx     Context parameter passed when the request was queued.
+ * @param ctx        The XPL client context the request was issued for.
+ * @param path       The path of the request.
+ * @param result     Pointer to the parsed JSON response, or NULL if the request failed.
+ *                   Callee is responsible to free the object!
+ * @return Return value is ignored at the moment, however, return 0 on sucess, -1 on error.
+ */
+typedef int (*xplclient_multi_cb)(void *cb_ctx, xplclient_t ctx, const char *path, struct json_object *result);
+
+/* Values passed as what parameter to xplclient_multi_socket_cb */
+#define XPLCLIENT_POLL_IN     CURL_POLL_IN
+#define XPLCLIENT_POLL_OUT    CURL_POLL_OUT
+#define XPLCLIENT_POLL_INOUT  CURL_POLL_INOUT
+#define XPLCLIENT_POLL_REMOVE CURL_POLL_REMOVE
+
+/* Values passed as events parameter to xplclient_multi_socket_action */
+#define XPLCLIENT_EV_IN  CURL_CSELECT_IN
+#define XPLCLIENT_EV_OUT CURL_CSELECT_OUT
+#define XPLCLIENT_EV_ERR CURL_CSELECT_ERR
+
+/* Pass as fd parameter to xplclient_multi_socket_action when the timer expired */
+#define XPLCLIENT_SOCKET_TIMEOUT CURL_SOCKET_TIMEOUT
+
+/**
+ * Callback function type which informs an external event loop about the file descriptors to watch.
+ *
+ * @param cb_ctx     Context parameter passed to xplclient_multi_set_socket_cb.
+ * @param fd         The file descriptor.
+ * @param what       One of XPLCLIENT_POLL_IN, XPLCLIENT_POLL_OUT, XPLCLIENT_POLL_INOUT or
+ *                   XPLCLIENT_POLL_REMOVE (the latter means that the fd must not be watched any longer).
+ * @return Zero on success, -1 on error.
+ */
+typedef int (*xplclient_multi_socket_cb)(void *cb_ctx, int fd, int what);
+
+/**
+ * Callback function type which informs an external event loop about the timeout to use.
+ *
+ * @param cb_ctx     Context parameter passed to xplclient_multi_set_timer_cb.
+ * @param timeout_ms Milliseconds after which xplclient_multi_socket_action must be called with
+ *                   XPLCLIENT_SOCKET_TIMEOUT, -1 means to delete the timer.
+ * @return Zero on success, -1 on error.
+ */
+typedef int (*xplclient_multi_timer_cb)(void *cb_ctx, long timeout_ms);
+
+/**
+ * Create a new asynchronous request engine.
+ *
+ * @return The new engine, or NULL on error.
+ */
+xplclient_multi_t xplclient_multi_new(void);
+
+/**
+ * Free all resources of the given engine. Pending requests are aborted, their callbacks are not invoked.
+ * Must not be called from within a callback.
+ */
+void xplclient_multi_free(xplclient_multi_t m);
+
+/**
+ * Queue an asynchronous GET request. The XPL client context must stay valid until the request completed.
+ *
+ * @param m          The engine.
+ * @param ctx        The XPL client context of the target device.
+ * @param path       The path to access.
+ * @param cb         Callback which is called when the request completed or failed.
+ * @param cb_ctx     Context parameter passed to the callback function as first parameter.
+ * @return Zero on success, -1 on error.
+ */
+int xplclient_multi_add_get(xplclient_multi_t m, xplclient_t ctx, const char *path,
+                            xplclient_multi_cb cb, void *cb_ctx);
+
+/**
+ * Queue an asynchronous SET request. Same as xplclient_multi_add_get but sends the given data as
+ * request body. The data is copied, i.e. caller may release it right after this call.
+ */
+int xplclient_multi_add_set(xplclient_multi_t m, xplclient_t ctx, const char *path, struct json_object *data,
+                            xplclient_multi_cb cb, void *cb_ctx);
+
+/**
+ * Drive all queued requests without blocking and invoke the callbacks of finished ones.
+ *
+ * @param m          The engine.
+ * @param running    Pointer to a variable which receives whether requests are still pending (may be NULL).
+ * @return Zero on success, -1 on error.
+ */
+int xplclient_multi_perform(xplclient_multi_t m, int *running);
+
+/**
+ * Block until there is activity on any of the engine's connections or the timeout expired.
+ * Use xplclient_multi_perform afterwards.
+ *
+ * @return The count of file descriptors with activity, or -1 on error.
+ */
+int xplclient_multi_wait(xplclient_multi_t m, int timeout_ms);
+
+/**
+ * Convenience helper which drives all queued requests until all are finished (blocking).
+ *
+ * @return Zero on success, -1 on error.
+ */
+int xplclient_multi_run(xplclient_multi_t m);
+
+/**
+ * Register callbacks to integrate the engine into an external (e.g. epoll based) event loop.
+ * Then, call xplclient_multi_socket_action when a watched fd becomes ready or the timer expired,
+ * instead of using xplclient_multi_perform/xplclient_multi_wait.
+ */
+void xplclient_multi_set_socket_cb(xplclient_multi_t m, xplclient_multi_socket_cb cb, void *cb_ctx);
+void xplclient_multi_set_timer_cb(xplclient_multi_t m, xplclient_multi_timer_cb cb, void *cb_ctx);
+
+/**
+ * Inform the engine about activity on a file descriptor (or about an expired timer) and
+ * invoke the callbacks of finished requests.
+ *
+ * @param m          The engine.
+ * @param fd         The ready file descriptor, or XPLCLIENT_SOCKET_TIMEOUT.
+ * @param events     Bit mask of XPLCLIENT_EV_* values, or zero to let the engine figure it out.
+ * @param running    Pointer to a variable which receives whether requests are still pending (may be NULL).
+ * @return Zero on success, -1 on error.
+ */
+int xplclient_multi_socket_action(xplclient_multi_t m, int fd, int events, int *running);
+
+/**
+ * Query the maximum time in milliseconds to wait before the engine must be driven again.
+ *
+ * @return The timeout in milliseconds, or -1 if no timeout is currently set.
+ */
+long xplclient_multi_timeout(xplclient_multi_t m);
+
 /**
  * Traverse a JSON object hierarchy to access a given key of a JSON object. The path to the
  * desired key is given by a "pathname", that is a list of key names separated by /.
@@ -147,7 +1183,8 @@ struct json_object *xplclient_url_set(xplclient_t ctx, const char *path, struct
  *  }
  *
  * Then you get with the pathname "device/product" the pointer for the JSON string object
- * with content "My fine product".
+ * with content "My fine product". Numeric path elements address array elements, e.g.
+ * "channels/3/value".
  *
  * @param root       Pointer to a root JSON object where to start.
  * @param key        The path to the desired JSON key object.
@@ -155,4 +1192,83 @@ struct json_object *xplclient_url_set(xplclient_t ctx, const char *path, struct
  */
 struct json_object *xplclient_json_object_get_by_key(struct json_object *root, const char *key);
 
+/* compiled JSON path(s), see xplclient_json_path_compile */
+typedef struct xplclient_json_path *xplclient_json_path_t;
+
+/**
+ * Compile a pathname (as used by xplclient_json_object_get_by_key) once, so that it can be
+ * evaluated against many JSON objects without any string processing or memory allocation.
+ * In contrast to xplclient_json_object_get_by_key, there is no depth limit.
+ *
+ * @param path       The path to compile.
+ * @return The compiled path which must be released with xplclient_json_path_free, or NULL on error.
+ */
+xplclient_json_path_t xplclient_json_path_compile(const char *path);
+
+/**
+ * Compile several pathnames at once, so that all of them can be looked up with a single
+ * traversal using xplclient_json_path_get_multi. Common leading path elements are looked up
+ * only once, e.g. for "device/product" and "device/serial".
+ *
+ * @param paths      Array of the paths to compile.
+ * @param count      Count of elements of paths (at least 1).
+ * @return The compiled paths which must be released with xplclient_json_path_free, or NULL on error.
+ */
+xplclient_json_path_t xplclient_json_path_compile_multi(const char * const *paths, unsigned int count);
+
+/**
+ * Look up a compiled path. For multiple compiled paths, the first one is used.
+ *
+ * @param path       The compiled path.
+ * @param root       Pointer to a root JSON object where to start.
+ * @return A pointer to the desired JSON object (no new reference), or NULL if not found.
+ */
+struct json_object *xplclient_json_path_get(xplclient_json_path_t path, struct json_object *root);
+
+/**
+ * Look up all compiled paths with a single traversal of the JSON object.
+ *
+ * @param path       The compiled paths.
+ * @param root       Pointer to a root JSON object where to start.
+ * @param values     Array receiving the found objects (no new references) in the order of the
+ *                   paths at compile time, NULL for each path not found. Caller must provide
+ *                   room for as many elements as paths were compiled.
+ * @return The count of paths found.
+ */
+int xplclient_json_path_get_multi(xplclient_json_path_t path, struct json_object *root, struct json_object **values);
+
+/**
+ * Release compiled path(s).
+ *
+ * @param path       The compiled path(s), may be NULL.
+ */
+void xplclient_json_path_free(xplclient_json_path_t path);
+
+/**
+ * Callback function type used by xplclient_url_get_extract.
+ *
+ * @param cb_ctx     Context parameter passed to xplclient_url_get_extract.
+ * @param index      Index of the path (at compile time) the value belongs to.
+ * @param value      The extracted value. Callee is responsible to free the object!
+ * @return Return 0 to continue, any other value to abort the transfer (e.g. when all needed
+ *         values were received).
+ */
+typedef int (*xplclient_json_extract_cb)(void *cb_ctx, unsigned int index, struct json_object *value);
+
+/**
+ * Fetch a path from the XPL device and extract the values of the given compiled paths from the
+ * response while it is received. No object tree of the whole response is built: all other
+ * values are skipped while scanning, so large responses need little memory.
+ *
+ * @param ctx        The XPL client context.
+ * @param path       The path of the request, e.g. "/v1/channels".
+ * @param paths      Compiled paths of the values to extract (relative to the response root).
+ * @param cb         Callback function which is called for each extracted value, as soon as
+ *                   the value was completely received.
+ * @param cb_ctx     Context parameter passed to the callback function as first parameter.
+ * @return The count of extracted values, or -1 on error (e.g. network error, malformed response).
+ */
+int xplclient_url_get_extract(xplclient_t ctx, const char *path, xplclient_json_path_t paths,
+                              xplclient_json_extract_cb cb, void *cb_ctx);
+
 #endif /* XPLCLIENT_H */
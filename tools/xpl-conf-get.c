@@ -8,22 +8,54 @@
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <errno.h>
 
 #include <json.h>
 
 #include "xplclient.h"
 #include "config.h"
 
+static void print_value(struct json_object *value)
+{
+	switch (json_object_get_type(value)) {
+	case json_type_string:
+		/* representation of strings include quotation marks so handle this extra */
+		printf("%s\n", json_object_get_string(value));
+		break;
+	default:
+#if JSON_C_MINOR_VERSION > 10
+		printf("%s\n", json_object_to_json_string_ext(value, JSON_C_TO_STRING_PRETTY));
+#else
+		printf("%s\n", json_object_to_json_string(value));
+#endif
+	}
+}
+
 int main(int argc, char *argv[])
 {
+	struct xplclient_bulk_item *items;
+	int i, count, rv = 0;
 	xplclient_t xpl;
-	struct json_object *root, *value;
 
-	if (argc != 4) {
-		fprintf(stderr, "Usage: %s <host> <path> <key>\n", argv[0]);
+	if (argc < 4 || argc % 2 != 0) {
+		fprintf(stderr, "Usage: %s <host> <path> <key> [<path> <key> ...]\n", argv[0]);
 		return 1;
 	}
 
+	/* all path/key pairs are read with a single bulk request */
+	count = (argc - 2) / 2;
+
+	items = calloc(count, sizeof(struct xplclient_bulk_item));
+	if (!items) {
+		perror("calloc");
+		return 1;
+	}
+
+	for (i = 0; i < count; i++) {
+		items[i].path = argv[2 + 2 * i];
+		items[i].key = argv[3 + 2 * i];
+	}
+
 	xplclient_global_init();
 
 	xpl = xplclient_new_by_url(argv[1]);
@@ -32,33 +64,29 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
-	root = xplclient_url_get(xpl, argv[2]);
-	if (!root) {
-		fprintf(stderr, "Error accessing '%s'.\n", argv[2]);
+	if (xplclient_url_get_bulk(xpl, items, count) == -1) {
+		fprintf(stderr, "Error accessing '%s'.\n", argv[1]);
 		return 1;
 	}
 
-	value = xplclient_json_object_get_by_key(root, argv[3]);
-	if (!value) {
-		fprintf(stderr, "Key '%s' does not exist.\n", argv[3]);
-		return 1;
-	}
-
-	switch (json_object_get_type(value)) {
-	case json_type_string:
-		/* representation of strings include quotation marks so handle this extra */
-		printf("%s\n", json_object_get_string(value));
-		break;
-	default:
-#if JSON_C_MINOR_VERSION > 10
-		printf("%s\n", json_object_to_json_string_ext(value, JSON_C_TO_STRING_PRETTY));
-#else
-		printf("%s\n", json_object_to_json_string(value));
-#endif
+	for (i = 0; i < count; i++) {
+		switch (items[i].err) {
+		case 0:
+			print_value(items[i].result);
+			json_object_put(items[i].result);
+			break;
+		case ENOENT:
+			fprintf(stderr, "Key '%s' does not exist.\n", items[i].key);
+			rv = 1;
+			break;
+		default:
+			fprintf(stderr, "Error accessing '%s'.\n", items[i].path);
+			rv = 1;
+		}
 	}
 
-	json_object_put(root);
 	xplclient_free(xpl);
+	free(items);
 
-	return 0;
+	return rv;
 }
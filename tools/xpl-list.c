@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <getopt.h>
 #include <arpa/inet.h>
+#include <netdb.h>
 
 #include <json.h>
 
@@ -22,17 +23,32 @@ extern int optind;
 
 char *interface = NULL;
 char *mc_address = XPLCLIENT_DEFAULT_MC_GROUP;
+char *mc_address6 = XPLCLIENT_DEFAULT_MC_GROUP6;
+int family = AF_UNSPEC;
+char *sweep = NULL;
+unsigned int sweep_rate = XPLCLIENT_SWEEP_DEFAULT_RATE;
 unsigned int port = XPLCLIENT_DEFAULT_MC_PORT;
-int timeout = 3;
+unsigned int timeout_ms = 3000;
+unsigned int quiet_ms = 0;
+unsigned int expected = 0;
 int csv_output = 0;
+int print_stats = 0;
 
 /* command line options */
 const struct option long_options[] = {
 	{ "interface",          required_argument,      0,      'i' },
 	{ "timeout",            required_argument,      0,      't' },
+	{ "quiet",              required_argument,      0,      'q' },
+	{ "expected",           required_argument,      0,      'e' },
 	{ "mc-address",         required_argument,      0,      'a' },
+	{ "mc-address6",        required_argument,      0,      'A' },
+	{ "ipv4",               no_argument,            0,      '4' },
+	{ "ipv6",               no_argument,            0,      '6' },
 	{ "port",               required_argument,      0,      'p' },
+	{ "sweep",              required_argument,      0,      'w' },
+	{ "rate",               required_argument,      0,      'r' },
 	{ "csv",                no_argument,            0,      'C' },
+	{ "stats",              no_argument,            0,      'S' },
 	{ "version",            no_argument,            0,      'V' },
 	{ "help",               no_argument,            0,      'h' },
 
@@ -42,10 +58,18 @@ const struct option long_options[] = {
 /* descriptions for the command line options */
 const char *long_options_descs[] = {
 	"interface to use (default: use all available interfaces)",
-	"response timeout (default: 3s)",
+	"response timeout in seconds, or in milliseconds with suffix ms (default, or 0: 3s)",
+	"end the search when no response arrived for this many milliseconds (default: wait for the timeout)",
+	"end the search when this count of devices responded (default: wait for the timeout)",
 	"multicast address (default: " XPLCLIENT_DEFAULT_MC_GROUP ")",
+	"IPv6 multicast address (default: " XPLCLIENT_DEFAULT_MC_GROUP6 ")",
+	"search via IPv4 only",
+	"search via IPv6 only",
 	"port to use (default: " __stringify(XPLCLIENT_DEFAULT_MC_PORT) ")",
+	"probe each host of the given IPv4 CIDR range via unicast instead of multicast",
+	"probes per second when sweeping (default: " __stringify(XPLCLIENT_SWEEP_DEFAULT_RATE) ")",
 	"print found devices with CSV delimiters",
+	"print receive counters of the search",
 	"print version and exit",
 	"print this usage and exit",
 	NULL /* stop condition for iterator */
@@ -72,13 +96,31 @@ void usage(char *p, int exitcode)
 	exit(exitcode);
 }
 
+/* parse a timeout given in seconds or with "ms" suffix in milliseconds, returns milliseconds or -1 */
+int parse_timeout(const char *arg)
+{
+	char *end;
+	unsigned long v = strtoul(arg, &end, 10);
+
+	if (end == arg)
+		return -1;
+
+	if (strcmp(end, "ms") == 0)
+		return (v <= 60000) ? (int)v : -1;
+
+	if (*end == '\0' || strcmp(end, "s") == 0)
+		return (v <= 60) ? (int)v * 1000 : -1;
+
+	return -1;
+}
+
 /* parse options from the command line */
 int options_parse_cli(int argc, char * argv[])
 {
-	int rc = EXIT_FAILURE;
+	int rc = EXIT_FAILURE, v;
 
 	while (1) {
-		int c = getopt_long(argc, argv, "i:t:a:p:CVh", long_options, NULL);
+		int c = getopt_long(argc, argv, "i:t:q:e:a:A:46p:w:r:CSVh", long_options, NULL);
 
 		/* detect the end of the options */
 		if (c == -1) break;
@@ -97,16 +139,54 @@ int options_parse_cli(int argc, char * argv[])
 		case 'a':
 			mc_address = optarg;
 			break;
+		case 'A':
+			mc_address6 = optarg;
+			break;
+		case '4':
+			family = AF_INET;
+			break;
+		case '6':
+			family = AF_INET6;
+			break;
+		case 'w':
+			sweep = optarg;
+			break;
+		case 'r':
+			sweep_rate = atoi(optarg);
+			if (sweep_rate == 0 || sweep_rate > 1000000) {
+				fprintf(stderr, "Error: Rate must be in range [1, 1000000] probes per second.");
+				exit(EXIT_FAILURE);
+			}
+			break;
 		case 't':
-			timeout = atoi(optarg);
-			if (timeout < 0 || timeout > 10) {
-				fprintf(stderr, "Error: Timeout must be in range [0, 10] seconds.");
+			/* zero selects the default, as it always did */
+			v = parse_timeout(optarg);
+			if (v == -1) {
+				fprintf(stderr, "Error: Timeout must be in range [0, 60s].");
+				exit(EXIT_FAILURE);
+			}
+			timeout_ms = v;
+			break;
+		case 'q':
+			quiet_ms = atoi(optarg);
+			if (quiet_ms == 0 || quiet_ms > 60000) {
+				fprintf(stderr, "Error: Quiet period must be in range [1, 60000] milliseconds.");
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'e':
+			expected = atoi(optarg);
+			if (expected == 0) {
+				fprintf(stderr, "Error: Expected count of devices must be at least 1.");
 				exit(EXIT_FAILURE);
 			}
 			break;
 		case 'C':
 			csv_output = 1;
 			break;
+		case 'S':
+			print_stats = 1;
+			break;
 		case 'V':
 			fprintf(stderr, "%s (%s)\n", argv[0], PACKAGE_STRING);
 			exit(EXIT_SUCCESS);
@@ -126,7 +206,7 @@ int options_parse_cli(int argc, char * argv[])
 
 int print_device(void *ctx, const struct sockaddr *address, socklen_t addrlen, struct json_object *deviceinfo)
 {
-	struct sockaddr_in *addr = (struct sockaddr_in *)address;
+	char host[NI_MAXHOST];
 	struct json_object *serial = NULL, *mac = NULL, *product = NULL, *sw_version = NULL;
 
 #if JSON_C_MINOR_VERSION > 10
@@ -141,7 +221,10 @@ int print_device(void *ctx, const struct sockaddr *address, socklen_t addrlen, s
 	sw_version = json_object_object_get(deviceinfo, "software_version");
 #endif
 
-	printf(csv_output ? "%s;%s;%s;%s;%s\n" : PRETTY_FORMAT, inet_ntoa(addr->sin_addr),
+	if (getnameinfo(address, addrlen, host, sizeof(host), NULL, 0, NI_NUMERICHOST) != 0)
+		strcpy(host, "-");
+
+	printf(csv_output ? "%s;%s;%s;%s;%s\n" : PRETTY_FORMAT, host,
 	       serial ? json_object_get_string(serial) : "-",
 	       mac ? json_object_get_string(mac) : "-",
 	       sw_version ? json_object_get_string(sw_version) : "-",
@@ -154,8 +237,24 @@ int print_device(void *ctx, const struct sockaddr *address, socklen_t addrlen, s
 
 int main(int argc, char *argv[])
 {
+	struct xplclient_search_stats stats;
+	struct xplclient_search_opts opts;
+
 	options_parse_cli(argc, argv);
 
+	memset(&opts, 0, sizeof(opts));
+	opts.interface = interface;
+	opts.mc_address = mc_address;
+	opts.mc_address6 = mc_address6;
+	opts.family = family;
+	opts.port = port;
+	opts.timeout_ms = timeout_ms;
+	opts.quiet_ms = quiet_ms;
+	opts.expected = expected;
+	opts.sweep = sweep;
+	opts.sweep_rate = sweep_rate;
+	opts.stats = &stats;
+
 	if (csv_output) {
 		fprintf(stderr, "IP Address;Serial;MAC Address;SW Version;Product\n");
 	} else {
@@ -163,5 +262,12 @@ int main(int argc, char *argv[])
 		fprintf(stderr, PRETTY_FORMAT, "----------------", "----------", "-----------------", "----------", "-------------");
 	}
 
-	return xplclient_search_devices(print_device, NULL, interface, mc_address, port, timeout) ? EXIT_FAILURE : EXIT_SUCCESS;
+	if (xplclient_search_devices_ex(print_device, NULL, &opts))
+		return EXIT_FAILURE;
+
+	if (print_stats)
+		fprintf(stderr, "\nreceived: %lu, processed: %lu, garbled: %lu, truncated: %lu, dropped: %lu\n",
+		        stats.received, stats.processed, stats.garbled, stats.truncated, stats.dropped);
+
+	return EXIT_SUCCESS;
 }
@@ -0,0 +1,880 @@
+/*
+ * Copyright © 2017 Michael Heimpold <mhei@heimpold.de>
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+/* splice(2) */
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <termios.h>
+#include <netdb.h>
+
+#include "stringify.h"
+#include "xplclient.h"
+#include "config.h"
+
+extern char *optarg;
+extern int optind;
+
+char *serial = NULL;
+unsigned int comport = 1;
+char *host = NULL;
+char *link_path = NULL;
+char *unix_path = NULL;
+unsigned int batch_us = 0;
+unsigned int batch_size = 4096;
+unsigned int timeout_ms = XPLCLIENT_SOCKET_DEFAULT_TIMEOUT;
+unsigned int keepalive = 10;
+unsigned int reconnect_ms = 1000;
+unsigned int stats_interval = 0;
+int no_splice = 0;
+
+volatile sig_atomic_t terminate = 0;
+
+/* command line options */
+const struct option long_options[] = {
+	{ "serial",             required_argument,      0,      's' },
+	{ "comport",            required_argument,      0,      'c' },
+	{ "host",               required_argument,      0,      'H' },
+	{ "link",               required_argument,      0,      'l' },
+	{ "unix",               required_argument,      0,      'u' },
+	{ "batch",              required_argument,      0,      'b' },
+	{ "batch-size",         required_argument,      0,      'B' },
+	{ "timeout",            required_argument,      0,      't' },
+	{ "keepalive",          required_argument,      0,      'k' },
+	{ "reconnect",          required_argument,      0,      'r' },
+	{ "stats",              required_argument,      0,      'S' },
+	{ "no-splice",          no_argument,            0,      'n' },
+	{ "version",            no_argument,            0,      'V' },
+	{ "help",               no_argument,            0,      'h' },
+
+	{} /* stop condition for iterator */
+};
+
+/* descriptions for the command line options */
+const char *long_options_descs[] = {
+	"serial number of the XPL device",
+	"physical port number of the device (default: 1)",
+	"connect to host:port directly instead of looking up the serial number ([address]:port for IPv6)",
+	"create a symlink with this name pointing to the PTY",
+	"listen on this Unix socket instead of creating a PTY",
+	"hold data back up to this many microseconds to send it in larger chunks (default: 0, send at once)",
+	"... but send as soon as this many bytes are pending (default: 4096)",
+	"time in milliseconds to find the device and connect (default: " __stringify(XPLCLIENT_SOCKET_DEFAULT_TIMEOUT) ")",
+	"TCP keepalive idle time in seconds, 0 disables it (default: 10)",
+	"wait this many milliseconds before reconnecting (default: 1000)",
+	"print throughput and latency every this many seconds (default: never)",
+	"copy via read/write only, do not try zero-copy splice",
+	"print version and exit",
+	"print this usage and exit",
+	NULL /* stop condition for iterator */
+};
+
+void usage(char *p, int exitcode)
+{
+	const char **desc = long_options_descs;
+	const struct option *op = long_options;
+
+	fprintf(stderr,
+		"%s (%s) -- relay a serial port of a XPL device to a local PTY or Unix socket\n\n"
+		"Usage: %s -s <serial> [options]\n"
+		"       %s -H <host:port> [options]\n\n"
+		"The connection to the device is re-established automatically when it is lost.\n\n"
+		"Options:\n",
+		p, PACKAGE_STRING, p, p);
+
+	while (op->name && desc) {
+		fprintf(stderr, "\t-%c, --%-12s\t%s\n", op->val, op->name, *desc);
+		op++; desc++;
+	}
+
+	fprintf(stderr, "\n");
+
+	exit(exitcode);
+}
+
+/* parse a number in the given range or exit */
+unsigned int parse_uint(const char *arg, const char *what, unsigned long min, unsigned long max)
+{
+	char *end;
+	unsigned long v = strtoul(arg, &end, 10);
+
+	if (*arg == '\0' || *end != '\0' || v < min || v > max) {
+		fprintf(stderr, "Error: %s must be in range [%lu, %lu].\n", what, min, max);
+		exit(EXIT_FAILURE);
+	}
+
+	return v;
+}
+
+/* parse options from the command line */
+int options_parse_cli(int argc, char * argv[])
+{
+	int rc = EXIT_FAILURE;
+
+	while (1) {
+		int c = getopt_long(argc, argv, "s:c:H:l:u:b:B:t:k:r:S:nVh", long_options, NULL);
+
+		/* detect the end of the options */
+		if (c == -1) break;
+
+		switch (c) {
+		case 's':
+			serial = optarg;
+			break;
+		case 'c':
+			comport = parse_uint(optarg, "Port number", 1, 255);
+			break;
+		case 'H':
+			host = optarg;
+			break;
+		case 'l':
+			link_path = optarg;
+			break;
+		case 'u':
+			unix_path = optarg;
+			break;
+		case 'b':
+			batch_us = parse_uint(optarg, "Batch time", 0, 1000000);
+			break;
+		case 'B':
+			batch_size = parse_uint(optarg, "Batch size", 1, 65536);
+			break;
+		case 't':
+			timeout_ms = parse_uint(optarg, "Timeout", 1, 600000);
+			break;
+		case 'k':
+			keepalive = parse_uint(optarg, "Keepalive time", 0, 7200);
+			break;
+		case 'r':
+			reconnect_ms = parse_uint(optarg, "Reconnect delay", 0, 600000);
+			break;
+		case 'S':
+			stats_interval = parse_uint(optarg, "Statistics interval", 1, 3600);
+			break;
+		case 'n':
+			no_splice = 1;
+			break;
+		case 'V':
+			fprintf(stderr, "%s (%s)\n", argv[0], PACKAGE_STRING);
+			exit(EXIT_SUCCESS);
+		case '?':
+		case 'h':
+			rc = EXIT_SUCCESS;
+			/* fall-through */
+		default:
+			usage(argv[0], rc);
+		}
+	}
+
+	if (!serial == !host) {
+		fprintf(stderr, "Error: Exactly one of --serial and --host must be given.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (link_path && unix_path) {
+		fprintf(stderr, "Error: --link is only possible with a PTY.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return 0;
+}
+
+void sig_handler(int sig)
+{
+	terminate = 1;
+}
+
+uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* capacity of the buffer of a direction, a pipe holds 64 KiB by default */
+#define RELAY_CAPACITY 65536
+
+/* one direction of the relay: in -> pipe (or buffer) -> out */
+struct relay {
+	const char *name;
+	int in, out;
+
+	/* pipe for zero-copy relaying, or -1 if splice is not possible for this direction */
+	int pipe[2];
+
+	/* buffer used instead of the pipe */
+	char *buf;
+	size_t off;
+
+	/* count of bytes in the pipe or buffer, and when the oldest of them arrived */
+	size_t pending;
+	uint64_t since;
+
+	/* counters */
+	uint64_t bytes;
+	unsigned long writes;
+	uint64_t hold_ns, hold_max_ns;
+	unsigned long holds;
+};
+
+int relay_init(struct relay *r, const char *name)
+{
+	memset(r, 0, sizeof(*r));
+	r->name = name;
+	r->in = r->out = -1;
+	r->pipe[0] = r->pipe[1] = -1;
+
+	r->buf = malloc(RELAY_CAPACITY);
+	if (!r->buf)
+		return -1;
+
+	if (!no_splice && pipe2(r->pipe, O_NONBLOCK | O_CLOEXEC) == -1)
+		r->pipe[0] = r->pipe[1] = -1;
+
+	return 0;
+}
+
+void relay_close_pipe(struct relay *r)
+{
+	if (r->pipe[0] == -1)
+		return;
+
+	close(r->pipe[0]);
+	close(r->pipe[1]);
+	r->pipe[0] = r->pipe[1] = -1;
+}
+
+/* fall back to read/write, the data already in the pipe is moved to the buffer */
+void relay_no_splice(struct relay *r)
+{
+	ssize_t n;
+
+	if (r->pipe[0] == -1)
+		return;
+
+	r->off = 0;
+	r->pending = 0;
+	while ((n = read(r->pipe[0], r->buf + r->pending, RELAY_CAPACITY - r->pending)) > 0)
+		r->pending += n;
+
+	relay_close_pipe(r);
+}
+
+/* throw away pending data, e.g. when the receiver is gone */
+void relay_discard(struct relay *r)
+{
+	char scratch[4096];
+
+	if (r->pipe[0] != -1)
+		while (read(r->pipe[0], scratch, sizeof(scratch)) > 0)
+			;
+
+	r->off = 0;
+	r->pending = 0;
+}
+
+/* read what is available from in, returns 0 on EOF, -1 on error and 1 otherwise */
+int relay_fill(struct relay *r)
+{
+	ssize_t n;
+
+	if (r->pending >= RELAY_CAPACITY)
+		return 1;
+
+	if (r->pipe[0] != -1) {
+		n = splice(r->in, NULL, r->pipe[1], NULL, RELAY_CAPACITY - r->pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (n == -1 && errno == EINVAL) {
+			/* not supported by this kind of descriptor (e.g. a PTY on older kernels) */
+			relay_no_splice(r);
+			return relay_fill(r);
+		}
+	} else {
+		/* keep the buffer contiguous */
+		if (r->off && r->off + r->pending == RELAY_CAPACITY) {
+			memmove(r->buf, r->buf + r->off, r->pending);
+			r->off = 0;
+		}
+		n = read(r->in, r->buf + r->off + r->pending, RELAY_CAPACITY - r->off - r->pending);
+	}
+
+	if (n == -1)
+		return (errno == EAGAIN || errno == EINTR) ? 1 : -1;
+
+	if (n == 0)
+		return 0;
+
+	if (!r->pending)
+		r->since = now_ns();
+
+	r->pending += n;
+	r->bytes += n;
+	return 1;
+}
+
+/* whether the pending data should be sent now */
+int relay_due(const struct relay *r, uint64_t now)
+{
+	if (!r->pending || r->out == -1)
+		return 0;
+
+	return !batch_us || r->pending >= batch_size || now - r->since >= (uint64_t)batch_us * 1000;
+}
+
+/* milliseconds until held back data becomes due, -1 if there is none
+ * (data which is already due but still pending waits for the receiver to become writable) */
+int relay_due_ms(const struct relay *r, uint64_t now)
+{
+	if (!r->pending || r->out == -1 || relay_due(r, now))
+		return -1;
+
+	return (r->since + (uint64_t)batch_us * 1000 - now + 999999) / 1000000;
+}
+
+/* write pending data to out, returns -1 on error */
+int relay_flush(struct relay *r)
+{
+	uint64_t hold;
+	ssize_t n;
+
+	while (r->pending) {
+		if (r->pipe[0] != -1) {
+			n = splice(r->pipe[0], NULL, r->out, NULL, r->pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (n == -1 && errno == EINVAL) {
+				relay_no_splice(r);
+				continue;
+			}
+		} else {
+			n = write(r->out, r->buf + r->off, r->pending);
+		}
+
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			/* the receiver is busy, the rest is sent when it becomes writable again */
+			return (errno == EAGAIN) ? 0 : -1;
+		}
+
+		r->writes++;
+		r->pending -= n;
+		r->off = r->pending ? r->off + n : 0;
+	}
+
+	/* how long the oldest byte of this batch was held back in the bridge */
+	hold = now_ns() - r->since;
+	r->hold_ns += hold;
+	r->holds++;
+	if (hold > r->hold_max_ns)
+		r->hold_max_ns = hold;
+
+	return 0;
+}
+
+/* send all due data, returns the relay whose receiver failed or NULL */
+struct relay *relays_flush(struct relay *rl, uint64_t now)
+{
+	int i;
+
+	for (i = 0; i < 2; i++)
+		if (relay_due(&rl[i], now) && relay_flush(&rl[i]) == -1)
+			return &rl[i];
+
+	return NULL;
+}
+
+/* counters at the last report */
+struct report {
+	uint64_t at;
+	uint64_t bytes[2];
+	unsigned long writes[2];
+};
+
+void relay_report(struct relay *rl, struct report *last, int remote, unsigned int reconnects)
+{
+	struct tcp_info ti;
+	socklen_t len = sizeof(ti);
+	uint64_t now = now_ns();
+	double secs = (now - last->at) / 1e9;
+	int i;
+
+	fprintf(stderr, "stats:");
+
+	for (i = 0; i < 2; i++) {
+		fprintf(stderr, " %s %.1f KiB/s in %lu writes, hold avg %.3f max %.3f ms;",
+		        rl[i].name, (rl[i].bytes - last->bytes[i]) / 1024.0 / secs, rl[i].writes - last->writes[i],
+		        rl[i].holds ? rl[i].hold_ns / 1e6 / rl[i].holds : 0.0, rl[i].hold_max_ns / 1e6);
+
+		last->bytes[i] = rl[i].bytes;
+		last->writes[i] = rl[i].writes;
+		rl[i].hold_ns = rl[i].hold_max_ns = 0;
+		rl[i].holds = 0;
+	}
+
+	/* round trip time to the device as seen by the kernel */
+	if (remote != -1 && getsockopt(remote, IPPROTO_TCP, TCP_INFO, &ti, &len) == 0)
+		fprintf(stderr, " rtt %.3f ms,", ti.tcpi_rtt / 1000.0);
+
+	fprintf(stderr, " reconnects %u\n", reconnects);
+
+	last->at = now;
+}
+
+/* same socket options as the library applies when connecting by serial number */
+int set_keepalive(int s)
+{
+	int one = 1, v;
+
+	if (!keepalive)
+		return 0;
+
+	if (setsockopt(s, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one)) == -1)
+		return -1;
+
+	v = keepalive;
+	if (setsockopt(s, IPPROTO_TCP, TCP_KEEPIDLE, &v, sizeof(v)) == -1 ||
+	    setsockopt(s, IPPROTO_TCP, TCP_KEEPINTVL, &v, sizeof(v)) == -1)
+		return -1;
+
+	v = XPLCLIENT_SOCKET_KEEPALIVE_PROBES;
+	return setsockopt(s, IPPROTO_TCP, TCP_KEEPCNT, &v, sizeof(v));
+}
+
+/* connect a non-blocking socket within the given time, the socket is blocking again afterwards */
+int connect_timeout(int s, const struct sockaddr *addr, socklen_t addrlen, int ms)
+{
+	struct pollfd pfd = { .fd = s, .events = POLLOUT };
+	socklen_t len = sizeof(int);
+	int err = 0, rv;
+
+	if (connect(s, addr, addrlen) == -1) {
+		if (errno != EINPROGRESS)
+			return -1;
+
+		rv = poll(&pfd, 1, ms);
+		if (rv == -1)
+			return -1;
+		if (rv == 0) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+
+		if (getsockopt(s, SOL_SOCKET, SO_ERROR, &err, &len) == -1)
+			return -1;
+		if (err) {
+			errno = err;
+			return -1;
+		}
+	}
+
+	return fcntl(s, F_SETFL, fcntl(s, F_GETFL) & ~O_NONBLOCK);
+}
+
+/* connect directly to host:port, an IPv6 address is given in brackets, e.g. [fe80::1%eth0]:2000 */
+int connect_host(const char *hostport)
+{
+	struct addrinfo hints, *res, *ai;
+	uint64_t deadline, now;
+	char *h, *p, *name;
+	int s = -1, one = 1, err = ETIMEDOUT;
+
+	h = strdup(hostport);
+	if (!h)
+		return -1;
+
+	p = strrchr(h, ':');
+	if (!p)
+		goto inval_out;
+	*p++ = '\0';
+
+	name = h;
+	if (*name == '[') {
+		if (p - h < 3 || p[-2] != ']')
+			goto inval_out;
+		p[-2] = '\0';
+		name++;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	if (getaddrinfo(name, p, &hints, &res) != 0) {
+		free(h);
+		errno = EHOSTUNREACH;
+		return -1;
+	}
+
+	/* the timeout covers all addresses of the host together */
+	deadline = now_ns() + timeout_ms * 1000000ULL;
+
+	for (ai = res; ai; ai = ai->ai_next) {
+		now = now_ns();
+		if (now >= deadline)
+			break;
+
+		s = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK, ai->ai_protocol);
+		if (s == -1) {
+			err = errno;
+			continue;
+		}
+		if (connect_timeout(s, ai->ai_addr, ai->ai_addrlen, (deadline - now + 999999) / 1000000) == 0)
+			break;
+		err = errno;
+		close(s);
+		s = -1;
+	}
+
+	freeaddrinfo(res);
+	free(h);
+
+	if (s == -1) {
+		errno = err;
+		return -1;
+	}
+
+	setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	if (set_keepalive(s) == -1) {
+		err = errno;
+		close(s);
+		errno = err;
+		return -1;
+	}
+
+	return s;
+
+inval_out:
+	free(h);
+	errno = EINVAL;
+	return -1;
+}
+
+int connect_remote(void)
+{
+	struct xplclient_socket_opts opts;
+	int s;
+
+	if (host) {
+		s = connect_host(host);
+	} else {
+		memset(&opts, 0, sizeof(opts));
+		opts.timeout_ms = timeout_ms;
+		/* the bridge does the batching itself, so what it hands over should go out immediately */
+		opts.nodelay = 1;
+		opts.keepalive_idle = keepalive;
+
+		s = xplclient_socket_by_serial_ex(serial, comport, &opts);
+	}
+
+	if (s != -1)
+		fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+
+	return s;
+}
+
+/* create the PTY, returns the master; the slave is kept open, so that the master does not hang up */
+int open_pty(int *slave)
+{
+	struct termios tio;
+	char *name;
+	int m;
+
+	m = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (m == -1)
+		return -1;
+
+	if (grantpt(m) == -1 || unlockpt(m) == -1 || !(name = ptsname(m)))
+		goto close_out;
+
+	*slave = open(name, O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if (*slave == -1)
+		goto close_out;
+
+	/* the data is binary, no line discipline processing */
+	if (tcgetattr(*slave, &tio) == 0) {
+		cfmakeraw(&tio);
+		tcsetattr(*slave, TCSANOW, &tio);
+	}
+
+	fprintf(stderr, "PTY: %s\n", name);
+
+	if (link_path) {
+		unlink(link_path);
+		if (symlink(name, link_path) == -1) {
+			perror("symlink");
+			close(*slave);
+			goto close_out;
+		}
+	}
+
+	return m;
+
+close_out:
+	close(m);
+	return -1;
+}
+
+int open_unix(void)
+{
+	struct sockaddr_un sun;
+	int s;
+
+	if (strlen(unix_path) >= sizeof(sun.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	s = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (s == -1)
+		return -1;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strcpy(sun.sun_path, unix_path);
+
+	unlink(unix_path);
+	if (bind(s, (struct sockaddr *)&sun, sizeof(sun)) == -1 || listen(s, 1) == -1) {
+		close(s);
+		return -1;
+	}
+
+	fprintf(stderr, "Listening on %s\n", unix_path);
+
+	return s;
+}
+
+int main(int argc, char *argv[])
+{
+	/* relays[0]: device -> local, relays[1]: local -> device */
+	struct relay relays[2], *failed;
+	struct report last;
+	struct pollfd pfds[3];
+	struct sigaction sa;
+	int listener = -1, local = -1, slave = -1, remote = -1;
+	unsigned int i, n, reconnects = 0;
+	uint64_t now, retry_at = 0, report_at = 0;
+	int timeout, ms, rv;
+
+	options_parse_cli(argc, argv);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sig_handler;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sa, NULL);
+
+	if (relay_init(&relays[0], "net->local") == -1 || relay_init(&relays[1], "local->net") == -1) {
+		perror("relay_init");
+		return EXIT_FAILURE;
+	}
+
+	xplclient_global_init();
+
+	if (unix_path) {
+		listener = open_unix();
+		if (listener == -1) {
+			perror("unix socket");
+			return EXIT_FAILURE;
+		}
+	} else {
+		local = open_pty(&slave);
+		if (local == -1) {
+			perror("pty");
+			return EXIT_FAILURE;
+		}
+	}
+
+	memset(&last, 0, sizeof(last));
+	last.at = now_ns();
+	if (stats_interval)
+		report_at = last.at + (uint64_t)stats_interval * 1000000000;
+
+	while (!terminate) {
+		now = now_ns();
+
+		if (remote == -1 && now >= retry_at) {
+			remote = connect_remote();
+			if (remote == -1) {
+				fprintf(stderr, "Connecting failed: %s, retrying in %u ms\n", strerror(errno), reconnect_ms);
+				retry_at = now_ns() + (uint64_t)reconnect_ms * 1000000;
+			} else {
+				fprintf(stderr, "Connected\n");
+			}
+		}
+
+		relays[0].in = remote;
+		relays[0].out = local;
+		relays[1].in = local;
+		relays[1].out = remote;
+
+		/* send what is due, e.g. left over from a previous round */
+		failed = relays_flush(relays, now);
+		if (failed)
+			goto out_gone;
+
+		n = 0;
+		timeout = -1;
+
+		if (listener != -1 && local == -1) {
+			pfds[n].fd = listener;
+			pfds[n].events = POLLIN;
+			n++;
+		}
+
+		/* pfds[n] is the remote side, pfds[n + 1] the local one */
+		for (i = 0; i < 2; i++) {
+			int fd = i ? local : remote;
+			struct relay *rin = &relays[i], *rout = &relays[1 - i];
+
+			pfds[n + i].fd = fd;
+			pfds[n + i].events = 0;
+			pfds[n + i].revents = 0;
+
+			/* only take more data when it can be passed on, the rest waits in the kernel buffers */
+			if (rin->out != -1 && rin->pending < RELAY_CAPACITY)
+				pfds[n + i].events |= POLLIN;
+			if (relay_due(rout, now))
+				pfds[n + i].events |= POLLOUT;
+		}
+
+		/* wake up for held back data, a reconnect and the next report */
+		for (i = 0; i < 2; i++) {
+			ms = relay_due_ms(&relays[i], now);
+			if (ms != -1 && (timeout == -1 || ms < timeout))
+				timeout = ms;
+		}
+		if (remote == -1) {
+			ms = (retry_at > now) ? (retry_at - now + 999999) / 1000000 : 0;
+			if (timeout == -1 || ms < timeout)
+				timeout = ms;
+		}
+		if (report_at) {
+			ms = (report_at > now) ? (report_at - now + 999999) / 1000000 : 0;
+			if (timeout == -1 || ms < timeout)
+				timeout = ms;
+		}
+
+		rv = poll(pfds, n + 2, timeout);
+		if (rv == -1) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+
+		if (listener != -1 && local == -1 && pfds[0].revents) {
+			local = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (local != -1)
+				fprintf(stderr, "Client connected\n");
+		}
+
+		/* Errors and hang-ups are reported whatever was requested: without reading, poll would
+		 * return right away forever. A hang-up with data still to read is only handled when
+		 * reading, i.e. after passing on what is left. */
+		for (i = 0; i < 2; i++) {
+			if (pfds[n + i].events & POLLIN)
+				continue;
+			if ((pfds[n + i].revents & (POLLERR | POLLNVAL)) ||
+			    ((pfds[n + i].revents & POLLHUP) && relays[i].out == -1)) {
+				if (i)
+					goto local_gone;
+				goto remote_gone;
+			}
+		}
+
+		/* device -> local */
+		if ((pfds[n].events & POLLIN) && (pfds[n].revents & (POLLIN | POLLHUP | POLLERR))) {
+			rv = relay_fill(&relays[0]);
+			if (rv <= 0)
+				goto remote_gone;
+		}
+
+		/* local -> device */
+		if ((pfds[n + 1].events & POLLIN) && (pfds[n + 1].revents & (POLLIN | POLLHUP | POLLERR))) {
+			rv = relay_fill(&relays[1]);
+			if (rv <= 0)
+				goto local_gone;
+		}
+
+		now = now_ns();
+		failed = relays_flush(relays, now);
+		if (failed)
+			goto out_gone;
+
+		if (report_at && now >= report_at) {
+			relay_report(relays, &last, remote, reconnects);
+			report_at = now + (uint64_t)stats_interval * 1000000000;
+		}
+
+		continue;
+
+out_gone:
+		if (failed->out != remote)
+			goto local_gone;
+
+remote_gone:
+		/* data of the local side stays pending and is sent after reconnecting */
+		fprintf(stderr, "Connection to the device lost\n");
+		if (remote != -1)
+			close(remote);
+		remote = -1;
+		reconnects++;
+		retry_at = now_ns() + (uint64_t)reconnect_ms * 1000000;
+		continue;
+
+local_gone:
+		/* only a client of the Unix socket can go away, the PTY slave is kept open */
+		if (listener != -1) {
+			fprintf(stderr, "Client disconnected\n");
+			close(local);
+			local = -1;
+			relay_discard(&relays[0]);
+			continue;
+		}
+
+		perror("pty");
+		break;
+	}
+
+	if (stats_interval)
+		relay_report(relays, &last, remote, reconnects);
+
+	if (remote != -1)
+		close(remote);
+	if (local != -1)
+		close(local);
+	if (slave != -1)
+		close(slave);
+	if (listener != -1) {
+		close(listener);
+		unlink(unix_path);
+	}
+	if (link_path)
+		unlink(link_path);
+
+	for (i = 0; i < 2; i++) {
+		relay_close_pipe(&relays[i]);
+		free(relays[i].buf);
+	}
+
+	return terminate ? EXIT_SUCCESS : EXIT_FAILURE;
+}
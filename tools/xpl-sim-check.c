@@ -0,0 +1,325 @@
+/*
+ * Copyright © 2017 Michael Heimpold <mhei@heimpold.de>
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <time.h>
+
+#include <json.h>
+
+#include "stringify.h"
+#include "xplclient.h"
+#include "config.h"
+
+extern char *optarg;
+extern int optind;
+
+unsigned int expected = 0;
+unsigned int min_percent = 100;
+unsigned int max_ms = 0;
+unsigned int rounds = 1;
+char *interface = NULL;
+char *mc_address = XPLCLIENT_DEFAULT_MC_GROUP;
+char *sweep = NULL;
+unsigned int port = XPLCLIENT_DEFAULT_MC_PORT;
+int timeout = 3;
+
+/* command line options */
+const struct option long_options[] = {
+	{ "expected",           required_argument,      0,      'n' },
+	{ "min-percent",        required_argument,      0,      'm' },
+	{ "max-time",           required_argument,      0,      'T' },
+	{ "rounds",             required_argument,      0,      'R' },
+	{ "interface",          required_argument,      0,      'i' },
+	{ "mc-address",         required_argument,      0,      'a' },
+	{ "sweep",              required_argument,      0,      'w' },
+	{ "port",               required_argument,      0,      'p' },
+	{ "timeout",            required_argument,      0,      't' },
+	{ "version",            no_argument,            0,      'V' },
+	{ "help",               no_argument,            0,      'h' },
+
+	{} /* stop condition for iterator */
+};
+
+/* descriptions for the command line options */
+const char *long_options_descs[] = {
+	"count of devices which should be found (required)",
+	"a round passes if at least this percentage is found (default: 100)",
+	"... and if that many are found within this time in milliseconds (default: no limit)",
+	"count of searches (default: 1)",
+	"interface to use (default: use all available interfaces)",
+	"multicast address (default: " XPLCLIENT_DEFAULT_MC_GROUP ")",
+	"probe each host of the given IPv4 CIDR range via unicast instead of multicast",
+	"port to use (default: " __stringify(XPLCLIENT_DEFAULT_MC_PORT) ")",
+	"response timeout (default: 3s)",
+	"print version and exit",
+	"print this usage and exit",
+	NULL /* stop condition for iterator */
+};
+
+void usage(char *p, int exitcode)
+{
+	const char **desc = long_options_descs;
+	const struct option *op = long_options;
+
+	fprintf(stderr,
+		"%s (%s) -- check that a search finds the expected count of XPL devices\n\n"
+		"Usage: %s -n <expected> [options]\n\n"
+		"Each round is printed as one JSON object to stdout, the exit code is zero\n"
+		"only if all rounds passed.\n\n"
+		"Options:\n",
+		p, PACKAGE_STRING, p);
+
+	while (op->name && desc) {
+		fprintf(stderr, "\t-%c, --%-12s\t%s\n", op->val, op->name, *desc);
+		op++; desc++;
+	}
+
+	fprintf(stderr, "\n");
+
+	exit(exitcode);
+}
+
+/* parse a number in the given range or exit */
+unsigned int parse_uint(const char *arg, const char *what, unsigned long min, unsigned long max)
+{
+	char *end;
+	unsigned long v = strtoul(arg, &end, 10);
+
+	if (*arg == '\0' || *end != '\0' || v < min || v > max) {
+		fprintf(stderr, "Error: %s must be in range [%lu, %lu].\n", what, min, max);
+		exit(EXIT_FAILURE);
+	}
+
+	return v;
+}
+
+/* parse options from the command line */
+int options_parse_cli(int argc, char * argv[])
+{
+	int rc = EXIT_FAILURE;
+
+	while (1) {
+		int c = getopt_long(argc, argv, "n:m:T:R:i:a:w:p:t:Vh", long_options, NULL);
+
+		/* detect the end of the options */
+		if (c == -1) break;
+
+		switch (c) {
+		case 'n':
+			expected = parse_uint(optarg, "Expected count", 1, 10000000);
+			break;
+		case 'm':
+			min_percent = parse_uint(optarg, "Percentage", 0, 100);
+			break;
+		case 'T':
+			max_ms = parse_uint(optarg, "Maximum time", 1, 600000);
+			break;
+		case 'R':
+			rounds = parse_uint(optarg, "Round count", 1, 100000);
+			break;
+		case 'i':
+			interface = optarg;
+			break;
+		case 'a':
+			mc_address = optarg;
+			break;
+		case 'w':
+			sweep = optarg;
+			break;
+		case 'p':
+			port = parse_uint(optarg, "Port", 1, 65535);
+			break;
+		case 't':
+			timeout = parse_uint(optarg, "Timeout", 1, 60);
+			break;
+		case 'V':
+			fprintf(stderr, "%s (%s)\n", argv[0], PACKAGE_STRING);
+			exit(EXIT_SUCCESS);
+		case '?':
+		case 'h':
+			rc = EXIT_SUCCESS;
+			/* fall-through */
+		default:
+			usage(argv[0], rc);
+		}
+	}
+
+	if (!expected)
+		usage(argv[0], EXIT_FAILURE);
+
+	return 0;
+}
+
+uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* state of a single search round */
+struct round {
+	uint64_t start;
+
+	/* time of the first response, and when the pass threshold and the expected count were reached */
+	uint64_t first_us, threshold_us, complete_us;
+
+	/* open addressing hash set of the serial numbers seen, to count each device only once */
+	char **serials;
+	unsigned int count, size;
+	unsigned long duplicates;
+};
+
+/* count of devices needed to pass */
+unsigned int needed;
+
+unsigned int hash_serial(const char *s)
+{
+	unsigned int h = 2166136261u;
+
+	while (*s)
+		h = (h ^ (unsigned char)*s++) * 16777619u;
+
+	return h;
+}
+
+/* add a serial number, returns 1 if added, 0 if already known, -1 on error */
+int add_serial(struct round *r, const char *serial)
+{
+	unsigned int i;
+
+	/* more devices than expected answered: keep at least one slot free */
+	if (r->count + 1 >= r->size)
+		return -1;
+
+	for (i = hash_serial(serial) & (r->size - 1); r->serials[i]; i = (i + 1) & (r->size - 1))
+		if (strcmp(r->serials[i], serial) == 0)
+			return 0;
+
+	r->serials[i] = strdup(serial);
+	if (!r->serials[i])
+		return -1;
+
+	r->count++;
+	return 1;
+}
+
+int collect_device(void *ctx, const struct sockaddr *address, socklen_t addrlen, struct json_object *deviceinfo)
+{
+	struct round *r = (struct round *)ctx;
+	struct json_object *serial = NULL;
+	uint64_t t = now_us() - r->start;
+	const char *s;
+	int rv = XPLCLIENT_SEARCH_CONTINUE;
+
+	if (!r->first_us)
+		r->first_us = t;
+
+#if JSON_C_MINOR_VERSION > 10
+	json_object_object_get_ex(deviceinfo, "serial", &serial);
+#else
+	serial = json_object_object_get(deviceinfo, "serial");
+#endif
+
+	if (!serial || !(s = json_object_get_string(serial)))
+		goto out;
+
+	switch (add_serial(r, s)) {
+	case 0:
+		r->duplicates++;
+		goto out;
+	case -1:
+		goto out;
+	}
+
+	if (r->count == needed)
+		r->threshold_us = t;
+
+	/* all devices answered, the remaining timeout is not interesting */
+	if (r->count == expected) {
+		r->complete_us = t;
+		rv = XPLCLIENT_SEARCH_STOP;
+	}
+
+out:
+	json_object_put(deviceinfo);
+	return rv;
+}
+
+int main(int argc, char *argv[])
+{
+	struct xplclient_search_stats stats;
+	struct xplclient_search_opts opts;
+	struct round r;
+	unsigned int i, j, failed = 0;
+	uint64_t elapsed;
+	int pass;
+
+	options_parse_cli(argc, argv);
+
+	needed = ((uint64_t)expected * min_percent + 99) / 100;
+	if (!needed)
+		needed = 1;
+
+	memset(&opts, 0, sizeof(opts));
+	opts.interface = interface;
+	opts.mc_address = mc_address;
+	opts.family = AF_INET;
+	opts.port = port;
+	opts.timeout = timeout;
+	opts.sweep = sweep;
+	opts.stats = &stats;
+
+	for (i = 0; i < rounds; i++) {
+		memset(&r, 0, sizeof(r));
+		memset(&stats, 0, sizeof(stats));
+
+		/* the hash set is kept at most half full */
+		for (r.size = 256; r.size < expected * 2; r.size *= 2)
+			;
+		r.serials = calloc(r.size, sizeof(char *));
+		if (!r.serials) {
+			perror("calloc");
+			return EXIT_FAILURE;
+		}
+
+		r.start = now_us();
+
+		if (xplclient_search_devices_ex(collect_device, &r, &opts)) {
+			perror("search");
+			return EXIT_FAILURE;
+		}
+
+		elapsed = now_us() - r.start;
+
+		/* enough devices found, and that in time */
+		pass = r.threshold_us && (!max_ms || r.threshold_us <= (uint64_t)max_ms * 1000);
+		if (!pass)
+			failed++;
+
+		printf("{\"round\": %u, \"expected\": %u, \"found\": %u, \"duplicates\": %lu, "
+		       "\"first_ms\": %.1f, \"threshold_ms\": %.1f, \"complete_ms\": %.1f, \"elapsed_ms\": %.1f, "
+		       "\"received\": %lu, \"garbled\": %lu, \"truncated\": %lu, \"dropped\": %lu, "
+		       "\"pass\": %s}\n",
+		       i + 1, expected, r.count, r.duplicates,
+		       r.first_us / 1000.0, r.threshold_us / 1000.0, r.complete_us / 1000.0, elapsed / 1000.0,
+		       stats.received, stats.garbled, stats.truncated, stats.dropped,
+		       pass ? "true" : "false");
+		fflush(stdout);
+
+		for (j = 0; j < r.size; j++)
+			free(r.serials[j]);
+		free(r.serials);
+	}
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
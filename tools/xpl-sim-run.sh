@@ -0,0 +1,50 @@
+#!/bin/sh
+#
+# Copyright © 2017 Michael Heimpold <mhei@heimpold.de>
+#
+# SPDX-License-Identifier: GPL-3.0
+#
+# Discovery load test: start xpl-sim on the loopback interface, search it with
+# xpl-sim-check and report discovered vs. expected devices and the time to
+# complete. The exit code is zero only if all rounds passed the thresholds.
+#
+# usage: xpl-sim-run.sh [-n devices] [-j jitter_ms] [-s reply_size] [-m min_percent]
+#                       [-T max_ms] [-R rounds] [-t timeout] [-p port]
+#
+# The programs are taken from the directory given by XPL_SIM_BINDIR (default: .).
+
+devices=1000
+jitter=100
+size=0
+percent=100
+maxtime=
+rounds=3
+timeout=3
+port=41090
+
+while getopts "n:j:s:m:T:R:t:p:" opt; do
+	case $opt in
+	n) devices=$OPTARG ;;
+	j) jitter=$OPTARG ;;
+	s) size=$OPTARG ;;
+	m) percent=$OPTARG ;;
+	T) maxtime="-T $OPTARG" ;;
+	R) rounds=$OPTARG ;;
+	t) timeout=$OPTARG ;;
+	p) port=$OPTARG ;;
+	*) echo "usage: $0 [-n devices] [-j jitter_ms] [-s reply_size] [-m min_percent] [-T max_ms] [-R rounds] [-t timeout] [-p port]" >&2
+	   exit 2 ;;
+	esac
+done
+
+bindir=${XPL_SIM_BINDIR:-.}
+
+"$bindir/xpl-sim" -n "$devices" -j "$jitter" -s "$size" -p "$port" 2>/dev/null &
+sim=$!
+trap 'kill $sim 2>/dev/null; wait $sim 2>/dev/null' EXIT INT TERM
+
+# give the simulator time to bind its socket
+sleep 0.2
+
+"$bindir/xpl-sim-check" -n "$devices" -m "$percent" $maxtime -R "$rounds" -t "$timeout" \
+	-w 127.0.0.1/32 -p "$port"
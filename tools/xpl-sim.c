@@ -0,0 +1,322 @@
+/*
+ * Copyright © 2017 Michael Heimpold <mhei@heimpold.de>
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+
+#include "stringify.h"
+#include "xplclient.h"
+#include "config.h"
+
+extern char *optarg;
+extern int optind;
+
+unsigned int devices = 1000;
+unsigned int jitter_ms = 100;
+unsigned int reply_size = 0;
+unsigned int port = XPLCLIENT_DEFAULT_MC_PORT;
+char *mc_address = XPLCLIENT_DEFAULT_MC_GROUP;
+char *interface = NULL;
+unsigned int seed = 0;
+int verbose = 0;
+
+volatile sig_atomic_t terminate = 0;
+
+/* command line options */
+const struct option long_options[] = {
+	{ "devices",            required_argument,      0,      'n' },
+	{ "jitter",             required_argument,      0,      'j' },
+	{ "size",               required_argument,      0,      's' },
+	{ "port",               required_argument,      0,      'p' },
+	{ "mc-address",         required_argument,      0,      'a' },
+	{ "interface",          required_argument,      0,      'i' },
+	{ "seed",               required_argument,      0,      'S' },
+	{ "verbose",            no_argument,            0,      'v' },
+	{ "version",            no_argument,            0,      'V' },
+	{ "help",               no_argument,            0,      'h' },
+
+	{} /* stop condition for iterator */
+};
+
+/* descriptions for the command line options */
+const char *long_options_descs[] = {
+	"count of simulated devices (default: 1000)",
+	"replies are spread randomly over this time in milliseconds (default: 100)",
+	"pad each reply to about this size in bytes (default: no padding)",
+	"UDP port to listen on (default: " __stringify(XPLCLIENT_DEFAULT_MC_PORT) ")",
+	"multicast group to join (default: " XPLCLIENT_DEFAULT_MC_GROUP ")",
+	"interface to join the multicast group on (default: chosen by the kernel)",
+	"seed of the random jitter (default: time based)",
+	"print each answered query",
+	"print version and exit",
+	"print this usage and exit",
+	NULL /* stop condition for iterator */
+};
+
+void usage(char *p, int exitcode)
+{
+	const char **desc = long_options_descs;
+	const struct option *op = long_options;
+
+	fprintf(stderr,
+		"%s (%s) -- simulate a farm of XPL devices answering search queries\n\n"
+		"Usage: %s [options]\n\n"
+		"Unicast queries (e.g. xpl-list --sweep 127.0.0.1/32) are answered, too, so the\n"
+		"simulator can be used on the loopback interface or in a network namespace.\n\n"
+		"Options:\n",
+		p, PACKAGE_STRING, p);
+
+	while (op->name && desc) {
+		fprintf(stderr, "\t-%c, --%-12s\t%s\n", op->val, op->name, *desc);
+		op++; desc++;
+	}
+
+	fprintf(stderr, "\n");
+
+	exit(exitcode);
+}
+
+/* parse a number in the given range or exit */
+unsigned int parse_uint(const char *arg, const char *what, unsigned long min, unsigned long max)
+{
+	char *end;
+	unsigned long v = strtoul(arg, &end, 10);
+
+	if (*arg == '\0' || *end != '\0' || v < min || v > max) {
+		fprintf(stderr, "Error: %s must be in range [%lu, %lu].\n", what, min, max);
+		exit(EXIT_FAILURE);
+	}
+
+	return v;
+}
+
+/* parse options from the command line */
+int options_parse_cli(int argc, char * argv[])
+{
+	int rc = EXIT_FAILURE;
+
+	while (1) {
+		int c = getopt_long(argc, argv, "n:j:s:p:a:i:S:vVh", long_options, NULL);
+
+		/* detect the end of the options */
+		if (c == -1) break;
+
+		switch (c) {
+		case 'n':
+			devices = parse_uint(optarg, "Device count", 1, 1000000);
+			break;
+		case 'j':
+			jitter_ms = parse_uint(optarg, "Jitter", 0, 60000);
+			break;
+		case 's':
+			reply_size = parse_uint(optarg, "Reply size", 0, 60000);
+			break;
+		case 'p':
+			port = parse_uint(optarg, "Port", 1, 65535);
+			break;
+		case 'a':
+			mc_address = optarg;
+			break;
+		case 'i':
+			interface = optarg;
+			break;
+		case 'S':
+			seed = parse_uint(optarg, "Seed", 0, ~0u);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'V':
+			fprintf(stderr, "%s (%s)\n", argv[0], PACKAGE_STRING);
+			exit(EXIT_SUCCESS);
+		case '?':
+		case 'h':
+			rc = EXIT_SUCCESS;
+			/* fall-through */
+		default:
+			usage(argv[0], rc);
+		}
+	}
+
+	return 0;
+}
+
+void sig_handler(int sig)
+{
+	terminate = 1;
+}
+
+/* when which device replies, relative to the query */
+struct reply_slot {
+	unsigned long us;
+	unsigned int dev;
+};
+
+int compare_slot(const void *a, const void *b)
+{
+	const struct reply_slot *x = a, *y = b;
+
+	return (x->us > y->us) - (x->us < y->us);
+}
+
+/* build the NOTIFY packet of a device, returns its length */
+int build_reply(char *pkt, size_t size, unsigned int dev)
+{
+	char body[60000 + 256];
+	int blen, pad;
+
+	blen = snprintf(body, sizeof(body),
+	                "{\"serial\": \"%08u\", \"mac_address\": \"00:01:87:%02x:%02x:%02x\", "
+	                "\"product\": \"XPL simulator\", \"software_version\": \"1.0\"",
+	                20000000 + dev, (dev >> 16) & 0xff, (dev >> 8) & 0xff, dev & 0xff);
+
+	/* fill up to the requested size, e.g. to stress the receive buffers */
+	pad = (int)reply_size - blen - 16;
+	if (pad > 0) {
+		blen += snprintf(body + blen, sizeof(body) - blen, ", \"pad\": \"");
+		memset(body + blen, 'x', pad);
+		blen += pad;
+		blen += snprintf(body + blen, sizeof(body) - blen, "\"");
+	}
+	blen += snprintf(body + blen, sizeof(body) - blen, "}");
+
+	return snprintf(pkt, size,
+	                "NOTIFY * HTTP/1.0\r\n"
+	                "Content-Type: application/json\r\n"
+	                "Content-Length: %d\r\n"
+	                "\r\n"
+	                "%s", blen, body);
+}
+
+int open_socket(void)
+{
+	struct sockaddr_in addr;
+	struct ip_mreqn mreq;
+	int s, one = 1;
+
+	s = socket(AF_INET, SOCK_DGRAM, 0);
+	if (s == -1)
+		return -1;
+
+	setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+
+	if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		close(s);
+		return -1;
+	}
+
+	/* not fatal: without the membership, unicast queries are still answered */
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.imr_multiaddr.s_addr = inet_addr(mc_address);
+	mreq.imr_ifindex = interface ? if_nametoindex(interface) : 0;
+	if (setsockopt(s, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == -1)
+		fprintf(stderr, "Warning: Could not join multicast group %s: %s\n", mc_address, strerror(errno));
+
+	return s;
+}
+
+/* send the replies of all devices according to their slots */
+void answer(int s, const struct reply_slot *slots, const struct sockaddr *peer, socklen_t peerlen)
+{
+	struct timespec start, due;
+	static char pkt[65536];
+	unsigned int i;
+	int len;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < devices && !terminate; i++) {
+		due.tv_sec = start.tv_sec + slots[i].us / 1000000;
+		due.tv_nsec = start.tv_nsec + (slots[i].us % 1000000) * 1000;
+		if (due.tv_nsec >= 1000000000) {
+			due.tv_sec++;
+			due.tv_nsec -= 1000000000;
+		}
+
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
+
+		len = build_reply(pkt, sizeof(pkt), slots[i].dev);
+		if (sendto(s, pkt, len, 0, peer, peerlen) == -1 && verbose)
+			fprintf(stderr, "sendto: %s\n", strerror(errno));
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_storage peer;
+	struct reply_slot *slots;
+	struct sigaction sa;
+	char buf[2048], host[INET6_ADDRSTRLEN];
+	socklen_t peerlen;
+	unsigned int i;
+	ssize_t len;
+	int s;
+
+	options_parse_cli(argc, argv);
+
+	if (!seed)
+		seed = time(NULL) ^ getpid();
+
+	slots = calloc(devices, sizeof(struct reply_slot));
+	if (!slots) {
+		perror("calloc");
+		return EXIT_FAILURE;
+	}
+
+	s = open_socket();
+	if (s == -1) {
+		perror("socket");
+		return EXIT_FAILURE;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sig_handler;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	fprintf(stderr, "Simulating %u devices on port %u, jitter %u ms, seed %u\n", devices, port, jitter_ms, seed);
+
+	while (!terminate) {
+		peerlen = sizeof(peer);
+		len = recvfrom(s, buf, sizeof(buf) - 1, 0, (struct sockaddr *)&peer, &peerlen);
+		if (len <= 0)
+			continue;
+		buf[len] = '\0';
+
+		/* only answer XPL search queries */
+		if (!strstr(buf, "NT: i2se:iodevice"))
+			continue;
+
+		if (verbose && inet_ntop(AF_INET, &((struct sockaddr_in *)&peer)->sin_addr, host, sizeof(host)))
+			fprintf(stderr, "Query from %s:%u\n", host, ntohs(((struct sockaddr_in *)&peer)->sin_port));
+
+		/* a new random order and timing for each query */
+		for (i = 0; i < devices; i++) {
+			slots[i].dev = i;
+			slots[i].us = jitter_ms ? (unsigned long)(rand_r(&seed) % (jitter_ms * 1000)) : 0;
+		}
+		qsort(slots, devices, sizeof(struct reply_slot), compare_slot);
+
+		answer(s, slots, (struct sockaddr *)&peer, peerlen);
+	}
+
+	close(s);
+	free(slots);
+	return EXIT_SUCCESS;
+}
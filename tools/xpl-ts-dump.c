@@ -0,0 +1,274 @@
+/*
+ * Copyright © 2017 Michael Heimpold <mhei@heimpold.de>
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <endian.h>
+#include <time.h>
+
+#include "xplclient.h"
+#include "config.h"
+
+extern char *optarg;
+extern int optind;
+
+int csv_output = 0;
+int channel = -1;
+
+/* command line options */
+const struct option long_options[] = {
+	{ "csv",                no_argument,            0,      'c' },
+	{ "channel",            required_argument,      0,      'C' },
+	{ "version",            no_argument,            0,      'V' },
+	{ "help",               no_argument,            0,      'h' },
+
+	{} /* stop condition for iterator */
+};
+
+/* descriptions for the command line options */
+const char *long_options_descs[] = {
+	"print all samples with CSV delimiters instead of a summary",
+	"only this channel (numbering starts at zero)",
+	"print version and exit",
+	"print this usage and exit",
+	NULL /* stop condition for iterator */
+};
+
+void usage(char *p, int exitcode)
+{
+	const char **desc = long_options_descs;
+	const struct option *op = long_options;
+
+	fprintf(stderr,
+		"%s (%s) -- dump a time-series file written by xplclient_sampler_export\n\n"
+		"Usage: %s [options] <file>\n\n"
+		"Without options, a summary of each channel is printed. Timestamps are given\n"
+		"in seconds since the epoch.\n\n"
+		"Options:\n",
+		p, PACKAGE_STRING, p);
+
+	while (op->name && desc) {
+		fprintf(stderr, "\t-%c, --%-12s\t%s\n", op->val, op->name, *desc);
+		op++; desc++;
+	}
+
+	fprintf(stderr, "\n");
+
+	exit(exitcode);
+}
+
+/* parse options from the command line */
+int options_parse_cli(int argc, char * argv[])
+{
+	int rc = EXIT_FAILURE;
+
+	while (1) {
+		int c = getopt_long(argc, argv, "cC:Vh", long_options, NULL);
+
+		/* detect the end of the options */
+		if (c == -1) break;
+
+		switch (c) {
+		case 'c':
+			csv_output = 1;
+			break;
+		case 'C':
+			channel = atoi(optarg);
+			if (channel < 0) {
+				fprintf(stderr, "Error: Channel must not be negative.\n");
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'V':
+			fprintf(stderr, "%s (%s)\n", argv[0], PACKAGE_STRING);
+			exit(EXIT_SUCCESS);
+		case '?':
+		case 'h':
+			rc = EXIT_SUCCESS;
+			/* fall-through */
+		default:
+			usage(argv[0], rc);
+		}
+	}
+
+	if (optind != argc - 1)
+		usage(argv[0], EXIT_FAILURE);
+
+	return 0;
+}
+
+/* the mapped file */
+const unsigned char *base;
+size_t size;
+
+/* read a little endian 64 bit word of a column */
+uint64_t get64(uint64_t offset, uint64_t index)
+{
+	uint64_t v;
+
+	memcpy(&v, base + offset + index * sizeof(v), sizeof(v));
+
+	return le64toh(v);
+}
+
+double get_double(uint64_t offset, uint64_t index)
+{
+	uint64_t v = get64(offset, index);
+	double d;
+
+	memcpy(&d, &v, sizeof(d));
+
+	return d;
+}
+
+/* read and check a directory entry, returns -1 if it points outside the file */
+int get_channel(unsigned int i, struct xplclient_ts_channel *ch, const char **name)
+{
+	const struct xplclient_ts_channel *p;
+
+	p = (const struct xplclient_ts_channel *)(base + sizeof(struct xplclient_ts_header)) + i;
+
+	ch->count = le64toh(p->count);
+	ch->lost = le64toh(p->lost);
+	ch->ts_offset = le64toh(p->ts_offset);
+	ch->value_offset = le64toh(p->value_offset);
+	ch->name_offset = le64toh(p->name_offset);
+
+	if (ch->count > size / sizeof(uint64_t) ||
+	    ch->ts_offset > size || size - ch->ts_offset < ch->count * sizeof(uint64_t) ||
+	    ch->value_offset > size || size - ch->value_offset < ch->count * sizeof(uint64_t) ||
+	    ch->name_offset >= size || !memchr(base + ch->name_offset, '\0', size - ch->name_offset))
+		return -1;
+
+	*name = (const char *)base + ch->name_offset;
+	return 0;
+}
+
+void print_time(uint64_t ns)
+{
+	printf("%llu.%09llu", (unsigned long long)(ns / 1000000000), (unsigned long long)(ns % 1000000000));
+}
+
+void print_summary(unsigned int i, const struct xplclient_ts_channel *ch, const char *name)
+{
+	double v, min = 0, max = 0, sum = 0;
+	uint64_t j;
+
+	for (j = 0; j < ch->count; j++) {
+		v = get_double(ch->value_offset, j);
+		if (j == 0 || v < min)
+			min = v;
+		if (j == 0 || v > max)
+			max = v;
+		sum += v;
+	}
+
+	printf("%u: %s\n", i, name);
+	printf("\tsamples: %llu, lost: %llu\n", (unsigned long long)ch->count, (unsigned long long)ch->lost);
+
+	if (!ch->count)
+		return;
+
+	printf("\tfirst: ");
+	print_time(get64(ch->ts_offset, 0));
+	printf(", last: ");
+	print_time(get64(ch->ts_offset, ch->count - 1));
+	printf("\n\tmin: %g, max: %g, avg: %g\n", min, max, sum / ch->count);
+}
+
+void print_csv(const struct xplclient_ts_channel *ch, const char *name)
+{
+	uint64_t j;
+
+	for (j = 0; j < ch->count; j++) {
+		printf("%s;", name);
+		print_time(get64(ch->ts_offset, j));
+		printf(";%.17g\n", get_double(ch->value_offset, j));
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	const struct xplclient_ts_header *hdr;
+	struct xplclient_ts_channel ch;
+	unsigned int i, channels;
+	const char *name;
+	struct stat st;
+	time_t created;
+	int fd;
+
+	options_parse_cli(argc, argv);
+
+	fd = open(argv[optind], O_RDONLY);
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		perror(argv[optind]);
+		return EXIT_FAILURE;
+	}
+	size = st.st_size;
+
+	if (size < sizeof(*hdr)) {
+		fprintf(stderr, "Error: %s is too short.\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+
+	base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (base == MAP_FAILED) {
+		perror("mmap");
+		return EXIT_FAILURE;
+	}
+	close(fd);
+
+	hdr = (const struct xplclient_ts_header *)base;
+	channels = le32toh(hdr->channels);
+
+	if (memcmp(hdr->magic, XPLCLIENT_TS_MAGIC, sizeof(hdr->magic)) != 0 ||
+	    le32toh(hdr->version) != XPLCLIENT_TS_VERSION) {
+		fprintf(stderr, "Error: %s is not a time-series file of version %d.\n", argv[optind], XPLCLIENT_TS_VERSION);
+		return EXIT_FAILURE;
+	}
+
+	if (channels > (size - sizeof(*hdr)) / sizeof(struct xplclient_ts_channel)) {
+		fprintf(stderr, "Error: %s is truncated.\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+
+	if (channel >= (int)channels) {
+		fprintf(stderr, "Error: The file contains %u channels only.\n", channels);
+		return EXIT_FAILURE;
+	}
+
+	if (csv_output) {
+		printf("Channel;Timestamp;Value\n");
+	} else {
+		created = le64toh(hdr->created_ns) / 1000000000;
+		printf("exported: %s", ctime(&created));
+		printf("channels: %u\n", channels);
+	}
+
+	for (i = 0; i < channels; i++) {
+		if (channel != -1 && i != channel)
+			continue;
+
+		if (get_channel(i, &ch, &name) == -1) {
+			fprintf(stderr, "Error: Channel %u is corrupt.\n", i);
+			return EXIT_FAILURE;
+		}
+
+		if (csv_output)
+			print_csv(&ch, name);
+		else
+			print_summary(i, &ch, name);
+	}
+
+	munmap((void *)base, size);
+	return EXIT_SUCCESS;
+}